@@ -0,0 +1,76 @@
+#!/bin/bash
+# 对比模拟Proactor(-a 0)和Reactor(-a 1)两种并发模型在小文件和大文件下的吞吐
+#
+# 用法: ./bench_modes.sh path_to_WebServer [port] [clients] [seconds]，两种模式分别使用port+2*i和port+2*i+1
+# 需要WebServer的网站根目录下存在small_file和large_file指定的两个文件，网站根目录可以用DOC_ROOT指定
+# 环境变量:
+#   TOOL=webbench|loadgen  压测程序，默认webbench；loadgen是闭环模式，额外给出p99服务时间
+#   SERVER_CPUS/CLIENT_CPUS  用taskset把服务器和压测程序绑定到不同的CPU上，例如SERVER_CPUS=0-3 CLIENT_CPUS=4-7；
+#                            不指定时在多核机器上把CPU对半分开，只有一个CPU时不绑定并给出提示
+#   ROUNDS  每种组合测几轮，默认1；两种模式轮流测，避免机器状态的变化只落在其中一种模式上
+
+SERVER=${1:?usage: $0 path_to_WebServer [port] [clients] [seconds]}
+PORT=${2:-9006}
+CLIENTS=${3:-1000}
+TIME=${4:-10}
+SMALL_FILE=${SMALL_FILE:-/index.html}
+LARGE_FILE=${LARGE_FILE:-/big.bin}
+TOOL=${TOOL:-webbench}
+ROUNDS=${ROUNDS:-1}
+BENCH=$(dirname "$0")/$TOOL
+ROOT_OPT=${DOC_ROOT:+-r $DOC_ROOT}
+
+if [ "$TOOL" != webbench ] && [ "$TOOL" != loadgen ]; then
+    echo "TOOL must be webbench or loadgen" >&2
+    exit 1
+fi
+if [ ! -x "$BENCH" ]; then
+    make -C "$(dirname "$0")" $TOOL >/dev/null || exit 1
+fi
+
+CPUS=$(nproc)
+if [ -z "$SERVER_CPUS" ] && [ -z "$CLIENT_CPUS" ] && [ "$CPUS" -ge 2 ]; then
+    SERVER_CPUS=0-$((CPUS / 2 - 1))
+    CLIENT_CPUS=$((CPUS / 2))-$((CPUS - 1))
+fi
+if [ -z "$SERVER_CPUS" ] && [ -z "$CLIENT_CPUS" ]; then
+    echo "only $CPUS CPU: server and client share it, the difference between the modes is not meaningful" >&2
+fi
+SERVER_PIN=${SERVER_CPUS:+taskset -c $SERVER_CPUS}
+CLIENT_PIN=${CLIENT_CPUS:+taskset -c $CLIENT_CPUS}
+echo "server cpus: ${SERVER_CPUS:-any}, client cpus: ${CLIENT_CPUS:-any}, tool: $TOOL, $CLIENTS clients, ${TIME}s"
+
+#输出一行: 请求数/秒 字节数/秒 p99 失败数
+run_bench() {
+    local url=$1 out
+    if [ $TOOL = webbench ]; then
+        out=$($CLIENT_PIN "$BENCH" -2 -c $CLIENTS -t $TIME $url 2>/dev/null)
+        echo "$out" | sed -n 's/^Speed=\([0-9]*\) pages\/min, \([0-9]*\) bytes\/sec.*/\1 \2/p' | awk '{printf "%.0f %.0f ", $1 / 60, $2}'
+        echo "$out" | sed -n 's/.* \([0-9]*\) failed.*/- \1/p'
+    else
+        #连接数较多时按每个线程约250个连接分配线程
+        out=$($CLIENT_PIN "$BENCH" -c $CLIENTS -T $(((CLIENTS + 249) / 250)) -d $TIME $url 2>/dev/null)
+        #结束时还在途的请求(unfinished)不算失败
+        echo "$out" | awk '/^requests:/ {rps = $6; mbs = $8}
+                           /^errors:/ {gsub(",", ""); failed = $3 + $5 + $7 + $9}
+                           /p99 / {for(i = 1; i <= NF; ++i) if($i == "p99") p99 = $(i + 1) "ms"}
+                           END {printf "%.0f %.0f %s %d\n", rps, mbs * 1048576, p99, failed}'
+    fi
+}
+
+printf "%-6s %-10s %-16s %12s %16s %10s %8s\n" round mode file req/sec bytes/sec p99 failed
+for round in $(seq 1 $ROUNDS); do
+    for mode in 0 1; do
+        #监听socket没有设置SO_REUSEADDR，上一轮服务器主动关闭的连接还在TIME_WAIT中，每一轮每种模式换一个端口
+        port=$((PORT + 2 * (round - 1) + mode))
+        $SERVER_PIN "$SERVER" $ROOT_OPT -a $mode 127.0.0.1 $port >/dev/null 2>&1 &
+        pid=$!
+        sleep 1
+        name=$([ $mode -eq 0 ] && echo proactor || echo reactor)
+        for file in $SMALL_FILE $LARGE_FILE; do
+            printf "%-6s %-10s %-16s %12s %16s %10s %8s\n" $round $name $file $(run_bench http://127.0.0.1:$port$file)
+        done
+        kill $pid
+        wait $pid 2>/dev/null || true
+    done
+done
@@ -0,0 +1,1709 @@
+/*
+ * 基于epoll的开环(open-loop)压测工具
+ *
+ * webbench为每个客户端fork一个进程、用阻塞socket一问一答，客户端数就是并发上限，服务器一慢发送速率也跟着降下来，
+ * 测不出尾延迟。loadgen在少量线程中用非阻塞socket维持大量保持连接，按固定速率(-R)安排每个请求的发送时刻，
+ * 不管之前的请求有没有返回。延迟从请求"应该"发出的时刻算起(修正coordinated omission)：服务器停顿时，
+ * 停顿期间本应发出的请求都会计入这段等待，而不是只有一个请求变慢。同时给出从实际发出算起的服务时间作为对照。
+ * 不指定速率时是闭环模式，每个连接始终保持-P个请求在途，用来测最大吞吐。
+ * 回放模式(-r)读入服务器-C捕获的文件，按原来的时间间隔(可以用-S加速)重新建立每个连接、发送同样的字节，
+ * 连接数、URL分布、头部大小和连接复用方式都与捕获时相同。
+ * -I在压测之前先建立大量只发过一个请求的空闲保持连接，测服务器同时持有它们时活动请求的延迟。
+ *
+ * 用法: loadgen [-c connections] [-T threads] [-d seconds] [-R rate] [-P depth] [-s timeout] [-H header] [-K] [-L]
+ *               [-I idle] URL
+ *       loadgen -r capture_file [-S speed] [-T threads] [-d seconds] [-s timeout] [-L] URL
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "CaptureFormat.h"
+
+/* ---------------- 延迟直方图 ----------------
+ * 与HdrHistogram相同的对数线性分桶：每个2的幂之间均分成128个桶，相对误差小于1%，范围覆盖整个uint64 */
+#define SUB_BITS 7
+#define SUB_COUNT (1 << SUB_BITS)
+#define BUCKET_NUMBER ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+struct histogram{
+    uint64_t counts[BUCKET_NUMBER];
+    uint64_t total;
+    uint64_t max;
+    double sum;
+    double sum_squares;
+};
+
+static int bucket_of(uint64_t v)
+{
+    if(v < SUB_COUNT){
+        return (int)v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (int)((v >> shift) & (SUB_COUNT - 1));
+}
+
+/* 桶中最大的值 */
+static uint64_t bucket_upper(int idx)
+{
+    if(idx < SUB_COUNT){
+        return idx;
+    }
+    int shift = idx / SUB_COUNT - 1;
+    return (((uint64_t)SUB_COUNT + idx % SUB_COUNT) << shift) + ((1ULL << shift) - 1);
+}
+
+static void hist_record(struct histogram *h, uint64_t v)
+{
+    h->counts[bucket_of(v)]++;
+    h->total++;
+    h->sum += v;
+    h->sum_squares += (double)v * v;
+    if(v > h->max){
+        h->max = v;
+    }
+}
+
+static void hist_merge(struct histogram *to, const struct histogram *from)
+{
+    for(int i = 0; i < BUCKET_NUMBER; ++i){
+        to->counts[i] += from->counts[i];
+    }
+    to->total += from->total;
+    to->sum += from->sum;
+    to->sum_squares += from->sum_squares;
+    if(from->max > to->max){
+        to->max = from->max;
+    }
+}
+
+static uint64_t hist_percentile(const struct histogram *h, double p)
+{
+    if(h->total == 0){
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p / 100.0 * h->total + 0.5);
+    if(rank < 1){
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKET_NUMBER; ++i){
+        seen += h->counts[i];
+        if(seen >= rank){
+            uint64_t v = bucket_upper(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+/* ---------------- 参数 ---------------- */
+static int connections = 10;
+static int thread_number = 1;
+static int duration = 10;
+static double rate = 0;          /* 每秒请求数，0表示闭环 */
+static int depth = 1;            /* 每个连接上最多在途的请求数(流水线深度) */
+static int timeout_ms = 2000;
+static int keep_alive = 1;
+static int print_distribution = 0;
+static int duration_set = 0;
+static const char *replay_file = NULL;
+static double replay_speed = 1.0;
+static const char *json_file = NULL;
+static struct sockaddr_in server_addr;
+static char request[4096];
+static int request_len;
+static char url_text[1024];
+
+#define MAX_DEPTH 64
+#define READ_SIZE 65536
+#define HEADER_SIZE 8192
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ---------------- 连接 ---------------- */
+enum conn_state {C_IDLE = 0, C_CONNECTING, C_READY};
+/* 应答解析器的状态 */
+enum parse_state {P_HEADER = 0, P_BODY, P_BODY_TO_CLOSE, P_CHUNK_SIZE, P_CHUNK_DATA, P_TRAILER};
+
+struct thread;
+
+struct conn{
+    int fd;
+    enum conn_state state;
+    struct thread *t;
+    /* 在途请求的计划发送时刻和实际发送时刻，按发送顺序排列 */
+    uint64_t intended[MAX_DEPTH];
+    uint64_t sent[MAX_DEPTH];
+    int head;
+    int count;
+    /* 还没有写出去的请求 */
+    char *out;
+    int out_len;
+    int out_off;
+    int want_out;
+    /* 是否在有空位的连接队列中 */
+    int queued;
+    /* 连接失败后重试的时刻 */
+    uint64_t retry_at;
+
+    enum parse_state pstate;
+    char header[HEADER_SIZE];
+    int header_len;
+    int64_t body_left;
+    int chunked;
+    int close_after;
+    int status;
+    char line[128];
+    int line_len;
+
+    /* 以下只用于回放：对应的捕获连接和下一个要回放的事件 */
+    struct session *session;
+    int next_event;
+    int in_heap;
+    int closing;
+    int done;
+    /* 等前一个应答收到后再发送的请求的计划时刻，0表示没有 */
+    uint64_t deferred;
+    int active_idx;
+    int out_cap;
+    /* 在发出的字节中找请求的边界，一个请求的最后一个字节发出时开始计时 */
+    uint32_t req_window;
+    char req_header[HEADER_SIZE];
+    int req_header_len;
+    int64_t req_body_left;
+};
+
+/* ---------------- 回放 ---------------- */
+struct replay_event{
+    uint64_t time;
+    const char *data;
+    uint32_t length;
+    uint16_t event;
+    uint32_t seq;
+};
+
+/* 捕获中的一个连接 */
+struct session{
+    uint64_t conn;
+    uint64_t open_time;
+    struct replay_event *events;
+    int event_number;
+};
+
+/* 按时间排序的待处理事件，每个活动的回放连接最多占一项 */
+struct heap_item{
+    uint64_t time;
+    struct conn *c;
+};
+
+struct thread{
+    pthread_t tid;
+    int epoll_fd;
+    struct conn *conns;
+    int conn_number;
+    double rate;
+    /* 有空位的连接队列，先进先出，请求轮流分配到各个连接上 */
+    struct conn **ready;
+    int ready_head;
+    int ready_count;
+    /* 已经到了发送时刻、还没有空闲连接可用的请求 */
+    uint64_t *backlog;
+    int backlog_cap;
+    int backlog_head;
+    int backlog_count;
+
+    uint64_t start;
+    uint64_t end;
+
+    struct histogram corrected;
+    struct histogram service;
+    uint64_t completed;
+    uint64_t bytes;
+    uint64_t status_errors;
+    uint64_t connect_errors;
+    uint64_t read_errors;
+    uint64_t timeouts;
+    uint64_t backlog_dropped;
+    uint64_t unfinished;
+
+    /* 回放：分给这个线程的捕获连接(按建立时间排序)，正在回放的连接，事件堆和本轮结束后释放的连接 */
+    struct session **sessions;
+    int session_number;
+    int next_session;
+    struct conn **active;
+    int active_number;
+    int active_cap;
+    struct heap_item *heap;
+    int heap_number;
+    int heap_cap;
+    struct conn **dead;
+    int dead_number;
+    int dead_cap;
+    uint64_t replayed_sessions;
+    uint64_t replayed_requests;
+};
+
+static pthread_barrier_t start_barrier;
+static volatile uint64_t global_start;
+
+static void conn_connect(struct conn *c);
+static void replay_finish(struct conn *c, uint64_t *error_counter);
+static void replay_resume(struct conn *c);
+
+static void ready_push(struct thread *t, struct conn *c)
+{
+    if(c->session || c->queued || c->state != C_READY || c->count >= depth){
+        return;
+    }
+    t->ready[(t->ready_head + t->ready_count) % (t->conn_number + 1)] = c;
+    t->ready_count++;
+    c->queued = 1;
+}
+
+static struct conn *ready_pop(struct thread *t)
+{
+    while(t->ready_count > 0){
+        struct conn *c = t->ready[t->ready_head];
+        t->ready_head = (t->ready_head + 1) % (t->conn_number + 1);
+        t->ready_count--;
+        c->queued = 0;
+        /* 入队之后连接可能已经关闭 */
+        if(c->state == C_READY && c->count < depth){
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void update_events(struct conn *c)
+{
+    struct epoll_event ev;
+    int want = c->state == C_CONNECTING || c->out_off < c->out_len;
+    if(want == c->want_out){
+        return;
+    }
+    c->want_out = want;
+    ev.events = EPOLLIN | EPOLLRDHUP | (want ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(c->t->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void reset_parser(struct conn *c)
+{
+    c->pstate = P_HEADER;
+    c->header_len = 0;
+    c->body_left = 0;
+    c->chunked = 0;
+    c->close_after = 0;
+    c->status = 0;
+    c->line_len = 0;
+}
+
+/* 关闭连接并重新连接，在途的请求计入errors。回放的连接不再重连 */
+static void conn_close(struct conn *c, uint64_t *error_counter)
+{
+    if(c->session){
+        replay_finish(c, error_counter);
+        return;
+    }
+    if(error_counter){
+        *error_counter += c->count;
+    }
+    if(c->fd >= 0){
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->state = C_IDLE;
+    c->head = 0;
+    c->count = 0;
+    c->out_len = 0;
+    c->out_off = 0;
+    reset_parser(c);
+    c->retry_at = 0;
+    conn_connect(c);
+}
+
+static void conn_connect(struct conn *c)
+{
+    struct epoll_event ev;
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c->fd < 0){
+        c->t->connect_errors++;
+        c->retry_at = now_ns() + 100000000ULL;
+        return;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(connect(c->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS){
+        c->t->connect_errors++;
+        close(c->fd);
+        c->fd = -1;
+        /* 服务器拒绝连接时不要空转，稍后再试 */
+        c->retry_at = now_ns() + 10000000ULL;
+        return;
+    }
+    c->state = C_CONNECTING;
+    c->want_out = 1;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.ptr = c;
+    epoll_ctl(c->t->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+static void out_append(struct conn *c, const char *data, int len)
+{
+    if(c->out_len + len > c->out_cap){
+        c->out_cap = (c->out_len + len) * 2;
+        c->out = realloc(c->out, c->out_cap);
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+}
+
+static int flush_out(struct conn *c)
+{
+    while(c->out_off < c->out_len){
+        ssize_t n = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+        if(n < 0){
+            if(errno == EAGAIN){
+                break;
+            }
+            return -1;
+        }
+        c->out_off += n;
+    }
+    if(c->out_off == c->out_len){
+        c->out_off = c->out_len = 0;
+    }
+    update_events(c);
+    return 0;
+}
+
+/* 在连接上发出一个计划在intended时刻发送的请求 */
+static void send_request(struct conn *c, uint64_t intended)
+{
+    int slot = (c->head + c->count) % MAX_DEPTH;
+    c->intended[slot] = intended;
+    c->sent[slot] = now_ns();
+    c->count++;
+    out_append(c, request, request_len);
+    if(flush_out(c) < 0){
+        conn_close(c, &c->t->read_errors);
+    }
+}
+
+/* 一个应答接收完 */
+static void response_done(struct conn *c)
+{
+    struct thread *t = c->t;
+    uint64_t now = now_ns();
+    if(c->count > 0){
+        uint64_t intended = c->intended[c->head];
+        uint64_t sent = c->sent[c->head];
+        c->head = (c->head + 1) % MAX_DEPTH;
+        c->count--;
+        if(now <= t->end){
+            hist_record(&t->corrected, now - intended);
+            hist_record(&t->service, now - sent);
+            t->completed++;
+            if(c->status < 200 || c->status >= 400){
+                t->status_errors++;
+            }
+        }
+    }
+    reset_parser(c);
+}
+
+/* 解析头部，决定应答体的读法 */
+static int parse_header(struct conn *c)
+{
+    c->header[c->header_len] = '\0';
+    if(strncmp(c->header, "HTTP/1.", 7) != 0){
+        return -1;
+    }
+    c->status = atoi(c->header + 9);
+    c->body_left = -1;
+    c->close_after = strncmp(c->header, "HTTP/1.0", 8) == 0;
+    char *line = strstr(c->header, "\r\n");
+    while(line && line[2] != '\r'){
+        line += 2;
+        if(strncasecmp(line, "Content-Length:", 15) == 0){
+            c->body_left = strtoll(line + 15, NULL, 10);
+        }else if(strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked")){
+            c->chunked = 1;
+        }else if(strncasecmp(line, "Connection:", 11) == 0){
+            const char *v = line + 11 + strspn(line + 11, " \t");
+            c->close_after = strncasecmp(v, "close", 5) == 0;
+        }
+        line = strstr(line, "\r\n");
+    }
+    if(c->status == 204 || c->status == 304){
+        c->body_left = 0;
+    }
+    if(c->chunked){
+        c->pstate = P_CHUNK_SIZE;
+        c->line_len = 0;
+    }else if(c->body_left < 0){
+        c->pstate = P_BODY_TO_CLOSE;
+    }else{
+        c->pstate = P_BODY;
+    }
+    return 0;
+}
+
+/* 读入一行(分块长度或者尾部)，返回1表示得到完整的一行 */
+static int take_line(struct conn *c, const char **data, int *len)
+{
+    while(*len > 0){
+        char ch = **data;
+        (*data)++;
+        (*len)--;
+        if(c->line_len < (int)sizeof(c->line) - 1){
+            c->line[c->line_len++] = ch;
+        }
+        if(ch == '\n'){
+            c->line[c->line_len] = '\0';
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* 处理收到的数据，返回-1表示应答格式错误 */
+static int consume(struct conn *c, const char *data, int len)
+{
+    while(len > 0){
+        switch(c->pstate){
+            case P_HEADER:
+            {
+                int old = c->header_len;
+                int n = len < HEADER_SIZE - 1 - old ? len : HEADER_SIZE - 1 - old;
+                memcpy(c->header + old, data, n);
+                c->header_len += n;
+                c->header[c->header_len] = '\0';
+                char *end = strstr(c->header + (old > 3 ? old - 3 : 0), "\r\n\r\n");
+                if(!end){
+                    if(c->header_len >= HEADER_SIZE - 1){
+                        return -1;
+                    }
+                    data += n;
+                    len -= n;
+                    break;
+                }
+                int used = (int)(end + 4 - c->header) - old;
+                c->header_len = (int)(end + 4 - c->header);
+                data += used;
+                len -= used;
+                if(parse_header(c) < 0){
+                    return -1;
+                }
+                if(c->pstate == P_BODY && c->body_left == 0){
+                    int close_after = c->close_after;
+                    response_done(c);
+                    if(close_after){
+                        return 1;
+                    }
+                }
+                break;
+            }
+            case P_BODY:
+            {
+                int n = (int64_t)len < c->body_left ? len : (int)c->body_left;
+                c->body_left -= n;
+                data += n;
+                len -= n;
+                if(c->body_left == 0){
+                    int close_after = c->close_after;
+                    response_done(c);
+                    if(close_after){
+                        return 1;
+                    }
+                }
+                break;
+            }
+            case P_BODY_TO_CLOSE:
+                /* 没有长度的应答体一直读到连接关闭 */
+                return 0;
+            case P_CHUNK_SIZE:
+            {
+                if(!take_line(c, &data, &len)){
+                    break;
+                }
+                long size = strtol(c->line, NULL, 16);
+                c->line_len = 0;
+                if(size < 0){
+                    return -1;
+                }
+                if(size == 0){
+                    c->pstate = P_TRAILER;
+                }else{
+                    c->body_left = size + 2;
+                    c->pstate = P_CHUNK_DATA;
+                }
+                break;
+            }
+            case P_CHUNK_DATA:
+            {
+                int n = (int64_t)len < c->body_left ? len : (int)c->body_left;
+                c->body_left -= n;
+                data += n;
+                len -= n;
+                if(c->body_left == 0){
+                    c->pstate = P_CHUNK_SIZE;
+                }
+                break;
+            }
+            case P_TRAILER:
+            {
+                if(!take_line(c, &data, &len)){
+                    break;
+                }
+                int empty = strcmp(c->line, "\r\n") == 0 || strcmp(c->line, "\n") == 0;
+                c->line_len = 0;
+                if(empty){
+                    int close_after = c->close_after;
+                    response_done(c);
+                    if(close_after){
+                        return 1;
+                    }
+                }
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+static void on_readable(struct conn *c, char *buf)
+{
+    struct thread *t = c->t;
+    while(1){
+        ssize_t n = read(c->fd, buf, READ_SIZE);
+        if(n < 0){
+            if(errno == EAGAIN){
+                break;
+            }
+            conn_close(c, &t->read_errors);
+            return;
+        }
+        if(n == 0){
+            if(c->pstate == P_BODY_TO_CLOSE){
+                response_done(c);
+            }
+            /* 服务器关闭了空闲的连接是正常的，在途的请求才算错误 */
+            conn_close(c, &t->read_errors);
+            return;
+        }
+        t->bytes += n;
+        int ret = consume(c, buf, (int)n);
+        if(ret < 0){
+            conn_close(c, &t->read_errors);
+            return;
+        }
+        if(ret > 0){
+            /* 应答要求关闭连接 */
+            conn_close(c, &t->read_errors);
+            return;
+        }
+    }
+    if(c->session){
+        replay_resume(c);
+        return;
+    }
+    ready_push(t, c);
+}
+
+static void on_writable(struct conn *c)
+{
+    if(c->state == C_CONNECTING){
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if(err){
+            c->t->connect_errors++;
+            if(c->session){
+                replay_finish(c, &c->t->connect_errors);
+                return;
+            }
+            epoll_ctl(c->t->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+            close(c->fd);
+            c->fd = -1;
+            c->state = C_IDLE;
+            c->retry_at = now_ns() + 10000000ULL;
+            return;
+        }
+        c->state = C_READY;
+        /* 回放时连接建立之前可能已经有要发送的数据 */
+        if(flush_out(c) < 0){
+            conn_close(c, &c->t->read_errors);
+            return;
+        }
+        ready_push(c->t, c);
+        return;
+    }
+    if(flush_out(c) < 0){
+        conn_close(c, &c->t->read_errors);
+    }
+}
+
+/* 闭环模式：每个有空位的连接立刻补满请求 */
+static void fill_closed_loop(struct thread *t)
+{
+    struct conn *c;
+    while((c = ready_pop(t)) != NULL){
+        while(c->state == C_READY && c->count < depth){
+            send_request(c, now_ns());
+        }
+    }
+}
+
+/* 开环模式：到了发送时刻的请求进入积压队列，再分配给有空位的连接 */
+static uint64_t schedule_open_loop(struct thread *t, uint64_t *sequence)
+{
+    uint64_t now = now_ns();
+    double interval = 1e9 / t->rate;
+    uint64_t next = t->start + (uint64_t)(*sequence * interval);
+    while(next <= now && next < t->end){
+        if(t->backlog_count < t->backlog_cap){
+            t->backlog[(t->backlog_head + t->backlog_count) % t->backlog_cap] = next;
+            t->backlog_count++;
+        }else{
+            t->backlog_dropped++;
+        }
+        ++*sequence;
+        next = t->start + (uint64_t)(*sequence * interval);
+    }
+    while(t->backlog_count > 0){
+        struct conn *c = ready_pop(t);
+        if(!c){
+            break;
+        }
+        send_request(c, t->backlog[t->backlog_head]);
+        t->backlog_head = (t->backlog_head + 1) % t->backlog_cap;
+        t->backlog_count--;
+        ready_push(t, c);
+    }
+    return next;
+}
+
+/* 超时的连接和需要重试的连接 */
+static void check_timeouts(struct thread *t, uint64_t now)
+{
+    for(int i = 0; i < t->conn_number; ++i){
+        struct conn *c = &t->conns[i];
+        if(c->state == C_IDLE && c->fd < 0 && c->retry_at && now >= c->retry_at){
+            c->retry_at = 0;
+            conn_connect(c);
+        }else if(c->count > 0 && now > c->sent[c->head] + (uint64_t)timeout_ms * 1000000ULL){
+            conn_close(c, &t->timeouts);
+        }
+    }
+}
+
+/* 内核不支持epoll_pwait2(5.11之前)时置1，之后都用epoll_wait */
+static volatile int no_pwait2 = 0;
+
+/* 最多等待wait_ns纳秒。epoll_pwait2的超时精确到纳秒，按计划发送请求时不会晚到；它的封装函数要glibc 2.35，
+ * 直接发起系统调用。不可用时退回毫秒精度的epoll_wait，超时向下取整，不足1毫秒时不等待，宁可空转也不晚发 */
+static int epoll_wait_ns(int epoll_fd, struct epoll_event *events, int max, uint64_t wait_ns)
+{
+#ifdef SYS_epoll_pwait2
+    if(!no_pwait2){
+        struct timespec wait;
+        wait.tv_sec = wait_ns / 1000000000ULL;
+        wait.tv_nsec = wait_ns % 1000000000ULL;
+        int n = syscall(SYS_epoll_pwait2, epoll_fd, events, max, &wait, NULL, 0);
+        if(n >= 0 || errno != ENOSYS){
+            return n;
+        }
+        no_pwait2 = 1;
+    }
+#endif
+    return epoll_wait(epoll_fd, events, max, (int)(wait_ns / 1000000ULL));
+}
+
+/* 等到next时刻或者有事件发生，处理各个连接上的事件 */
+static void wait_and_dispatch(struct thread *t, struct epoll_event *events, char *buf, uint64_t next)
+{
+    uint64_t now = now_ns();
+    int n = epoll_wait_ns(t->epoll_fd, events, 256, next > now ? next - now : 0);
+    for(int i = 0; i < n; ++i){
+        struct conn *c = events[i].data.ptr;
+        if(c->fd < 0){
+            continue;
+        }
+        if(events[i].events & (EPOLLOUT | EPOLLERR)){
+            on_writable(c);
+        }
+        if(c->fd >= 0 && c->state == C_READY && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))){
+            on_readable(c, buf);
+        }
+    }
+}
+
+static void *thread_main(void *arg)
+{
+    struct thread *t = (struct thread *)arg;
+    struct epoll_event events[256];
+    char *buf = malloc(READ_SIZE);
+    t->epoll_fd = epoll_create1(0);
+    for(int i = 0; i < t->conn_number; ++i){
+        struct conn *c = &t->conns[i];
+        c->t = t;
+        c->fd = -1;
+        c->out_cap = request_len * MAX_DEPTH;
+        c->out = malloc(c->out_cap);
+        reset_parser(c);
+        conn_connect(c);
+    }
+
+    /* 先建立连接，所有线程同时开始计时 */
+    uint64_t connect_deadline = now_ns() + 2000000000ULL;
+    int connected = 0;
+    while(connected < t->conn_number && now_ns() < connect_deadline){
+        int n = epoll_wait(t->epoll_fd, events, 256, 10);
+        for(int i = 0; i < n; ++i){
+            struct conn *c = events[i].data.ptr;
+            if(c->state == C_CONNECTING && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+                on_writable(c);
+            }
+        }
+        connected = 0;
+        for(int i = 0; i < t->conn_number; ++i){
+            connected += t->conns[i].state == C_READY;
+        }
+        check_timeouts(t, now_ns());
+    }
+    pthread_barrier_wait(&start_barrier);
+    t->start = global_start;
+    t->end = t->start + (uint64_t)duration * 1000000000ULL;
+
+    uint64_t sequence = 0;
+    uint64_t next_check = t->start;
+    while(1){
+        uint64_t now = now_ns();
+        if(now >= t->end){
+            break;
+        }
+        uint64_t next = t->end;
+        if(t->rate > 0){
+            next = schedule_open_loop(t, &sequence);
+        }else{
+            fill_closed_loop(t);
+        }
+        if(now >= next_check){
+            check_timeouts(t, now);
+            next_check = now + 10000000ULL;
+        }
+        if(next_check < next){
+            next = next_check;
+        }
+        wait_and_dispatch(t, events, buf, next);
+    }
+
+    for(int i = 0; i < t->conn_number; ++i){
+        t->unfinished += t->conns[i].count;
+        if(t->conns[i].fd >= 0){
+            close(t->conns[i].fd);
+        }
+        free(t->conns[i].out);
+    }
+    t->unfinished += t->backlog_count;
+    free(buf);
+    close(t->epoll_fd);
+    return NULL;
+}
+
+/* ---------------- 回放模式 ---------------- */
+static void heap_push(struct thread *t, uint64_t time, struct conn *c)
+{
+    if(t->heap_number == t->heap_cap){
+        t->heap_cap = t->heap_cap ? t->heap_cap * 2 : 256;
+        t->heap = realloc(t->heap, t->heap_cap * sizeof(struct heap_item));
+    }
+    int i = t->heap_number++;
+    while(i > 0 && t->heap[(i - 1) / 2].time > time){
+        t->heap[i] = t->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    t->heap[i].time = time;
+    t->heap[i].c = c;
+    c->in_heap = 1;
+}
+
+static struct heap_item heap_pop(struct thread *t)
+{
+    struct heap_item top = t->heap[0];
+    struct heap_item last = t->heap[--t->heap_number];
+    int i = 0;
+    while(2 * i + 1 < t->heap_number){
+        int child = 2 * i + 1;
+        if(child + 1 < t->heap_number && t->heap[child + 1].time < t->heap[child].time){
+            child++;
+        }
+        if(t->heap[child].time >= last.time){
+            break;
+        }
+        t->heap[i] = t->heap[child];
+        i = child;
+    }
+    if(t->heap_number > 0){
+        t->heap[i] = last;
+    }
+    top.c->in_heap = 0;
+    return top;
+}
+
+/* 捕获中最早的时刻，对应回放的开始 */
+static uint64_t capture_base;
+
+/* 捕获中的时刻对应的回放时刻 */
+static uint64_t replay_time(const struct thread *t, uint64_t capture_time, uint64_t capture_base)
+{
+    return t->start + (uint64_t)((capture_time - capture_base) / replay_speed);
+}
+
+static void replay_free(struct conn *c)
+{
+    free(c->out);
+    free(c);
+}
+
+/* 回放的连接结束。事件循环中可能还有它的事件，本轮结束后才释放；还在事件堆中的等弹出时释放 */
+static void replay_finish(struct conn *c, uint64_t *error_counter)
+{
+    struct thread *t = c->t;
+    if(c->done){
+        return;
+    }
+    if(error_counter){
+        *error_counter += c->count;
+    }
+    if(c->fd >= 0){
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->state = C_IDLE;
+    c->done = 1;
+    t->active[c->active_idx] = t->active[--t->active_number];
+    t->active[c->active_idx]->active_idx = c->active_idx;
+    t->replayed_sessions++;
+    if(!c->in_heap){
+        if(t->dead_number == t->dead_cap){
+            t->dead_cap = t->dead_cap ? t->dead_cap * 2 : 64;
+            t->dead = realloc(t->dead, t->dead_cap * sizeof(struct conn *));
+        }
+        t->dead[t->dead_number++] = c;
+    }
+}
+
+/* 一个请求的最后一个字节已经交给连接，在途队列满时(捕获中的流水线超过MAX_DEPTH)不再计时 */
+static void replay_request_sent(struct conn *c, uint64_t intended)
+{
+    if(c->count < MAX_DEPTH){
+        int slot = (c->head + c->count) % MAX_DEPTH;
+        c->intended[slot] = intended;
+        c->sent[slot] = now_ns();
+        c->count++;
+    }
+    c->t->replayed_requests++;
+}
+
+/* 在发出的字节中找请求的边界：头部以空行结束，有Content-Length时再跳过请求体 */
+static void replay_track_requests(struct conn *c, const char *data, uint32_t len, uint64_t intended)
+{
+    while(len > 0){
+        if(c->req_body_left > 0){
+            uint32_t n = (int64_t)len < c->req_body_left ? len : (uint32_t)c->req_body_left;
+            c->req_body_left -= n;
+            data += n;
+            len -= n;
+            if(c->req_body_left == 0){
+                replay_request_sent(c, intended);
+            }
+            continue;
+        }
+        char ch = *data++;
+        len--;
+        if(c->req_header_len < HEADER_SIZE - 1){
+            c->req_header[c->req_header_len++] = ch;
+        }
+        c->req_window = (c->req_window << 8) | (uint8_t)ch;
+        if(c->req_window != 0x0d0a0d0a){
+            continue;
+        }
+        c->req_header[c->req_header_len] = '\0';
+        const char *cl = strcasestr(c->req_header, "\nContent-Length:");
+        c->req_body_left = cl ? strtoll(cl + 16, NULL, 10) : 0;
+        c->req_header_len = 0;
+        c->req_window = 0;
+        if(c->req_body_left <= 0){
+            c->req_body_left = 0;
+            replay_request_sent(c, intended);
+        }
+    }
+}
+
+/* 处理一个回放连接的下一个事件 */
+static void replay_step(struct conn *c, uint64_t scheduled)
+{
+    struct session *s = c->session;
+    struct replay_event *ev = &s->events[c->next_event];
+    /* 浏览器等客户端不会在一个连接上流水线发送请求，加速回放时新的请求要等前一个应答收到再发，延迟仍然从计划的时刻算起。
+     * 服务器也只处理一次recv读到的第一个请求 */
+    if(ev->event == CAPTURE_DATA && !c->closing && c->count > 0 && c->req_header_len == 0 && c->req_body_left == 0){
+        c->deferred = scheduled;
+        return;
+    }
+    c->next_event++;
+    if(ev->event == CAPTURE_DATA && !c->closing){
+        out_append(c, ev->data, ev->length);
+        replay_track_requests(c, ev->data, ev->length, scheduled);
+        if(c->state == C_READY && flush_out(c) < 0){
+            replay_finish(c, &c->t->read_errors);
+            return;
+        }
+    }else if(ev->event == CAPTURE_CLOSE){
+        c->closing = 1;
+    }
+    /* 捕获在连接关闭之前结束的，最后一个事件之后按关闭处理 */
+    if(c->next_event >= s->event_number){
+        c->closing = 1;
+    }
+    if(c->closing){
+        if(c->count == 0 && c->out_len == 0){
+            replay_finish(c, NULL);
+        }
+        return;
+    }
+    heap_push(c->t, replay_time(c->t, s->events[c->next_event].time, capture_base), c);
+}
+
+/* 收到应答之后：发送等待中的请求，或者在客户端已经关闭时结束连接 */
+static void replay_resume(struct conn *c)
+{
+    if(c->count > 0){
+        return;
+    }
+    if(c->deferred){
+        uint64_t scheduled = c->deferred;
+        c->deferred = 0;
+        replay_step(c, scheduled);
+    }else if(c->closing && c->out_len == 0){
+        replay_finish(c, NULL);
+    }
+}
+
+static void replay_start(struct thread *t, struct session *s)
+{
+    struct conn *c = calloc(1, sizeof(struct conn));
+    c->t = t;
+    c->fd = -1;
+    c->session = s;
+    c->out_cap = 4096;
+    c->out = malloc(c->out_cap);
+    reset_parser(c);
+    if(t->active_number == t->active_cap){
+        t->active_cap = t->active_cap ? t->active_cap * 2 : 64;
+        t->active = realloc(t->active, t->active_cap * sizeof(struct conn *));
+    }
+    c->active_idx = t->active_number;
+    t->active[t->active_number++] = c;
+    /* 跳过OPEN事件 */
+    while(c->next_event < s->event_number && s->events[c->next_event].event == CAPTURE_OPEN){
+        c->next_event++;
+    }
+    conn_connect(c);
+    if(c->fd < 0){
+        replay_finish(c, NULL);
+        return;
+    }
+    if(c->next_event >= s->event_number){
+        c->closing = 1;
+        replay_finish(c, NULL);
+        return;
+    }
+    heap_push(t, replay_time(t, s->events[c->next_event].time, capture_base), c);
+}
+
+static void *replay_main(void *arg)
+{
+    struct thread *t = (struct thread *)arg;
+    struct epoll_event events[256];
+    char *buf = malloc(READ_SIZE);
+    t->epoll_fd = epoll_create1(0);
+    pthread_barrier_wait(&start_barrier);
+    t->start = global_start;
+    t->end = duration_set ? t->start + (uint64_t)duration * 1000000000ULL : UINT64_MAX;
+
+    uint64_t next_check = t->start;
+    while(1){
+        uint64_t now = now_ns();
+        if(now >= t->end){
+            break;
+        }
+        while(t->next_session < t->session_number
+              && replay_time(t, t->sessions[t->next_session]->open_time, capture_base) <= now){
+            replay_start(t, t->sessions[t->next_session++]);
+        }
+        while(t->heap_number > 0 && t->heap[0].time <= now){
+            struct heap_item item = heap_pop(t);
+            if(item.c->done){
+                replay_free(item.c);
+                continue;
+            }
+            replay_step(item.c, item.time);
+        }
+        if(t->next_session >= t->session_number && t->active_number == 0){
+            break;
+        }
+        if(now >= next_check){
+            for(int i = t->active_number - 1; i >= 0; --i){
+                struct conn *c = t->active[i];
+                if(c->count > 0 && now > c->sent[c->head] + (uint64_t)timeout_ms * 1000000ULL){
+                    replay_finish(c, &t->timeouts);
+                }
+            }
+            next_check = now + 10000000ULL;
+        }
+        uint64_t next = next_check;
+        if(t->heap_number > 0 && t->heap[0].time < next){
+            next = t->heap[0].time;
+        }
+        if(t->next_session < t->session_number){
+            uint64_t open = replay_time(t, t->sessions[t->next_session]->open_time, capture_base);
+            if(open < next){
+                next = open;
+            }
+        }
+        wait_and_dispatch(t, events, buf, next);
+        for(int i = 0; i < t->dead_number; ++i){
+            replay_free(t->dead[i]);
+        }
+        t->dead_number = 0;
+    }
+
+    for(int i = 0; i < t->active_number; ++i){
+        t->unfinished += t->active[i]->count;
+        if(t->active[i]->fd >= 0){
+            close(t->active[i]->fd);
+        }
+    }
+    free(buf);
+    close(t->epoll_fd);
+    return NULL;
+}
+
+static int compare_event(const void *a, const void *b)
+{
+    const struct replay_event *x = a, *y = b;
+    if(x->time != y->time){
+        return x->time < y->time ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+static int compare_session(const void *a, const void *b)
+{
+    const struct session *x = *(struct session *const *)a, *y = *(struct session *const *)b;
+    if(x->open_time != y->open_time){
+        return x->open_time < y->open_time ? -1 : 1;
+    }
+    return x->conn < y->conn ? -1 : (x->conn > y->conn);
+}
+
+/* 读入捕获文件，按连接分组，每个连接的事件和所有连接分别按时间排序 */
+static struct session **load_capture(const char *file, int *session_number, uint64_t *span)
+{
+    FILE *fp = fopen(file, "rb");
+    if(!fp){
+        perror(file);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *content = malloc(size > 0 ? size : 1);
+    if(size < (long)sizeof(capture_file_header) || fread(content, 1, size, fp) != (size_t)size){
+        fprintf(stderr, "%s: not a capture file\n", file);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    capture_file_header *header = (capture_file_header *)content;
+    if(memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0 || header->record_size != sizeof(capture_record)){
+        fprintf(stderr, "%s: not a capture file, or written by an incompatible server\n", file);
+        return NULL;
+    }
+
+    /* 第一遍数出记录数，末尾不完整的记录(服务器被杀掉时)忽略 */
+    int record_number = 0;
+    long end = sizeof(capture_file_header);
+    for(long off = end; off + (long)sizeof(capture_record) <= size; ){
+        capture_record *r = (capture_record *)(content + off);
+        if(off + (long)sizeof(capture_record) + (long)r->length > size){
+            break;
+        }
+        off += sizeof(capture_record) + r->length;
+        end = off;
+        record_number++;
+    }
+    if(record_number == 0){
+        fprintf(stderr, "%s: no records\n", file);
+        return NULL;
+    }
+
+    /* 连接编号到会话下标的开放寻址哈希表 */
+    int table_size = 1;
+    while(table_size < record_number * 2){
+        table_size <<= 1;
+    }
+    int *table = malloc(table_size * sizeof(int));
+    memset(table, -1, table_size * sizeof(int));
+    struct session *sessions = calloc(record_number, sizeof(struct session));
+    int *record_session = malloc(record_number * sizeof(int));
+    int count = 0;
+    int idx = 0;
+    for(long off = sizeof(capture_file_header); off < end; ++idx){
+        capture_record *r = (capture_record *)(content + off);
+        uint64_t h = r->conn * 0x9e3779b97f4a7c15ULL;
+        int slot = (int)(h >> 32) & (table_size - 1);
+        while(table[slot] >= 0 && sessions[table[slot]].conn != r->conn){
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if(table[slot] < 0){
+            table[slot] = count;
+            sessions[count].conn = r->conn;
+            sessions[count].open_time = UINT64_MAX;
+            count++;
+        }
+        record_session[idx] = table[slot];
+        sessions[table[slot]].event_number++;
+        off += sizeof(capture_record) + r->length;
+    }
+
+    /* 第二遍按会话放入事件 */
+    struct replay_event *events = malloc(record_number * sizeof(struct replay_event));
+    int *fill = calloc(count, sizeof(int));
+    int offset = 0;
+    for(int i = 0; i < count; ++i){
+        sessions[i].events = events + offset;
+        offset += sessions[i].event_number;
+    }
+    uint64_t first = UINT64_MAX, last = 0;
+    idx = 0;
+    for(long off = sizeof(capture_file_header); off < end; ++idx){
+        capture_record *r = (capture_record *)(content + off);
+        struct session *s = &sessions[record_session[idx]];
+        struct replay_event *ev = &s->events[fill[record_session[idx]]++];
+        ev->time = r->time;
+        ev->data = content + off + sizeof(capture_record);
+        ev->length = r->length;
+        ev->event = r->event;
+        ev->seq = idx;
+        if(r->time < first){
+            first = r->time;
+        }
+        if(r->time > last){
+            last = r->time;
+        }
+        off += sizeof(capture_record) + r->length;
+    }
+    struct session **order = malloc(count * sizeof(struct session *));
+    for(int i = 0; i < count; ++i){
+        qsort(sessions[i].events, sessions[i].event_number, sizeof(struct replay_event), compare_event);
+        sessions[i].open_time = sessions[i].events[0].time;
+        order[i] = &sessions[i];
+    }
+    qsort(order, count, sizeof(struct session *), compare_session);
+    free(table);
+    free(record_session);
+    free(fill);
+    capture_base = first;
+    *session_number = count;
+    *span = last - first;
+    return order;
+}
+
+/* ---------------- 空闲连接 ----------------
+ * 每个空闲连接发一个保持连接的请求，收到应答的开头之后就不再活动，压测期间一直占着服务器的连接对象、
+ * 定时器和epoll中的位置。应答的其余部分留在socket的接收缓冲区中，不再读取。
+ * 目标是回环地址时从127.0.0.2开始轮流使用多个源地址，每个源地址最多IDLE_PER_SOURCE个连接，
+ * 避开一个源地址只有约28000个临时端口的限制 */
+#define IDLE_PER_SOURCE 20000
+/* 同时进行中的connect数，太多时服务器的accept队列会溢出，连接要等SYN重传 */
+#define IDLE_CONNECTING 512
+
+static int idle_number = 0;
+static int *idle_fds;
+static int idle_opened = 0;
+
+static int idle_socket(int i)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(fd < 0){
+        return -1;
+    }
+    if((ntohl(server_addr.sin_addr.s_addr) >> 24) == 127){
+        struct sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(0x7f000002 + i / IDLE_PER_SOURCE);
+        /* 端口推迟到connect时按四元组分配，各个源地址都能用满临时端口的范围 */
+        int one = 1;
+        setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+        if(bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0){
+            close(fd);
+            return -1;
+        }
+    }
+    if(connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 建立idle_number个空闲连接，返回成功的个数。某次等待超过-s毫秒没有任何进展时放弃还没完成的连接 */
+static int open_idle(const char *idle_request, int idle_request_len)
+{
+    idle_fds = malloc(idle_number * sizeof(int));
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event events[256];
+    char buf[4096];
+    int launched = 0, pending = 0, failed = 0;
+    uint64_t start = now_ns();
+    while(launched < idle_number || pending > 0){
+        while(launched < idle_number && pending < IDLE_CONNECTING){
+            int i = launched++;
+            idle_fds[i] = idle_socket(i);
+            if(idle_fds[i] < 0){
+                ++failed;
+                continue;
+            }
+            struct epoll_event ev;
+            ev.events = EPOLLOUT;
+            ev.data.u32 = i;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, idle_fds[i], &ev);
+            ++pending;
+        }
+        int n = epoll_wait(epoll_fd, events, 256, timeout_ms);
+        if(n <= 0){
+            break;
+        }
+        for(int k = 0; k < n; ++k){
+            int i = events[k].data.u32;
+            int fd = idle_fds[i];
+            int ok = 1;
+            if(events[k].events & EPOLLOUT){
+                /* 连接建立，发出请求后等应答 */
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if(err == 0 && send(fd, idle_request, idle_request_len, MSG_NOSIGNAL) == idle_request_len){
+                    struct epoll_event ev;
+                    ev.events = EPOLLIN;
+                    ev.data.u32 = i;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+                    continue;
+                }
+                ok = 0;
+            }else if(recv(fd, buf, sizeof(buf), 0) <= 0 || memcmp(buf, "HTTP/1.1 200", 12) != 0){
+                ok = 0;
+            }
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            --pending;
+            if(ok){
+                ++idle_opened;
+            }else{
+                close(fd);
+                idle_fds[i] = -1;
+                ++failed;
+            }
+        }
+    }
+    /* 超时没有完成的连接 */
+    for(int i = 0; i < launched; ++i){
+        struct epoll_event ev;
+        if(idle_fds[i] >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_DEL, idle_fds[i], &ev) == 0){
+            close(idle_fds[i]);
+            idle_fds[i] = -1;
+            ++failed;
+        }
+    }
+    failed += idle_number - launched;
+    close(epoll_fd);
+    printf("idle: %d of %d connections open in %.1f s", idle_opened, idle_number, (now_ns() - start) / 1e9);
+    if(failed){
+        printf(", %d failed", failed);
+    }
+    printf("\n");
+    return idle_opened;
+}
+
+/* 压测结束时仍然打开(服务器没有关闭)的空闲连接数 */
+static int idle_alive(void)
+{
+    struct pollfd *fds = calloc(idle_number, sizeof(struct pollfd));
+    int n = 0;
+    for(int i = 0; i < idle_number; ++i){
+        if(idle_fds[i] >= 0){
+            fds[n].fd = idle_fds[i];
+            fds[n].events = POLLRDHUP;
+            ++n;
+        }
+    }
+    int alive = n;
+    if(poll(fds, n, 0) > 0){
+        for(int i = 0; i < n; ++i){
+            if(fds[i].revents & (POLLRDHUP | POLLHUP | POLLERR)){
+                --alive;
+            }
+        }
+    }
+    free(fds);
+    return alive;
+}
+
+/* ---------------- 输出 ---------------- */
+static void print_latency(const char *title, const struct histogram *h)
+{
+    static const double points[] = {50, 75, 90, 99, 99.9, 99.99};
+    printf("%s\n", title);
+    if(h->total == 0){
+        printf("  no responses\n");
+        return;
+    }
+    printf("  mean %.3f ms", h->sum / h->total / 1e6);
+    for(size_t i = 0; i < sizeof(points) / sizeof(points[0]); ++i){
+        printf(", p%g %.3f ms", points[i], hist_percentile(h, points[i]) / 1e6);
+    }
+    printf(", max %.3f ms\n", h->max / 1e6);
+}
+
+/* HdrHistogram的.hgrm格式，可以用它的在线工具画出百分位曲线 */
+static void print_distribution_hgrm(const struct histogram *h)
+{
+    printf("\n%12s %14s %10s %14s\n\n", "Value(ms)", "Percentile", "TotalCount", "1/(1-Percentile)");
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKET_NUMBER; ++i){
+        if(!h->counts[i]){
+            continue;
+        }
+        seen += h->counts[i];
+        double p = (double)seen / h->total;
+        uint64_t v = bucket_upper(i) < h->max ? bucket_upper(i) : h->max;
+        if(seen < h->total){
+            printf("%12.3f %14.12f %10llu %14.2f\n", v / 1e6, p, (unsigned long long)seen, 1 / (1 - p));
+        }else{
+            printf("%12.3f %14.12f %10llu\n", v / 1e6, p, (unsigned long long)seen);
+        }
+    }
+    double mean = h->sum / h->total;
+    double variance = h->sum_squares / h->total - mean * mean;
+    printf("#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean / 1e6, sqrt(variance > 0 ? variance : 0) / 1e6);
+    printf("#[Max     = %12.3f, Total count    = %12llu]\n", h->max / 1e6, (unsigned long long)h->total);
+}
+
+static void json_latency(FILE *fp, const char *name, const struct histogram *h)
+{
+    static const struct { const char *name; double p; } points[] = {
+        {"p50", 50}, {"p90", 90}, {"p99", 99}, {"p99.9", 99.9}, {"p99.99", 99.99}
+    };
+    fprintf(fp, "  \"%s\": {\"count\": %llu, \"mean\": %.4f", name, (unsigned long long)h->total,
+            h->total ? h->sum / h->total / 1e6 : 0.0);
+    for(size_t i = 0; i < sizeof(points) / sizeof(points[0]); ++i){
+        fprintf(fp, ", \"%s\": %.4f", points[i].name, hist_percentile(h, points[i].p) / 1e6);
+    }
+    fprintf(fp, ", \"max\": %.4f}", h->max / 1e6);
+}
+
+/* 机器可读的结果，延迟单位毫秒，供回归测试等脚本使用 */
+static int write_json(const char *file, double elapsed, uint64_t completed, uint64_t bytes, const uint64_t errors[4],
+                      uint64_t unfinished, int alive, const struct histogram *corrected, const struct histogram *service)
+{
+    FILE *fp = fopen(file, "w");
+    if(!fp){
+        perror(file);
+        return -1;
+    }
+    fprintf(fp, "{\n  \"url\": \"%s\",\n  \"connections\": %d,\n  \"threads\": %d,\n  \"rate\": %.1f,\n"
+            "  \"keep_alive\": %s,\n  \"elapsed\": %.3f,\n  \"requests\": %llu,\n  \"requests_per_second\": %.1f,\n"
+            "  \"bytes\": %llu,\n  \"errors\": {\"status\": %llu, \"connect\": %llu, \"read\": %llu, \"timeout\": %llu},\n"
+            "  \"unfinished\": %llu,\n  \"idle_connections\": %d,\n  \"idle_alive\": %d,\n",
+            url_text, connections, thread_number, rate, keep_alive ? "true" : "false", elapsed,
+            (unsigned long long)completed, completed / elapsed, (unsigned long long)bytes,
+            (unsigned long long)errors[0], (unsigned long long)errors[1], (unsigned long long)errors[2],
+            (unsigned long long)errors[3], (unsigned long long)unfinished, idle_opened, alive);
+    json_latency(fp, "latency_ms", rate > 0 || replay_file ? corrected : service);
+    fprintf(fp, ",\n");
+    json_latency(fp, "service_ms", service);
+    fprintf(fp, "\n}\n");
+    fclose(fp);
+    return 0;
+}
+
+static int parse_url(const char *url, char *host, size_t host_size, int *port, const char **path)
+{
+    if(strncasecmp(url, "http://", 7) != 0){
+        return -1;
+    }
+    const char *p = url + 7;
+    const char *slash = strchr(p, '/');
+    *path = slash ? slash : "/";
+    size_t hostport_len = slash ? (size_t)(slash - p) : strlen(p);
+    if(hostport_len == 0 || hostport_len >= host_size){
+        return -1;
+    }
+    memcpy(host, p, hostport_len);
+    host[hostport_len] = '\0';
+    char *colon = strchr(host, ':');
+    *port = 80;
+    if(colon){
+        *colon = '\0';
+        *port = atoi(colon + 1);
+    }
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "loadgen [option]... URL\n"
+            "  -c <n>        Keep <n> connections open. Default 10.\n"
+            "  -T <n>        Use <n> threads, connections are split between them. Default 1.\n"
+            "  -d <sec>      Run for <sec> seconds. Default 10.\n"
+            "  -R <rate>     Open loop: send <rate> requests per second in total, on schedule,\n"
+            "                measuring latency from the scheduled time. Default 0: closed loop.\n"
+            "  -P <depth>    Pipeline up to <depth> requests per connection (1-%d). Default 1.\n"
+            "  -s <ms>       Count a request as timed out after <ms> and reconnect. Default 2000.\n"
+            "  -H <header>   Add a request header, e.g. -H 'Accept-Encoding: gzip'. Repeatable.\n"
+            "  -K            Send Connection: close and reconnect after every response.\n"
+            "  -L            Print the full latency distribution in HdrHistogram .hgrm format.\n"
+            "  -J <file>     Also write the results to <file> as JSON, latencies in ms.\n"
+            "  -r <file>     Replay the connections in a file captured by WebServer -C against URL's host,\n"
+            "                keeping their timing. -d limits the replay, other load options are ignored.\n"
+            "  -S <speed>    Replay <speed> times faster than captured, e.g. 2 or 0.5. Default 1.\n"
+            "  -I <n>        Before the load, open <n> keep-alive connections that send one request and then\n"
+            "                stay idle until the end, from several 127.0.0.x source addresses on loopback.\n",
+            MAX_DEPTH);
+}
+
+int main(int argc, char *argv[])
+{
+    char headers[2048] = "";
+    int opt;
+    while((opt = getopt(argc, argv, "c:T:d:R:P:s:H:KLJ:r:S:I:h?")) != -1){
+        switch(opt){
+            case 'c': connections = atoi(optarg); break;
+            case 'T': thread_number = atoi(optarg); break;
+            case 'd': duration = atoi(optarg); duration_set = 1; break;
+            case 'R': rate = atof(optarg); break;
+            case 'P': depth = atoi(optarg); break;
+            case 's': timeout_ms = atoi(optarg); break;
+            case 'H':
+                if(strlen(headers) + strlen(optarg) + 3 < sizeof(headers)){
+                    strcat(headers, optarg);
+                    strcat(headers, "\r\n");
+                }
+                break;
+            case 'K': keep_alive = 0; break;
+            case 'L': print_distribution = 1; break;
+            case 'J': json_file = optarg; break;
+            case 'r': replay_file = optarg; break;
+            case 'S': replay_speed = atof(optarg); break;
+            case 'I': idle_number = atoi(optarg); break;
+            default: usage(); return 2;
+        }
+    }
+    if(optind >= argc || connections < 1 || thread_number < 1 || duration < 1 || rate < 0
+       || depth < 1 || depth > MAX_DEPTH || timeout_ms < 1 || replay_speed <= 0 || idle_number < 0){
+        usage();
+        return 2;
+    }
+    if(thread_number > connections && !replay_file){
+        thread_number = connections;
+    }
+
+    char host[256];
+    int port;
+    const char *path;
+    snprintf(url_text, sizeof(url_text), "%s", argv[optind]);
+    if(parse_url(url_text, host, sizeof(host), &port, &path) < 0){
+        fprintf(stderr, "only http://host[:port]/path URLs are supported\n");
+        return 2;
+    }
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, NULL, &hints, &res) != 0){
+        fprintf(stderr, "cannot resolve %s\n", host);
+        return 1;
+    }
+    memcpy(&server_addr, res->ai_addr, sizeof(server_addr));
+    server_addr.sin_port = htons(port);
+    freeaddrinfo(res);
+
+    request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: loadgen\r\n"
+                           "Connection: %s\r\n%s\r\n", path, host, keep_alive ? "keep-alive" : "close", headers);
+    if(request_len >= (int)sizeof(request)){
+        fprintf(stderr, "request too long\n");
+        return 2;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    /* 大量连接需要的描述符号超过默认的软限制 */
+    struct rlimit nofile;
+    if(getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max){
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+    if(idle_number > 0){
+        char idle_request[4096];
+        int idle_request_len = snprintf(idle_request, sizeof(idle_request), "GET %s HTTP/1.1\r\nHost: %s\r\n"
+                                        "User-Agent: loadgen\r\nConnection: keep-alive\r\n%s\r\n", path, host, headers);
+        open_idle(idle_request, idle_request_len);
+    }
+    struct session **sessions = NULL;
+    int session_number = 0;
+    uint64_t span = 0;
+    if(replay_file){
+        sessions = load_capture(replay_file, &session_number, &span);
+        if(!sessions){
+            return 1;
+        }
+        if(thread_number > session_number){
+            thread_number = session_number;
+        }
+        printf("loadgen %s: replaying %d connections over %.1f s from %s at %gx speed, %d threads\n", url_text,
+               session_number, span / 1e9, replay_file, replay_speed, thread_number);
+    }else{
+        printf("loadgen %s: %d threads, %d connections, pipeline %d, %s", url_text, thread_number, connections, depth,
+               keep_alive ? "keep-alive" : "connection per request");
+        if(rate > 0){
+            printf(", open loop at %.0f req/s", rate);
+        }else{
+            printf(", closed loop");
+        }
+        printf(", %d s\n", duration);
+    }
+
+    struct thread *threads = calloc(thread_number, sizeof(struct thread));
+    pthread_barrier_init(&start_barrier, NULL, thread_number + 1);
+    for(int i = 0; i < thread_number; ++i){
+        struct thread *t = &threads[i];
+        if(replay_file){
+            /* 捕获的连接按建立的先后轮流分给各个线程 */
+            t->sessions = malloc((session_number / thread_number + 1) * sizeof(struct session *));
+            for(int j = i; j < session_number; j += thread_number){
+                t->sessions[t->session_number++] = sessions[j];
+            }
+            if(pthread_create(&t->tid, NULL, replay_main, t) != 0){
+                fprintf(stderr, "pthread_create failed\n");
+                return 3;
+            }
+            continue;
+        }
+        t->conn_number = connections / thread_number + (i < connections % thread_number ? 1 : 0);
+        t->conns = calloc(t->conn_number, sizeof(struct conn));
+        t->ready = calloc(t->conn_number + 1, sizeof(struct conn *));
+        t->rate = rate / thread_number;
+        /* 积压队列最多容纳一秒的请求 */
+        t->backlog_cap = t->rate > 0 ? (int)t->rate + 1024 : 1;
+        t->backlog = calloc(t->backlog_cap, sizeof(uint64_t));
+        if(pthread_create(&t->tid, NULL, thread_main, t) != 0){
+            fprintf(stderr, "pthread_create failed\n");
+            return 3;
+        }
+    }
+    /* 所有线程都建立好连接(或者超时)之后一起开始 */
+    global_start = now_ns() + 1000000ULL;
+    pthread_barrier_wait(&start_barrier);
+
+    struct histogram *corrected = calloc(1, sizeof(struct histogram));
+    struct histogram *service = calloc(1, sizeof(struct histogram));
+    uint64_t completed = 0, bytes = 0, status_errors = 0, connect_errors = 0, read_errors = 0, timeouts = 0;
+    uint64_t backlog_dropped = 0, unfinished = 0, replayed_sessions = 0, replayed_requests = 0;
+    for(int i = 0; i < thread_number; ++i){
+        struct thread *t = &threads[i];
+        pthread_join(t->tid, NULL);
+        hist_merge(corrected, &t->corrected);
+        hist_merge(service, &t->service);
+        completed += t->completed;
+        bytes += t->bytes;
+        status_errors += t->status_errors;
+        connect_errors += t->connect_errors;
+        read_errors += t->read_errors;
+        timeouts += t->timeouts;
+        backlog_dropped += t->backlog_dropped;
+        unfinished += t->unfinished;
+        replayed_sessions += t->replayed_sessions;
+        replayed_requests += t->replayed_requests;
+    }
+
+    /* 回放的时间由捕获决定 */
+    double elapsed = replay_file ? (now_ns() - global_start) / 1e9 : duration;
+    double achieved = (double)completed / elapsed;
+    if(replay_file){
+        printf("replayed: %llu of %d connections, %llu requests sent\n", (unsigned long long)replayed_sessions,
+               session_number, (unsigned long long)replayed_requests);
+    }
+    printf("requests: %llu in %.1f s, %.1f req/s, %.2f MB/s\n", (unsigned long long)completed, elapsed, achieved,
+           bytes / 1048576.0 / elapsed);
+    printf("errors: status %llu, connect %llu, read %llu, timeout %llu; unfinished %llu\n",
+           (unsigned long long)status_errors, (unsigned long long)connect_errors, (unsigned long long)read_errors,
+           (unsigned long long)timeouts, (unsigned long long)unfinished);
+    if(backlog_dropped){
+        printf("warning: %llu scheduled requests were dropped because no connection was free for a second, "
+               "add connections (-c)\n", (unsigned long long)backlog_dropped);
+    }
+    int alive = idle_number > 0 ? idle_alive() : 0;
+    if(idle_number > 0){
+        printf("idle: %d of %d connections still open\n", alive, idle_opened);
+    }
+    if(replay_file){
+        print_latency("latency (from the captured send time, scaled):", corrected);
+    }else if(rate > 0){
+        print_latency("latency (from scheduled send time, corrected for coordinated omission):", corrected);
+        if(achieved < rate * 0.95){
+            printf("warning: achieved %.1f req/s, below the target %.0f; latency above includes the queueing\n",
+                   achieved, rate);
+        }
+    }
+    print_latency("service time (from actual send):", service);
+    if(print_distribution){
+        print_distribution_hgrm(rate > 0 || replay_file ? corrected : service);
+    }
+    if(json_file){
+        uint64_t errors[4] = {status_errors, connect_errors, read_errors, timeouts};
+        if(write_json(json_file, elapsed, completed, bytes, errors, unfinished, alive, corrected, service) < 0){
+            return 1;
+        }
+    }
+    return completed > 0 ? 0 : 1;
+}
@@ -19,7 +19,7 @@
 #include "socket.c"
 #include <unistd.h>
 #include <sys/param.h>
-#include <rpc/types.h>
+#include <sys/types.h>
 #include <getopt.h>
 #include <strings.h>
 #include <time.h>
@@ -29,7 +29,7 @@
 volatile int timerexpired=0;
 int speed=0;
 int failed=0;
-int bytes=0;
+long long bytes=0;
 
 /* globals */
 int http10=1; /* 0 - http/0.9, 1 - http/1.0, 2 - http/1.1 */
@@ -324,7 +324,8 @@ void build_request(const char *url)
 /* vraci system rc error kod */
 static int bench(void)
 {
-    int i,j,k;	
+    int i,j;
+    long long k;	
     pid_t pid=0;
     FILE *f;
 
@@ -386,7 +387,7 @@ static int bench(void)
             return 3;
         }
         /* fprintf(stderr,"Child - %d %d\n",speed,failed); */
-        fprintf(f,"%d %d %d\n",speed,failed,bytes);
+        fprintf(f,"%d %d %lld\n",speed,failed,bytes);
         fclose(f);
 
         return 0;
@@ -408,7 +409,7 @@ static int bench(void)
     
         while(1)
         {
-            pid=fscanf(f,"%d %d %d",&i,&j,&k);
+            pid=fscanf(f,"%d %d %lld",&i,&j,&k);
             if(pid<2)
             {
                 fprintf(stderr,"Some of our childrens died.\n");
@@ -425,9 +426,9 @@ static int bench(void)
     
         fclose(f);
 
-        printf("\nSpeed=%d pages/min, %d bytes/sec.\nRequests: %d susceed, %d failed.\n",
+        printf("\nSpeed=%d pages/min, %lld bytes/sec.\nRequests: %d susceed, %d failed.\n",
             (int)((speed+failed)/(benchtime/60.0f)),
-            (int)(bytes/(float)benchtime),
+            (long long)(bytes/(double)benchtime),
             speed,
             failed);
     }
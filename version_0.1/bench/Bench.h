@@ -0,0 +1,223 @@
+//
+// 微基准测试的框架：每个基准是一个函数，按给定的次数运行被测代码，框架自动增加次数直到一次运行超过最短时间，
+// 重复几次取中位数。结果输出为Google Benchmark的JSON格式，可以直接用它的compare.py比较两次提交的结果
+// 用法: XxxBench [--filter=substring] [--min_time=seconds] [--repetitions=n] [--out=file.json]
+//
+
+#ifndef WEBSERVER_BENCH_H
+#define WEBSERVER_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+class BenchState{
+public:
+    explicit BenchState(uint64_t iterations) : m_iterations(iterations), m_items(0), m_paused_ns(0), m_pause_start(0),
+                                               m_paused_cpu_ns(0), m_pause_cpu_start(0), m_paused(false) {}
+    //被测代码应该执行的次数
+    uint64_t iterations() const { return m_iterations; }
+    //本次运行处理的条目数，用于计算items_per_second，不设置时等于iterations
+    void set_items_processed(uint64_t items){ m_items = items; }
+    uint64_t items_processed() const { return m_items ? m_items : m_iterations; }
+    //暂停计时，用于排除每轮的准备工作。函数返回时仍处于暂停状态的，之后的清理工作也不计时
+    void pause(){
+        m_pause_start = now_ns();
+        m_pause_cpu_start = cpu_ns();
+        m_paused = true;
+    }
+    void resume(){
+        m_paused_ns += now_ns() - m_pause_start;
+        m_paused_cpu_ns += cpu_ns() - m_pause_cpu_start;
+        m_paused = false;
+    }
+    //除去暂停的时间之后，从start开始经过的时间和CPU时间
+    uint64_t elapsed_ns(uint64_t start) const { return (m_paused ? m_pause_start : now_ns()) - start - m_paused_ns; }
+    uint64_t elapsed_cpu_ns(uint64_t start) const {
+        return (m_paused ? m_pause_cpu_start : cpu_ns()) - start - m_paused_cpu_ns;
+    }
+
+    static uint64_t now_ns(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    static uint64_t cpu_ns(){
+        struct timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+private:
+    uint64_t m_iterations;
+    uint64_t m_items;
+    uint64_t m_paused_ns;
+    uint64_t m_pause_start;
+    uint64_t m_paused_cpu_ns;
+    uint64_t m_pause_cpu_start;
+    bool m_paused;
+};
+
+typedef void (*BenchFunc)(BenchState &state, int64_t arg);
+
+class Bench{
+public:
+    //注册一个基准，arg非负时作为参数传给函数，name_arg为true时还附加到名字后面
+    static void add(const char *name, BenchFunc func, int64_t arg = -1, bool name_arg = true){
+        Entry entry;
+        entry.name = name;
+        if(arg >= 0 && name_arg){
+            entry.name += "/" + std::to_string((long long)arg);
+        }
+        entry.func = func;
+        entry.arg = arg;
+        entries().push_back(entry);
+    }
+
+    static int run_all(int argc, char *argv[]){
+        const char *filter = "";
+        const char *out_file = NULL;
+        double min_time = 0.2;
+        int repetitions = 3;
+        for(int i = 1; i < argc; ++i){
+            if(strncmp(argv[i], "--filter=", 9) == 0){
+                filter = argv[i] + 9;
+            }else if(strncmp(argv[i], "--min_time=", 11) == 0){
+                min_time = atof(argv[i] + 11);
+            }else if(strncmp(argv[i], "--repetitions=", 14) == 0){
+                repetitions = std::max(1, atoi(argv[i] + 14));
+            }else if(strncmp(argv[i], "--out=", 6) == 0){
+                out_file = argv[i] + 6;
+            }else{
+                fprintf(stderr, "usage: %s [--filter=substring] [--min_time=seconds] [--repetitions=n] [--out=file.json]\n",
+                        argv[0]);
+                return 1;
+            }
+        }
+
+        //被测代码的输出(例如线程池创建线程时的提示)转到stderr，stdout只留给JSON
+        fflush(stdout);
+        int json_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+
+        std::string json = context_json();
+        bool first = true;
+        for(size_t i = 0; i < entries().size(); ++i){
+            const Entry &entry = entries()[i];
+            if(!strstr(entry.name.c_str(), filter)){
+                continue;
+            }
+            //先找到一次运行超过min_time的次数，再用这个次数重复测量
+            uint64_t iterations = 1;
+            Result result;
+            while(true){
+                result = measure(entry, iterations);
+                if(result.real_ns >= min_time * 1e9 || iterations >= (1ULL << 40)){
+                    break;
+                }
+                double scale = result.real_ns > 0 ? min_time * 1e9 * 1.4 / result.real_ns : 10;
+                iterations = (uint64_t)(iterations * std::min(std::max(scale, 2.0), 10.0));
+            }
+            std::vector<Result> results(1, result);
+            for(int r = 1; r < repetitions; ++r){
+                results.push_back(measure(entry, iterations));
+            }
+            std::sort(results.begin(), results.end(), [](const Result &a, const Result &b){
+                return a.real_ns < b.real_ns;
+            });
+            const Result &median = results[results.size() / 2];
+            double real_per_iter = median.real_ns / iterations;
+            double cpu_per_iter = median.cpu_ns / iterations;
+            double items_per_second = median.real_ns > 0 ? median.items * 1e9 / median.real_ns : 0;
+            fprintf(stderr, "%-40s %12.1f ns %12.1f ns cpu %14llu iterations %14.0f items/s\n", entry.name.c_str(),
+                    real_per_iter, cpu_per_iter, (unsigned long long)iterations, items_per_second);
+
+            char line[512];
+            snprintf(line, sizeof(line), "%s    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n"
+                     "      \"run_type\": \"iteration\",\n      \"repetitions\": %d,\n      \"iterations\": %llu,\n"
+                     "      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\",\n"
+                     "      \"items_per_second\": %.1f\n    }",
+                     first ? "" : ",\n", entry.name.c_str(), entry.name.c_str(), repetitions,
+                     (unsigned long long)iterations, real_per_iter, cpu_per_iter, items_per_second);
+            json += line;
+            first = false;
+        }
+        json += "\n  ]\n}\n";
+
+        fflush(stdout);
+        FILE *fp = out_file ? fopen(out_file, "w") : fdopen(json_fd, "w");
+        if(!fp){
+            perror(out_file ? out_file : "stdout");
+            return 1;
+        }
+        fputs(json.c_str(), fp);
+        fclose(fp);
+        return 0;
+    }
+
+private:
+    struct Entry{
+        std::string name;
+        BenchFunc func;
+        int64_t arg;
+    };
+    struct Result{
+        double real_ns;
+        double cpu_ns;
+        uint64_t items;
+    };
+
+    static std::vector<Entry> &entries(){
+        static std::vector<Entry> s_entries;
+        return s_entries;
+    }
+
+    static Result measure(const Entry &entry, uint64_t iterations){
+        BenchState state(iterations);
+        uint64_t cpu_start = BenchState::cpu_ns();
+        uint64_t start = BenchState::now_ns();
+        entry.func(state, entry.arg);
+        Result result;
+        result.real_ns = (double)state.elapsed_ns(start);
+        result.cpu_ns = (double)state.elapsed_cpu_ns(cpu_start);
+        result.items = state.items_processed();
+        return result;
+    }
+
+    static std::string context_json(){
+        char host[256] = "";
+        gethostname(host, sizeof(host) - 1);
+        char date[64];
+        time_t now = time(nullptr);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", &tm);
+        char context[512];
+        snprintf(context, sizeof(context), "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"host_name\": \"%s\",\n"
+                 "    \"num_cpus\": %ld,\n    \"library_build_type\": \"%s\"\n  },\n  \"benchmarks\": [\n",
+                 date, host, sysconf(_SC_NPROCESSORS_ONLN),
+#ifdef NDEBUG
+                 "release"
+#else
+                 "debug"
+#endif
+                 );
+        return context;
+    }
+};
+
+//防止编译器把结果没有被使用的计算优化掉
+template<typename T>
+inline void bench_keep(const T &value){
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#define BENCH_MAIN() int main(int argc, char *argv[]){ register_benchmarks(); return Bench::run_all(argc, argv); }
+
+#endif //WEBSERVER_BENCH_H
@@ -0,0 +1,106 @@
+//
+// 解析和应答基准共用的请求样本，以及访问HttpConnection私有函数的辅助类
+//
+
+#ifndef WEBSERVER_BENCHHTTP_H
+#define WEBSERVER_BENCHHTTP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "HttpConnection.h"
+
+extern const char *doc_root;
+
+//请求样本：命令行工具、浏览器、带较多头部的请求、保持连接的请求、不存在的文件和错误的请求
+static const char *bench_corpus[] = {
+    "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\nUser-Agent: curl/7.88.1\r\nAccept: */*\r\n\r\n",
+    "GET /static/app.js HTTP/1.1\r\nHost: www.example.com\r\nConnection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/114.0 Safari/537.36\r\n"
+    "Accept: */*\r\nSec-Fetch-Site: same-origin\r\nSec-Fetch-Mode: no-cors\r\nSec-Fetch-Dest: script\r\n"
+    "Referer: https://www.example.com/index.html\r\nAccept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark; _ga=GA1.2.1234567890.1650000000\r\n\r\n",
+    "GET /img/logo.png HTTP/1.1\r\nHost: www.example.com\r\nConnection: keep-alive\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/*,*/*;q=0.8\r\nAccept-Encoding: gzip\r\n\r\n",
+    "GET /missing.html HTTP/1.1\r\nHost: www.example.com\r\nConnection: close\r\n\r\n",
+    "GET /index.html HTTP/1.0\r\nHost: 127.0.0.1\r\n\r\n",
+};
+static const int BENCH_CORPUS_SIZE = sizeof(bench_corpus) / sizeof(bench_corpus[0]);
+
+class HttpConnectionBench{
+public:
+    //在临时目录中建立样本请求的文件，把doc_root指向它
+    static void make_doc_root(){
+        static char dir[] = "/tmp/webserver-bench-XXXXXX";
+        if(!mkdtemp(dir)){
+            perror("mkdtemp");
+            exit(1);
+        }
+        const char *files[] = {"/index.html", "/static/app.js", "/img/logo.png"};
+        for(size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i){
+            std::string path = std::string(dir) + files[i];
+            std::string parent = path.substr(0, path.rfind('/'));
+            mkdir(parent.c_str(), 0755);
+            FILE *fp = fopen(path.c_str(), "w");
+            if(!fp){
+                perror(path.c_str());
+                exit(1);
+            }
+            std::string body(1024 * (i + 1), 'x');
+            fwrite(body.data(), 1, body.size(), fp);
+            fclose(fp);
+        }
+        doc_root = dir;
+    }
+
+    //把请求放进读缓冲区，只重置从状态机的位置，parse_line会把行尾改成'\0'，每次都要重新拷贝
+    static void load_raw(HttpConnection &conn, const char *request, int len){
+        memcpy(conn.m_read_buf, request, len);
+        conn.m_read_idx = len;
+        conn.m_checked_idx = 0;
+        conn.m_start_line = 0;
+    }
+    //切分出所有完整的行，返回行数
+    static int parse_lines(HttpConnection &conn){
+        int lines = 0;
+        while(conn.parse_line() == HttpConnection::LINE_OK){
+            conn.m_start_line = conn.m_checked_idx;
+            ++lines;
+        }
+        return lines;
+    }
+    //与服务器中一样，每个请求之前调用init()重置连接，然后完整地解析并执行do_request
+    static HttpConnection::HTTP_CODE process_read(HttpConnection &conn, const char *request, int len){
+        conn.init();
+        memcpy(conn.m_read_buf, request, len);
+        conn.m_read_idx = len;
+        HttpConnection::HTTP_CODE ret = conn.process_read();
+        conn.unmap();
+        return ret;
+    }
+
+    //只格式化状态行和通用头部
+    static void status_and_headers(HttpConnection &conn, int content_length){
+        conn.m_write_idx = 0;
+        conn.add_status_line(200, "OK");
+        conn.add_headers(content_length);
+    }
+    //填充一个完整的应答，文件应答指向调用者提供的内存
+    static bool process_write(HttpConnection &conn, HttpConnection::HTTP_CODE code, char *file, int file_size){
+        conn.m_write_idx = 0;
+        conn.m_iv_count = 0;
+        conn.m_linger = true;
+        conn.m_file_address = file;
+        conn.m_file_stat.st_size = file_size;
+        bool ret = conn.process_write(code);
+        conn.m_file_address = nullptr;
+        return ret;
+    }
+    static int written(const HttpConnection &conn){ return conn.m_write_idx; }
+};
+
+#endif //WEBSERVER_BENCHHTTP_H
@@ -0,0 +1,11 @@
+//
+// 服务器代码依赖的全局对象在main函数所在的文件中定义，微基准测试没有链接那个文件，在这里定义
+//
+
+#include "Locker.h"
+#include "TimeHeap.h"
+#include "Config.h"
+
+Locker timeHeapLock;
+TimeHeap timeHeap(100);
+ServerConfig config;
@@ -0,0 +1,55 @@
+//
+// 请求解析的微基准：从状态机parse_line，以及包括do_request在内的完整process_read
+//
+
+#include "Bench.h"
+#include "BenchHttp.h"
+#include "StatCache.h"
+
+static HttpConnection *conn = nullptr;
+
+//按行切分一个样本请求，arg是样本的序号
+static void bench_parse_line(BenchState &state, int64_t arg){
+    const char *request = bench_corpus[arg];
+    int len = strlen(request);
+    int lines = 0;
+    for(uint64_t i = 0; i < state.iterations(); ++i){
+        HttpConnectionBench::load_raw(*conn, request, len);
+        lines += HttpConnectionBench::parse_lines(*conn);
+    }
+    bench_keep(lines);
+}
+
+//依次处理所有样本，每次迭代是一个请求
+static void bench_process_read(BenchState &state, int64_t arg){
+    int lens[BENCH_CORPUS_SIZE];
+    for(int i = 0; i < BENCH_CORPUS_SIZE; ++i){
+        lens[i] = strlen(bench_corpus[i]);
+    }
+    int codes = 0;
+    for(uint64_t i = 0; i < state.iterations(); ++i){
+        int idx = i % BENCH_CORPUS_SIZE;
+        codes += HttpConnectionBench::process_read(*conn, bench_corpus[idx], lens[idx]);
+    }
+    bench_keep(codes);
+}
+
+//同上，文件元数据来自共享内存中的缓存(-c)
+static void bench_process_read_stat_cache(BenchState &state, int64_t arg){
+    if(!StatCache::enabled()){
+        StatCache::init(60000);
+    }
+    bench_process_read(state, arg);
+}
+
+static void register_benchmarks(){
+    conn = new HttpConnection;
+    HttpConnectionBench::make_doc_root();
+    for(int i = 0; i < BENCH_CORPUS_SIZE; ++i){
+        Bench::add("parse_line", bench_parse_line, i);
+    }
+    Bench::add("process_read/corpus", bench_process_read);
+    Bench::add("process_read/corpus_stat_cache", bench_process_read_stat_cache);
+}
+
+BENCH_MAIN()
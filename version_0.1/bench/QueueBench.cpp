@@ -0,0 +1,94 @@
+//
+// 线程池请求队列的微基准：入队、唤醒工作线程、出队的吞吐量，以及多个线程同时入队时的锁争用
+//
+
+#include "Bench.h"
+#include "ThreadPool.h"
+#include <sched.h>
+#include <pthread.h>
+#include <atomic>
+
+//空任务，只计数
+struct BenchTask{
+    std::atomic<uint64_t> processed;
+    BenchTask() : processed(0) {}
+    void process(){ processed.fetch_add(1, std::memory_order_relaxed); }
+};
+
+//队列满时让出CPU再试
+static void push(ThreadPool<BenchTask> *pool, BenchTask *task, uint64_t count){
+    for(uint64_t i = 0; i < count; ++i){
+        while(!pool->append(task)){
+            sched_yield();
+        }
+    }
+}
+
+static void wait_processed(BenchTask &task, uint64_t count){
+    while(task.processed.load(std::memory_order_relaxed) < count){
+        sched_yield();
+    }
+}
+
+//一个生产者(主线程)，arg个工作线程
+static void bench_append_dequeue(BenchState &state, int64_t workers){
+    state.pause();
+    BenchTask task;
+    ThreadPool<BenchTask> *pool = new ThreadPool<BenchTask>((int)workers);
+    state.resume();
+    push(pool, &task, state.iterations());
+    wait_processed(task, state.iterations());
+    state.pause();
+    delete pool;
+}
+
+struct Producer{
+    ThreadPool<BenchTask> *pool;
+    BenchTask *task;
+    uint64_t count;
+};
+
+static void *producer(void *arg){
+    Producer *p = (Producer *)arg;
+    push(p->pool, p->task, p->count);
+    return NULL;
+}
+
+//arg个生产者线程同时入队，4个工作线程
+static void bench_contended(BenchState &state, int64_t producers){
+    state.pause();
+    BenchTask task;
+    ThreadPool<BenchTask> *pool = new ThreadPool<BenchTask>(4);
+    std::vector<Producer> args(producers);
+    std::vector<pthread_t> threads(producers);
+    uint64_t total = 0;
+    for(int64_t i = 0; i < producers; ++i){
+        args[i].pool = pool;
+        args[i].task = &task;
+        args[i].count = state.iterations() / producers + (i < (int64_t)(state.iterations() % producers) ? 1 : 0);
+        total += args[i].count;
+    }
+    state.resume();
+    for(int64_t i = 0; i < producers; ++i){
+        pthread_create(&threads[i], NULL, producer, &args[i]);
+    }
+    for(int64_t i = 0; i < producers; ++i){
+        pthread_join(threads[i], NULL);
+    }
+    wait_processed(task, total);
+    state.pause();
+    delete pool;
+}
+
+static void register_benchmarks(){
+    const int64_t workers[] = {1, 2, 4, 8};
+    for(size_t i = 0; i < sizeof(workers) / sizeof(workers[0]); ++i){
+        Bench::add("ThreadPool/append_dequeue/workers", bench_append_dequeue, workers[i]);
+    }
+    const int64_t producers[] = {1, 2, 4, 8};
+    for(size_t i = 0; i < sizeof(producers) / sizeof(producers[0]); ++i){
+        Bench::add("ThreadPool/contended/producers", bench_contended, producers[i]);
+    }
+}
+
+BENCH_MAIN()
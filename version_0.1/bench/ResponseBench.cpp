@@ -0,0 +1,38 @@
+//
+// 应答填充的微基准：add_response格式化的头部，以及process_write生成的文件应答和错误应答
+//
+
+#include "Bench.h"
+#include "BenchHttp.h"
+
+static HttpConnection *conn = nullptr;
+static char file_body[4096];
+
+static void bench_status_and_headers(BenchState &state, int64_t arg){
+    int bytes = 0;
+    for(uint64_t i = 0; i < state.iterations(); ++i){
+        HttpConnectionBench::status_and_headers(*conn, (int)(i & 0xffff));
+        bytes += HttpConnectionBench::written(*conn);
+    }
+    bench_keep(bytes);
+}
+
+//arg是HttpConnection::HTTP_CODE
+static void bench_process_write(BenchState &state, int64_t arg){
+    HttpConnection::HTTP_CODE code = (HttpConnection::HTTP_CODE)arg;
+    int ok = 0;
+    for(uint64_t i = 0; i < state.iterations(); ++i){
+        ok += HttpConnectionBench::process_write(*conn, code, file_body, sizeof(file_body));
+    }
+    bench_keep(ok);
+}
+
+static void register_benchmarks(){
+    conn = new HttpConnection;
+    Bench::add("add_response/status_and_headers", bench_status_and_headers);
+    Bench::add("process_write/file", bench_process_write, HttpConnection::FILE_REQUEST, false);
+    Bench::add("process_write/not_found", bench_process_write, HttpConnection::NO_RESOURCE, false);
+    Bench::add("process_write/bad_request", bench_process_write, HttpConnection::BAD_REQUEST, false);
+}
+
+BENCH_MAIN()
@@ -0,0 +1,93 @@
+//
+// 定时器堆的微基准，堆中的定时器数从1万到100万
+//
+
+#include "Bench.h"
+#include "TimeHeap.h"
+#include <vector>
+
+//伪随机的过期时间，不同的堆大小使用相同的序列
+static time_t next_expire(uint64_t &seed, time_t base, int spread){
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return base + (time_t)((seed >> 33) % spread);
+}
+
+//定时器由调用者拥有，与服务器中内嵌在连接对象里一样
+static void fill(TimeHeap &heap, std::vector<Timer> &timers, time_t base, uint64_t &seed){
+    for(size_t i = 0; i < timers.size(); ++i){
+        timers[i].expire = next_expire(seed, base, (int)timers.size());
+        heap.add_timer(&timers[i]);
+    }
+}
+
+//堆中保持n个定时器，每次迭代弹出堆顶，再以新的过期时间加入，与服务器中连接不断重新计时的情形相同
+static void bench_add_pop(BenchState &state, int64_t n){
+    state.pause();
+    TimeHeap heap(100);
+    std::vector<Timer> timers(n, Timer(0, nullptr));
+    uint64_t seed = 1;
+    time_t base = time(nullptr) + 1000;
+    fill(heap, timers, base, seed);
+    state.resume();
+    for(uint64_t i = 0; i < state.iterations(); ++i){
+        Timer *timer = heap.top();
+        heap.pop_timer();
+        timer->expire = next_expire(seed, base, (int)n);
+        heap.add_timer(timer);
+    }
+    state.pause();
+}
+
+//n个已经过期的定时器，按handle_expired_conn的方式检查堆顶并全部弹出。每次迭代处理n个定时器
+static void bench_expire(BenchState &state, int64_t n){
+    uint64_t seed = 1;
+    for(uint64_t i = 0; i < state.iterations(); ++i){
+        state.pause();
+        TimeHeap heap(100);
+        std::vector<Timer> timers(n, Timer(0, nullptr));
+        fill(heap, timers, time(nullptr) - n - 1, seed);
+        state.resume();
+        int expired = 0;
+        while(!heap.empty()){
+            Timer *timer = heap.top();
+            if(timer->isvalid()){
+                break;
+            }
+            ++expired;
+            heap.pop_timer();
+        }
+        bench_keep(expired);
+    }
+    state.set_items_processed(state.iterations() * n);
+}
+
+//连接交给工作线程时把定时器从堆中删除，处理完再加回去。每次迭代删除并重新加入一个定时器
+static void bench_del(BenchState &state, int64_t n){
+    state.pause();
+    TimeHeap heap(100);
+    std::vector<Timer> timers(n, Timer(0, nullptr));
+    uint64_t seed = 1;
+    time_t base = time(nullptr) + 1000;
+    fill(heap, timers, base, seed);
+    state.resume();
+    for(uint64_t i = 0; i < state.iterations(); ++i){
+        Timer *timer = &timers[i % n];
+        heap.del_timer(timer);
+        timer->expire = next_expire(seed, base, (int)n);
+        heap.add_timer(timer);
+    }
+    state.pause();
+}
+
+static void register_benchmarks(){
+    const int64_t sizes[] = {10000, 100000, 1000000};
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i){
+        Bench::add("TimeHeap/add_pop", bench_add_pop, sizes[i]);
+    }
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i){
+        Bench::add("TimeHeap/expire", bench_expire, sizes[i]);
+    }
+    Bench::add("TimeHeap/del", bench_del, 10000);
+}
+
+BENCH_MAIN()
@@ -0,0 +1,43 @@
+//
+// CGI示例程序：以常驻工作进程方式运行时循环处理请求，直接运行时按传统CGI方式输出一次。
+// 环境变量HELLO_CGI_PAD为正数时在问候之后再输出这么多字节，用来检查超过一条记录(64KB)的应答
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "CgiProtocol.h"
+
+static int served = 0;
+static char *padding = NULL;
+static size_t pad = 0;
+
+static void handle(const CgiRequest &request){
+    char body[256];
+    const char *script = cgi_param(request, "SCRIPT_FILENAME");
+    const char *client = cgi_param(request, "REMOTE_ADDR");
+    int len = snprintf(body, sizeof(body), "hello %s from %s (pid %d, request %d)\n",
+                       client ? client : "-", script ? script : "-", getpid(), ++served);
+    cgi_worker_write(request, body, len);
+    if(pad > 0){
+        cgi_worker_write(request, padding, pad);
+    }
+}
+
+int main(int argc, char *argv[]){
+    const char *pad_env = getenv("HELLO_CGI_PAD");
+    if(pad_env && atol(pad_env) > 0){
+        pad = (size_t)atol(pad_env);
+        padding = (char *)malloc(pad);
+        for(size_t i = 0; i < pad; ++i){
+            padding[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+        }
+    }
+    if(getenv(CGI_WORKER_ENV)){
+        return cgi_worker_serve(handle);
+    }
+    printf("hello from %s (pid %d)\n", argv[0], getpid());
+    if(pad > 0){
+        fwrite(padding, 1, pad, stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+//
+// 访问日志：工作线程在应答发送完后把一条定长的二进制记录放入自己的环形缓冲区，只是一次拷贝；
+// 后台线程定期取出所有线程的记录，格式化成Common Log Format(末尾加上处理时间)后用writev批量写入文件。
+// 磁盘慢、环满时丢弃新记录并计数，工作线程永远不会因为写日志而阻塞。收到SIGHUP时重新打开文件，配合logrotate使用
+//
+
+#ifndef WEBSERVER_ACCESSLOG_H
+#define WEBSERVER_ACCESSLOG_H
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+
+//一条访问记录
+struct AccessRecord{
+    //请求完成的时间，单位秒(CLOCK_REALTIME)
+    int64_t time;
+    //处理时间：从读到请求到应答发送完，单位微秒
+    uint32_t duration_us;
+    //对方的IPv4地址和端口，网络字节序
+    uint32_t addr;
+    uint16_t port;
+    uint16_t status;
+    //HttpConnection::METHOD
+    uint8_t method;
+    //请求行中的HTTP版本，主版本号*10+次版本号，例如11表示HTTP/1.1；没有可以识别的版本时为0
+    uint8_t version;
+    uint8_t reserved[2];
+    //发送的字节数，包括应答头部
+    uint32_t bytes;
+    //请求的URL，超长时截断
+    char url[96];
+};
+
+class AccessLog{
+public:
+    //打开日志文件，检查它可写
+    static bool init(const char *file);
+    static bool enabled(){ return m_file != nullptr; }
+    //启动后台写日志的线程。多进程时每个服务进程在fork之后各自启动
+    static bool start();
+    //写出所有剩下的记录，结束后台线程
+    static void stop();
+    //请求下次写之前重新打开文件，可以在信号处理之外的任何线程中调用
+    static void reopen(){ m_reopen.store(true); }
+    //工作线程调用：放入当前线程的环，环满时丢弃并计数
+    static void append(const AccessRecord &record);
+
+public:
+    //每个线程的环能容纳的记录数
+    static const int RING_SIZE = 4096;
+    static const int MAX_RINGS = 64;
+    //后台线程两次写之间的间隔，单位毫秒
+    static const int FLUSH_INTERVAL = 100;
+
+private:
+    //单生产者单消费者的环：所属的工作线程推进head，后台线程推进tail
+    struct Ring{
+        AccessRecord records[RING_SIZE];
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+    };
+    static Ring *ring();
+    static void *flusher(void *arg);
+    //取出所有环中的记录并写入文件，返回写出的记录数
+    static int flush();
+
+private:
+    static const char *m_file;
+    static int m_fd;
+    static pthread_t m_thread;
+    static std::atomic<bool> m_running;
+    static std::atomic<bool> m_reopen;
+    static std::atomic<Ring *> m_rings[MAX_RINGS];
+    static std::atomic<int> m_ring_number;
+};
+
+#endif //WEBSERVER_ACCESSLOG_H
@@ -0,0 +1,51 @@
+//
+// 准入控制：过载时由主线程直接回复预先生成的503，不经过工作线程，请求不再堆积在队列里等到超时。
+// 排队时间按CoDel的方式判断是否过载：工作线程每取出一个请求报告它的排队时间，一个间隔(100ms)内最短的排队时间
+// 超过目标值说明队列一直没有排空，处于过载状态。请求在主线程中入队之前还没有排队时间，
+// 用队列长度除以最近一个间隔的出队速率估计它要等多久，过载时估计值超过两倍目标值的请求被拒绝。
+// 另外可以限制连接占用的字节数：排队中的请求和等待EPOLLOUT的应答，超过上限时同样拒绝新的请求
+//
+
+#ifndef WEBSERVER_ADMISSION_H
+#define WEBSERVER_ADMISSION_H
+
+#include <stdint.h>
+#include <atomic>
+#include "Metrics.h"
+
+class Admission{
+public:
+    //target_ms为排队时间的目标值，为0时不按排队时间拒绝；budget_bytes为字节数上限，为0时不限制
+    static void init(int target_ms, uint64_t budget_bytes);
+    static bool enabled(){ return m_target_ns != 0 || m_budget_bytes != 0; }
+    //工作线程从请求队列取出一个请求时调用，wait为它的排队时间
+    static void dequeued(uint64_t now, uint64_t wait);
+    //主线程把请求放入队列之前调用：queued为队列中已有的请求数，bytes为这个请求占用的字节数。
+    //接受时返回true，拒绝时返回false并在reason中给出拒绝的原因
+    static bool admit(int queued, int bytes, METRIC_COUNTER &reason);
+    //连接占用的字节数变化了delta
+    static void hold(int64_t delta){ m_held_bytes.fetch_add(delta, std::memory_order_relaxed); }
+    //在主线程中拒绝socket上的请求：读掉已经到达的请求(关闭有未读数据的socket会发送RST，客户端可能收不到应答)，
+    //再非阻塞地发送503，发不出去也不等待。socket由调用者关闭
+    static void reject(int fd);
+
+public:
+    //CoDel判断过载的间隔，单位纳秒
+    static const uint64_t INTERVAL = 100000000;
+
+private:
+    //预先生成的503应答，Retry-After要求客户端1秒后重试
+    static const char RESPONSE[];
+    static uint64_t m_target_ns;
+    static uint64_t m_budget_bytes;
+    static std::atomic<int64_t> m_held_bytes;
+    //当前间隔的开始时间、间隔内最短的排队时间和出队的请求数
+    static std::atomic<uint64_t> m_interval_start;
+    static std::atomic<uint64_t> m_min_wait;
+    static std::atomic<uint32_t> m_dequeued;
+    //上一个间隔的结果：是否过载，以及平均每出队一个请求的时间
+    static std::atomic<bool> m_overloaded;
+    static std::atomic<uint64_t> m_drain_ns;
+};
+
+#endif //WEBSERVER_ADMISSION_H
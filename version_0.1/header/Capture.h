@@ -0,0 +1,67 @@
+//
+// 请求捕获：把连接的建立、收到的原始字节和关闭连同时间写入文件，用loadgen -r回放，
+// 得到与线上相同的URL分布、头部大小和连接复用方式。记录先拷贝进当前线程自己的缓冲区，
+// 后台线程定期换出所有线程的缓冲区，用一次writev以O_APPEND写入，多个进程写同一个文件时记录不会交错。
+// 同一连接的记录可能来自不同线程，文件中不保证按时间排列，loadgen按时间排序每个连接的记录。
+// 缓冲区满(磁盘跟不上)时丢弃新记录并计数，工作线程不会因为写文件而阻塞。文件中是请求的原文(包括Cookie等)，权限为0600
+//
+
+#ifndef WEBSERVER_CAPTURE_H
+#define WEBSERVER_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include "CaptureFormat.h"
+#include "Locker.h"
+
+class Capture{
+public:
+    //截断文件并写入文件头，必须在fork出服务进程之前调用。写满max_bytes后停止捕获
+    static bool init(const char *file, uint64_t max_bytes);
+    static bool enabled(){ return m_file != nullptr && !m_full.load(std::memory_order_relaxed); }
+    //启动后台写文件的线程。多进程时每个服务进程在fork之后各自启动
+    static bool start();
+    //写出所有剩下的记录，结束后台线程
+    static void stop();
+    //新连接，返回它的编号
+    static uint64_t open(uint64_t now);
+    static void data(uint64_t conn, uint64_t now, const char *buf, size_t len);
+    static void close(uint64_t conn, uint64_t now);
+
+public:
+    //每个线程的缓冲区大小，两次写之间追加的记录超过这个大小时丢弃
+    static const size_t BUFFER_BYTES = 4 << 20;
+    static const int MAX_BUFFERS = 64;
+    //后台线程两次写之间的间隔，单位毫秒
+    static const int FLUSH_INTERVAL = 100;
+
+private:
+    //每个线程一个缓冲区。锁只在后台线程换出data时才会有竞争，spare是换出后写文件用的另一块，两块都预先分配
+    struct Buffer{
+        Locker lock;
+        std::string data;
+        std::string spare;
+    };
+    static Buffer *buffer();
+    static void append(uint64_t conn, uint64_t now, uint16_t event, const char *buf, size_t len);
+    static void *flusher(void *arg);
+    //换出所有线程的缓冲区并写入文件
+    static void flush();
+
+private:
+    static const char *m_file;
+    static int m_fd;
+    static uint64_t m_max_bytes;
+    static std::atomic<uint64_t> m_bytes;
+    static std::atomic<bool> m_full;
+    static std::atomic<uint32_t> m_next_conn;
+    static pthread_t m_thread;
+    static std::atomic<bool> m_running;
+    static std::atomic<Buffer *> m_buffers[MAX_BUFFERS];
+    static std::atomic<int> m_buffer_number;
+};
+
+#endif //WEBSERVER_CAPTURE_H
@@ -0,0 +1,38 @@
+/*
+ * 请求捕获文件的格式。服务器(-C)把每个连接的建立、收到的原始字节和关闭按发生的时间写入文件，
+ * WebBench/loadgen的回放模式(-r)按同样的时间间隔重新建立这些连接、发送同样的字节。
+ * 这个头文件只使用C的类型，由服务器和loadgen共用
+ */
+
+#ifndef WEBSERVER_CAPTUREFORMAT_H
+#define WEBSERVER_CAPTUREFORMAT_H
+
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "WSCAPT01"
+
+/* 文件头，后面紧跟着若干条记录 */
+typedef struct capture_file_header{
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+} capture_file_header;
+
+enum capture_event{
+    CAPTURE_OPEN = 1,   /* 连接被accept */
+    CAPTURE_DATA = 2,   /* 一次recv读到的数据，HTTPS连接记录解密后的明文 */
+    CAPTURE_CLOSE = 3   /* 服务器关闭连接(对方关闭、超时或者不保持连接) */
+};
+
+/* 记录头，CAPTURE_DATA后面紧跟着length字节的数据。按本机字节序 */
+typedef struct capture_record{
+    /* CLOCK_MONOTONIC纳秒，同一台机器上的各个服务进程可以直接比较 */
+    uint64_t time;
+    /* 连接编号：高32位是进程号，低32位是进程内的序号 */
+    uint64_t conn;
+    uint32_t length;
+    uint16_t event;
+    uint16_t reserved;
+} capture_record;
+
+#endif /* WEBSERVER_CAPTUREFORMAT_H */
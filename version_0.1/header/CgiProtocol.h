@@ -0,0 +1,170 @@
+//
+// CGI常驻工作进程的通信协议，格式参考FastCGI：每条记录由8字节的头部和内容组成
+// 启动时:   工作进程 -> 服务器  CGI_READY，服务器据此区分常驻工作进程和只往标准输出写一次的传统CGI程序
+// 一次请求: 服务器 -> 工作进程  CGI_BEGIN, CGI_PARAMS(若干"KEY=VALUE\0")
+//          工作进程 -> 服务器  CGI_STDOUT(0条或多条), CGI_END
+// 工作进程处理完一个请求后继续等待下一个请求，不再为每个请求fork + execl
+//
+
+#ifndef WEBSERVER_CGIPROTOCOL_H
+#define WEBSERVER_CGIPROTOCOL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+//工作进程从这个文件描述符读写记录，服务器exec工作进程之前把socketpair的一端dup2到这里
+#define CGI_WORKER_FD 3
+//exec工作进程时设置的环境变量，程序据此判断自己是常驻工作进程
+#define CGI_WORKER_ENV "CGI_WORKER"
+
+enum CGI_RECORD_TYPE {CGI_BEGIN = 1, CGI_PARAMS, CGI_STDOUT, CGI_END, CGI_READY};
+
+struct CgiRecordHeader{
+    uint8_t version;
+    uint8_t type;
+    uint16_t request_id;
+    uint32_t content_length;
+};
+
+//一条记录的最大内容长度
+static const uint32_t CGI_MAX_CONTENT = 65536;
+
+//阻塞地读满len字节，对方关闭或出错返回false
+static inline bool cgi_read_full(int fd, void *buf, size_t len){
+    char *p = (char *)buf;
+    while(len > 0){
+        ssize_t ret = read(fd, p, len);
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            return false;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+static inline bool cgi_write_full(int fd, const void *buf, size_t len){
+    const char *p = (const char *)buf;
+    while(len > 0){
+        ssize_t ret = write(fd, p, len);
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            return false;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+//发送一条记录，头部和内容用一次writev发出
+static inline bool cgi_write_record(int fd, uint8_t type, uint16_t request_id, const void *content, uint32_t len){
+    CgiRecordHeader header;
+    header.version = 1;
+    header.type = type;
+    header.request_id = request_id;
+    header.content_length = len;
+    struct iovec iv[2];
+    iv[0].iov_base = &header;
+    iv[0].iov_len = sizeof(header);
+    iv[1].iov_base = (void *)content;
+    iv[1].iov_len = len;
+    ssize_t ret = writev(fd, iv, len ? 2 : 1);
+    if(ret == (ssize_t)(sizeof(header) + len)){
+        return true;
+    }
+    //没有一次写完时退回逐段写
+    if(ret < 0){
+        if(errno != EINTR){
+            return false;
+        }
+        ret = 0;
+    }
+    if((size_t)ret < sizeof(header)){
+        if(!cgi_write_full(fd, (char *)&header + ret, sizeof(header) - ret)){
+            return false;
+        }
+        ret = sizeof(header);
+    }
+    return cgi_write_full(fd, (const char *)content + (ret - sizeof(header)), len - (ret - sizeof(header)));
+}
+
+//读取一条记录，内容超过cap时返回false
+static inline bool cgi_read_record(int fd, CgiRecordHeader &header, char *content, uint32_t cap){
+    if(!cgi_read_full(fd, &header, sizeof(header)) || header.content_length > cap){
+        return false;
+    }
+    return cgi_read_full(fd, content, header.content_length);
+}
+
+/* 工作进程一侧的主循环：handler处理一个请求，通过cgi_worker_write输出应答，返回后自动发送CGI_END。
+ * params是以'\0'分隔的"KEY=VALUE"列表，cgi_param从中取值 */
+struct CgiRequest{
+    int fd;
+    uint16_t request_id;
+    const char *params;
+    uint32_t params_len;
+};
+
+static inline const char *cgi_param(const CgiRequest &request, const char *key){
+    size_t key_len = strlen(key);
+    const char *p = request.params;
+    const char *end = request.params + request.params_len;
+    while(p < end){
+        size_t len = strnlen(p, end - p);
+        if(len > key_len && strncmp(p, key, key_len) == 0 && p[key_len] == '='){
+            return p + key_len + 1;
+        }
+        p += len + 1;
+    }
+    return NULL;
+}
+
+//服务器读取记录时内容最长为CGI_MAX_CONTENT，更长的输出拆成多条CGI_STDOUT记录
+static inline bool cgi_worker_write(const CgiRequest &request, const void *data, size_t len){
+    const char *p = (const char *)data;
+    while(len > 0){
+        uint32_t n = len > CGI_MAX_CONTENT ? CGI_MAX_CONTENT : (uint32_t)len;
+        if(!cgi_write_record(request.fd, CGI_STDOUT, request.request_id, p, n)){
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static inline int cgi_worker_serve(void (*handler)(const CgiRequest &request)){
+    static char params[CGI_MAX_CONTENT + 1];
+    CgiRecordHeader header;
+    CgiRequest request;
+    request.fd = CGI_WORKER_FD;
+    if(!cgi_write_record(CGI_WORKER_FD, CGI_READY, 0, NULL, 0)){
+        return 1;
+    }
+    while(cgi_read_record(CGI_WORKER_FD, header, params, CGI_MAX_CONTENT)){
+        if(header.type != CGI_PARAMS){
+            continue;
+        }
+        params[header.content_length] = '\0';
+        request.request_id = header.request_id;
+        request.params = params;
+        request.params_len = header.content_length;
+        handler(request);
+        if(!cgi_write_record(CGI_WORKER_FD, CGI_END, request.request_id, NULL, 0)){
+            break;
+        }
+    }
+    return 0;
+}
+
+#endif //WEBSERVER_CGIPROTOCOL_H
@@ -0,0 +1,161 @@
+//
+// CGI常驻工作进程池
+// 进程池的每个子进程各自管理一组CGI工作进程：第一次请求某个CGI程序时fork + execl启动它，
+// 之后的请求都通过socketpair以CgiProtocol.h中的记录格式交给已经启动的工作进程处理。
+// 子进程同步地处理一个请求，所以每个CGI程序只需要一个工作进程。
+// 启动后没有发送CGI_READY的程序是传统CGI程序，记下来之后由调用者为每个请求fork + execl
+//
+
+#ifndef WEBSERVER_CGIWORKERPOOL_H
+#define WEBSERVER_CGIWORKERPOOL_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <signal.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "CgiProtocol.h"
+
+//CGI工作进程，m_fd是与它通信的socketpair的本端
+class CgiWorker{
+public:
+    CgiWorker() : m_pid(-1), m_fd(-1) {}
+public:
+    pid_t m_pid;
+    int m_fd;
+};
+
+class CgiWorkerPool{
+public:
+    //最多同时管理的CGI程序数量
+    static const int MAX_PROGRAM_NUMBER = 16;
+    static const int PATH_LEN = 256;
+    //等待新启动的程序发送CGI_READY的最长时间，单位毫秒
+    static const int READY_TIMEOUT = 1000;
+
+    CgiWorkerPool() : m_program_number(0) {}
+    ~CgiWorkerPool(){
+        for(int i = 0; i < m_program_number; ++i){
+            stop(m_programs[i].worker);
+        }
+    }
+
+    //取得program的工作进程，必要时启动它，失败返回NULL。
+    //program不是常驻工作进程时同样返回NULL并把classic置为true，调用者应当改为fork + execl执行它
+    CgiWorker *acquire(const char *program, bool &classic){
+        classic = false;
+        Program *entry = find(program);
+        if(!entry){
+            return NULL;
+        }
+        if(entry->classic){
+            classic = true;
+            return NULL;
+        }
+        if(entry->worker.m_pid != -1){
+            return &entry->worker;
+        }
+        if(!spawn(entry->worker, program, classic)){
+            entry->classic = classic;
+            return NULL;
+        }
+        return &entry->worker;
+    }
+
+    //请求处理完毕后归还工作进程。broken为true表示通信出错，工作进程会被停止，下次请求时重新启动
+    void release(CgiWorker *worker, bool broken){
+        if(broken){
+            stop(*worker);
+        }
+    }
+
+private:
+    struct Program{
+        char path[PATH_LEN];
+        CgiWorker worker;
+        bool classic;
+    };
+
+    Program *find(const char *program){
+        if(strlen(program) >= PATH_LEN){
+            return NULL;
+        }
+        for(int i = 0; i < m_program_number; ++i){
+            if(strcmp(m_programs[i].path, program) == 0){
+                return &m_programs[i];
+            }
+        }
+        if(m_program_number >= MAX_PROGRAM_NUMBER){
+            return NULL;
+        }
+        Program &entry = m_programs[m_program_number++];
+        strcpy(entry.path, program);
+        entry.classic = false;
+        return &entry;
+    }
+
+    //启动工作进程并等待它发送CGI_READY。程序退出或超时仍没有发送时返回false并把classic置为true
+    bool spawn(CgiWorker &worker, const char *program, bool &classic){
+        int fds[2];
+        if(socketpair(PF_UNIX, SOCK_STREAM, 0, fds) != 0){
+            return false;
+        }
+        pid_t pid = fork();
+        if(pid < 0){
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+        if(pid == 0){
+            //工作进程只保留标准输入输出和CGI_WORKER_FD，进程池子进程的epoll、监听socket和客户连接都不能泄漏给它
+            dup2(fds[1], CGI_WORKER_FD);
+            int max_fd = getdtablesize();
+            for(int fd = CGI_WORKER_FD + 1; fd < max_fd; ++fd){
+                close(fd);
+            }
+            //恢复进程池修改过的信号处置
+            signal(SIGPIPE, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGCHLD, SIG_DFL);
+            setenv(CGI_WORKER_ENV, "1", 1);
+            execl(program, program, NULL);
+            _exit(1);
+        }
+        close(fds[1]);
+        worker.m_pid = pid;
+        worker.m_fd = fds[0];
+        struct pollfd pfd;
+        pfd.fd = worker.m_fd;
+        pfd.events = POLLIN;
+        CgiRecordHeader header;
+        if(poll(&pfd, 1, READY_TIMEOUT) <= 0 || !cgi_read_full(worker.m_fd, &header, sizeof(header))
+           || header.type != CGI_READY){
+            printf("%s is not a cgi worker, run it once per request\n", program);
+            stop(worker);
+            classic = true;
+            return false;
+        }
+        printf("start cgi worker %d for %s\n", pid, program);
+        return true;
+    }
+
+    //关闭通信socket后工作进程读到EOF自行退出，SIGTERM确保卡住的工作进程也会退出，由SIGCHLD回收
+    void stop(CgiWorker &worker){
+        if(worker.m_pid == -1){
+            return;
+        }
+        close(worker.m_fd);
+        kill(worker.m_pid, SIGTERM);
+        worker.m_pid = -1;
+        worker.m_fd = -1;
+    }
+
+private:
+    Program m_programs[MAX_PROGRAM_NUMBER];
+    int m_program_number;
+};
+
+#endif //WEBSERVER_CGIWORKERPOOL_H
@@ -0,0 +1,62 @@
+//
+// 服务器运行参数，由main函数解析命令行得到
+//
+
+#ifndef WEBSERVER_CONFIG_H
+#define WEBSERVER_CONFIG_H
+
+#include <stddef.h>
+
+//并发模型
+enum ACTOR_MODEL {PROACTOR = 0, REACTOR};
+
+struct ServerConfig{
+    //0: 模拟Proactor，主线程负责read()/write()，工作线程只做解析
+    //1: Reactor，主线程只负责监听事件，工作线程自己完成recv/writev和解析
+    int actor_model;
+    //连接socket是否以EPOLLONESHOT注册。关闭后连接只注册一次，由拿到连接的工作线程负责到底，
+    //因此必须工作在Reactor模式下
+    bool one_shot;
+    //静态资源包文件，设置后所有请求都从资源包中查找，不再访问网站根目录，收到SIGHUP时重新加载
+    const char *bundle_file;
+    //热点文件列表，运行时定期保存访问最多的路径，启动时在accept之前按它预热page cache
+    const char *hotset_file;
+    //预热时mmap并mlock的字节数上限
+    size_t hotset_budget;
+    //服务进程数。大于1时fork出这么多个子进程共享监听socket，父进程只负责重启退出的子进程
+    int process_number;
+    //每个服务进程中线程池的线程数，为0时不创建线程池，请求在事件循环中直接处理
+    int thread_number;
+    //文件元数据缓存的有效期，单位毫秒，为0时不缓存，每个请求都stat
+    int stat_cache_ms;
+    //输出运行指标的URL，为nullptr时不提供
+    const char *metrics_path;
+    //请求跟踪记录写入的文件和采样率(每多少个请求记录一个)，文件为nullptr时不跟踪
+    const char *trace_file;
+    int trace_sample;
+    //访问日志文件，为nullptr时不记录
+    const char *access_log;
+    //请求捕获文件和它的大小上限(MB)，文件为nullptr时不捕获
+    const char *capture_file;
+    int capture_max_mb;
+    //线程池请求队列中最多等待的请求数
+    int queue_size;
+    //每个连接的读缓冲区(请求头部和请求体的上限)和写缓冲区(应答头部的上限)的字节数
+    int read_buffer_size;
+    int write_buffer_size;
+    //准入控制：排队时间的目标值(毫秒)和连接占用字节数的上限(MB)，都为0时不做准入控制，只在队列满时回复503
+    int admission_target_ms;
+    int admission_budget_mb;
+
+    ServerConfig() : actor_model(PROACTOR), one_shot(true), bundle_file(nullptr),
+                     hotset_file(nullptr), hotset_budget(64 << 20), process_number(1), thread_number(4),
+                     stat_cache_ms(0), metrics_path(nullptr),
+                     trace_file(nullptr), trace_sample(1), access_log(nullptr),
+                     capture_file(nullptr), capture_max_mb(256), queue_size(100000),
+                     read_buffer_size(2048), write_buffer_size(1024),
+                     admission_target_ms(0), admission_budget_mb(0) {}
+};
+
+extern ServerConfig config;
+
+#endif //WEBSERVER_CONFIG_H
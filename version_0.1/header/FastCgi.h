@@ -0,0 +1,92 @@
+//
+// FastCGI上游：把URL前缀绑定到FastCGI后端(PHP-FPM等)，与后端的连接在请求之间保持并复用
+//
+
+#ifndef WEBSERVER_FASTCGI_H
+#define WEBSERVER_FASTCGI_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <vector>
+#include "Locker.h"
+
+//FastCGI协议中用到的记录类型和常量
+enum FCGI_TYPE {FCGI_BEGIN_REQUEST = 1, FCGI_ABORT_REQUEST, FCGI_END_REQUEST, FCGI_PARAMS,
+                FCGI_STDIN, FCGI_STDOUT, FCGI_STDERR};
+static const int FCGI_VERSION_1 = 1;
+static const int FCGI_RESPONDER = 1;
+//BEGIN_REQUEST的flags，要求后端处理完请求后不要关闭连接
+static const int FCGI_KEEP_CONN = 1;
+static const int FCGI_REQUEST_COMPLETE = 0;
+
+struct FcgiHeader{
+    uint8_t version;
+    uint8_t type;
+    //下面两个字段都是网络字节序
+    uint16_t request_id;
+    uint16_t content_length;
+    uint8_t padding_length;
+    uint8_t reserved;
+};
+
+/* 一个FastCGI后端。空闲的连接保存在m_idle中，请求结束后放回去给下一个请求用；
+ * m_active是正在处理请求的连接数，达到m_max_conns时acquire直接失败，由调用者返回503，
+ * 而不是让工作线程排队等待一个慢后端 */
+class FcgiBackend{
+public:
+    FcgiBackend();
+    ~FcgiBackend();
+
+    //解析"prefix=address[,max_conns]"，address为"unix:/path/to/sock"或"ip:port"
+    bool parse(const char *spec);
+    //URL是否以本后端的前缀开头
+    bool match(const char *url) const;
+    //取一个连接，reused返回它是否是复用的空闲连接。达到并发上限时返回-1，连接失败时返回-2
+    int acquire(bool &reused);
+    //归还连接，keep为false时关闭连接(出错，或者后端没有遵守FCGI_KEEP_CONN)
+    void release(int fd, bool keep);
+    const char *address() const { return m_address; }
+
+public:
+    //每个后端默认的并发上限
+    static const int DEFAULT_MAX_CONNS = 8;
+    //与后端通信的超时时间，单位秒
+    static const int IO_TIMEOUT = 30;
+
+private:
+    int connect_backend();
+
+private:
+    char m_prefix[128];
+    size_t m_prefix_len;
+    char m_address[128];
+    sockaddr_storage m_addr;
+    socklen_t m_addr_len;
+    int m_max_conns;
+    int m_active;
+    std::vector<int> m_idle;
+    Locker m_lock;
+};
+
+class FastCgi{
+public:
+    //注册一个后端，由main函数在解析命令行(-f)时调用
+    static bool add_backend(const char *spec);
+    //按注册顺序查找第一个前缀匹配url的后端，没有则返回nullptr
+    static FcgiBackend *match(const char *url);
+
+    //下面一组函数在发送请求时使用
+    static void write_header(FcgiHeader &header, int type, int content_length);
+    //把一个FastCGI名值对追加到buf中，空间不足时返回false
+    static bool add_param(char *buf, int &len, int cap, const char *name, const char *value);
+
+public:
+    static const int MAX_BACKEND_NUMBER = 8;
+
+private:
+    static FcgiBackend m_backends[MAX_BACKEND_NUMBER];
+    static int m_backend_number;
+};
+
+#endif //WEBSERVER_FASTCGI_H
@@ -0,0 +1,45 @@
+//
+// 热点文件集合：运行时统计请求最多的文件路径并定期保存，
+// 下次启动时在开始accept之前预读这些文件，避免部署后的冷page cache拉高延迟
+//
+
+#ifndef WEBSERVER_HOTSET_H
+#define WEBSERVER_HOTSET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+class HotSet{
+public:
+    //工作线程在do_request成功后调用，记录一次对url的访问。表满时直接丢弃，不会阻塞
+    static void record(const char *url);
+    //把访问次数最多的路径写入文件，然后把所有计数减半，使统计偏向最近的访问
+    static bool save(const char *file);
+    //按保存的顺序预读文件：readahead进page cache，在budget字节之内再mmap(MAP_POPULATE)并mlock
+    static void warmup(const char *file, const char *doc_root, size_t budget);
+
+public:
+    //保存时最多写入的路径数量
+    static const int MAX_SAVED = 1024;
+    //两次保存之间的间隔，单位秒
+    static const int SAVE_INTERVAL = 60;
+
+private:
+    static const int SLOT_NUMBER = 4096;
+    //开放定址时最多探测的槽数
+    static const int MAX_PROBE = 8;
+    static const int PATH_LEN = 200;
+
+    struct Slot{
+        //路径的哈希值，0表示空槽
+        std::atomic<uint64_t> hash;
+        //路径写入完成后才置为true，保存时跳过还没写完的槽
+        std::atomic<bool> ready;
+        std::atomic<uint32_t> count;
+        char path[PATH_LEN];
+    };
+    static Slot m_slots[SLOT_NUMBER];
+};
+
+#endif //WEBSERVER_HOTSET_H
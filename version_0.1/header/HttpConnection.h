@@ -21,21 +21,46 @@
 #include <stdarg.h>
 #include <signal.h>
 #include <assert.h>
+#include <atomic>
 #include "Locker.h"
 #include "TimeHeap.h"
+#include "Config.h"
+#include "TlsContext.h"
+#include "StaticBundle.h"
+#include "FastCgi.h"
+#include "PluginHost.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "AccessLog.h"
+#include "Capture.h"
+#include "Admission.h"
 
 //保护定时器堆的锁
 extern Locker timeHeapLock;
 extern TimeHeap timeHeap;
 
 class HttpConnection{
+    //微基准测试(bench/)直接调用解析和填充应答的私有函数
+    friend class HttpConnectionBench;
 public:
     //文件名的最大长度
     static const int FILENAME_LEN = 200;
-    //读缓冲区的大小
+    //读缓冲区的默认大小和上限，实际大小由-u设置，保存在m_read_buffer_size中
     static const int READ_BUFFER_SIZE = 2048;
-    //写缓冲区域的大小
+    static const int MAX_READ_BUFFER_SIZE = 65536;
+    //写缓冲区(应答头部)的默认大小和上限，实际大小保存在m_write_buffer_size中
     static const int WRITE_BUFFER_SIZE = 1024;
+    static const int MAX_WRITE_BUFFER_SIZE = 65536;
+    //连接的超时时间，单位秒
+    static const int CONN_TIMEOUT = 100000;
+    //转发FastCGI应答时，客户端接收不及的部分最多在内存中积压这么多字节，之后交给write()在EPOLLOUT时发送
+    static const int FCGI_BUFFER_LIMIT = 4 << 20;
+    //积压超过上限时工作线程等待客户端接收，一次转发总共最多等待的时间(不包括等待后端的时间)，单位毫秒
+    static const int RELAY_TIMEOUT = 10000;
+    //FastCGI应答头部的最大长度
+    static const int FCGI_HEADER_SIZE = 4096;
+    //writev一次最多发送的内存块数量：应答头部加上插件应答体的各段
+    static const int MAX_IOV = ws_response::MAX_SEGMENTS + 1;
     //HTTP请求方法
     enum METHOD{GET = 0, POST, HEAD, PUT, DELETE,
                 TRACE, OPTIONS, CONNECT, PATCH};
@@ -44,13 +69,19 @@ public:
     //服务器处理HTTP请求的可能结果
     enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST,
                     NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR,
-                    CLOSED_CONNECTION};
+                    CLOSED_CONNECTION, BUNDLE_REQUEST, FCGI_REQUEST, BAD_GATEWAY, SERVICE_UNAVAILABLE,
+                    PLUGIN_REQUEST, METRICS_REQUEST};
     //从状态机，行的读取状态
     enum LINE_STATUS {LINE_OK, LINE_BAD, LINE_OPEN};
+    //Reactor模式下交给工作线程的任务类型
+    enum IO_STATE {IO_READ = 0, IO_WRITE};
 
 public:
     HttpConnection();
     ~HttpConnection();
+    //缓冲区属于连接对象，不能拷贝
+    HttpConnection(const HttpConnection &) = delete;
+    HttpConnection &operator=(const HttpConnection &) = delete;
 
 public:
     //初始化新接受的连接
@@ -63,6 +94,36 @@ public:
     bool read();
     //非阻塞写操作
     bool write();
+    //Reactor模式下，主线程在把连接放入请求队列之前设置工作线程要做的事情
+    void set_io_state(IO_STATE state){ m_io_state = state; }
+    //非ONESHOT模式下，主线程每收到一个事件就调用一次，返回true表示连接空闲，需要放入请求队列；
+    //返回false表示已有工作线程拥有该连接，它会在释放连接前处理这次事件
+    bool acquire(){ return m_sched.fetch_add(1) == 0; }
+    //连接当前是否没有被工作线程拥有
+    bool idle() const { return m_sched.load() == 0; }
+    //连接是否还没有关闭
+    bool is_open() const { return m_sock_fd != -1; }
+    //是否有发送到一半的应答，这时不能再插入503
+    bool responding() const { return m_bytes_to_send > 0; }
+    //读缓冲区中已经读入的请求字节数
+    int read_bytes() const { return m_read_idx; }
+    //把连接占用的字节数计入准入控制的预算，没有开启准入控制时什么也不做
+    void hold_bytes(int bytes){
+        if(Admission::enabled() && bytes != m_held_bytes){
+            Admission::hold(bytes - m_held_bytes);
+            m_held_bytes = bytes;
+        }
+    }
+    //过载时由主线程拒绝连接上的请求并关闭连接
+    void shed();
+    //记下当前请求到达了某个处理阶段，请求没有被采样时什么也不做
+    void trace(TRACE_PHASE phase){
+        if(m_tracing){
+            Trace::mark(m_trace, phase, Metrics::now_ns());
+        }
+    }
+    //打印所有已关闭连接的epoll_ctl统计
+    static void print_epoll_stats();
 
 private:
     //初始化连接
@@ -71,12 +132,33 @@ private:
     HTTP_CODE process_read();
     //填充HTTP应答
     bool process_write(HTTP_CODE ret);
+    //非ONESHOT模式下工作线程处理一轮读写，返回false表示连接已经关闭
+    bool handle_owned();
+    //修改socket上注册的事件，注册的事件与缓存的相同时跳过epoll_ctl
+    void mod_event(int ev);
+    //应答发送完，提交被采样请求的跟踪记录和访问日志
+    void request_done();
 
     //下面一组函数被process_read调用以分析HTTP请求
     HTTP_CODE parse_request_line(char* text);
     HTTP_CODE parse_headers(char* text);
     HTTP_CODE parse_content(char* text);
     HTTP_CODE do_request();
+    //在静态资源包中查找m_url
+    HTTP_CODE do_bundle_request();
+    //把请求转发给m_fcgi_backend并把应答边收边发给客户端，成功时返回FCGI_REQUEST
+    HTTP_CODE relay_fcgi();
+    //在一个后端连接上完成一次FastCGI请求，replied返回是否已经从后端收到了数据，
+    //keep返回这个后端连接能否继续复用
+    HTTP_CODE fcgi_exchange(int fcgi_fd, bool &replied, bool &keep);
+    //把FastCGI应答的CGI头部转换成HTTP应答头部并发送
+    bool send_fcgi_headers(char *headers, int len, bool &chunked);
+    //调用m_plugin处理请求并填充应答，成功时返回PLUGIN_REQUEST
+    HTTP_CODE run_plugin();
+    //把一段应答体发送给客户端，chunked为true时按chunked编码发送
+    bool send_fcgi_body(const char *data, int len, bool chunked);
+    //把iovec发送给客户端，socket写满时剩下的部分追加到m_plugin_body中，积压超过FCGI_BUFFER_LIMIT时才等待可写
+    bool send_all(struct iovec *iv, int count);
     char* get_line(){ return m_read_buf + m_start_line; }
     LINE_STATUS parse_line();
 
@@ -93,24 +175,51 @@ private:
 public:
     //所有socket上的事件都被注册同一个epoll内核事件表中，所以把epoll文件描述符设置为静态
     static int m_epoll_fd;
-    //统计用户数量
-    static int m_user_count;
+    //统计用户数量，主线程accept时加1，工作线程关闭连接时减1
+    static std::atomic<int> m_user_count;
+    //已关闭连接的epoll_ctl调用次数、被跳过的调用次数和处理的请求数的累计值
+    static std::atomic<long> m_total_epoll_ctl;
+    static std::atomic<long> m_total_epoll_ctl_skipped;
+    static std::atomic<long> m_total_requests;
+    //进程停止accept、等待已有连接处理完时为true，之后的应答都带"Connection: close"
+    static std::atomic<bool> m_draining;
+    //读写缓冲区的大小，必须在创建连接对象之前设置
+    static int m_read_buffer_size;
+    static int m_write_buffer_size;
 
 private:
+    /* 连接状态的归属：socket以EPOLLONESHOT注册，某一时刻只有一个线程拥有这个连接。
+     * 模拟Proactor模式下，主线程从epoll拿到事件后执行read()/write()，然后才把连接放入请求队列，
+     * 工作线程在process()中解析并重新注册事件，注册之后不再访问连接的状态；
+     * Reactor模式下，主线程拿到事件后只设置m_io_state就放入请求队列，由工作线程完成读写，
+     * 主线程在事件被重新注册之前不会再访问这个连接。 */
+    IO_STATE m_io_state;
+    /* 非ONESHOT模式下，socket上的事件不会被自动屏蔽，由m_sched保证同一时刻只有一个工作线程拥有连接:
+     * 0表示空闲，1表示被工作线程拥有，大于1表示拥有期间又来了新的事件，工作线程释放前需要再处理一轮 */
+    std::atomic<int> m_sched;
+    //当前在epoll内核事件表中注册的事件
+    int m_ev_mask;
+    //本连接的epoll_ctl调用次数、被跳过的调用次数和处理的请求数
+    int m_epoll_ctl_count;
+    int m_epoll_ctl_skipped;
+    int m_request_count;
+
     //读HTTP连接的socket和对方的socket地址
     int m_sock_fd;
     sockaddr_in m_address;
+    //开启HTTPS时连接的TLS状态
+    TlsConn m_tls;
 
-    //读缓冲区
-    char m_read_buf[READ_BUFFER_SIZE];
+    //读缓冲区，构造时按m_read_buffer_size分配
+    char *m_read_buf;
     //标识读缓冲区已经读入的客户数据的最后一个字节的下一个位置
     int m_read_idx;
     //当前正在分析的字符在缓冲区中的位置
     int m_checked_idx;
     //目前正在解析的行的起始位置
     int m_start_line;
-    //写缓冲区
-    char m_write_buf[WRITE_BUFFER_SIZE];
+    //写缓冲区，构造时按m_write_buffer_size分配
+    char *m_write_buf;
     //写缓冲区待发送的字节数
     int m_write_idx;
 
@@ -127,25 +236,58 @@ private:
     char *m_version;
     //主机名
     char *m_host;
+    //请求体的类型和内容，转发给FastCGI后端时使用
+    char *m_content_type;
+    char *m_content;
     //HTTP请求的消息体的长度
     int m_content_length;
     //HTTP请求是否要求保持连接
     int m_linger;
+    //客户端是否接受gzip编码(Accept-Encoding)
+    bool m_accept_gzip;
 
     //客户请求的目标文件被mmap到内存的起始位置
     char* m_file_address;
+    //目标文件来自静态资源包时，持有资源包的引用直到应答发送完，m_file_address指向资源包内部
+    std::shared_ptr<StaticBundle> m_bundle;
+    const BundleEntry *m_bundle_entry;
+    //请求的URL匹配的FastCGI后端
+    FcgiBackend *m_fcgi_backend;
+    //请求的URL匹配的插件，以及插件拷贝写入的应答体(或者运行指标的文本、FastCGI应答中客户端还没有接收的部分)，
+    //连接持有它直到应答发送完
+    const Plugin *m_plugin;
+    std::string m_plugin_body;
+    //这次转发还可以等待客户端接收积压数据的时间，单位纳秒
+    int64_t m_relay_wait_left;
 
     //目标文件的状态，通过它我们可以判断文件是否存在，是否为目录，是否可读，并获取文件大小
     struct stat m_file_stat;
     //我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量
-    struct iovec m_iv[2];
+    struct iovec m_iv[MAX_IOV];
     int m_iv_count;
+    //本次应答还需发送的字节数，以及已经发送的字节数
+    int m_bytes_to_send;
+    int m_bytes_have_send;
+
+    //应答的状态码和已经发送的字节数(包括头部)，以及读到请求的时间(只在记录访问日志时设置)
+    int m_status;
+    uint32_t m_response_bytes;
+    uint64_t m_request_start;
+    //当前请求是否被采样，以及它的跟踪记录
+    bool m_tracing;
+    TraceRecord m_trace;
+    //请求捕获中的连接编号，0表示这个连接没有被捕获
+    uint64_t m_capture_id;
+    //计入准入控制预算的字节数：排队中的请求，或者等待EPOLLOUT的应答
+    int m_held_bytes;
 
 public:
-    Timer* timer;
+    //连接的空闲定时器，内嵌在连接对象中，由定时器堆引用
+    Timer timer;
 public:
-    void setTimer(Timer* timer);
-    void startTimer(Timer* timer);
+    //开始计时，CONN_TIMEOUT秒后到期。定时器已经在堆中时重新计时
+    void startTimer();
+    //把定时器从堆中删除，连接交给工作线程处理期间不会超时
     void separateTimer();
 };
 #endif //WEBSERVER_HTTPCONNECTION_H
@@ -0,0 +1,97 @@
+//
+// 运行指标：每个线程有自己的一组计数器和延迟直方图，各占独立的缓存行，记录时没有锁也没有跨核的缓存行争用。
+// 请求/metrics(由-m指定)时把所有线程的数据加起来，以Prometheus的文本格式输出
+//
+
+#ifndef WEBSERVER_METRICS_H
+#define WEBSERVER_METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <atomic>
+
+//计数器
+enum METRIC_COUNTER {M_ACCEPTED = 0, M_CLOSED, M_REQUESTS, M_RESPONSE_BYTES, M_TIMER_EXPIRED,
+                     M_QUEUE_PUSHED, M_QUEUE_POPPED, M_QUEUE_REJECTED, M_LOG_DROPPED, M_CAPTURE_DROPPED,
+                     //FastCGI后端发来的FCGI_STDERR记录
+                     M_FASTCGI_STDERR,
+                     //准入控制拒绝的请求：排队时间过长、字节数超过上限、连接数达到上限
+                     M_SHED_DELAY, M_SHED_BYTES, M_SHED_CONNECTIONS,
+                     //按状态码统计的发送完成的应答数，不在列表中的状态码计入M_STATUS_OTHER
+                     M_STATUS_200, M_STATUS_206, M_STATUS_302, M_STATUS_304, M_STATUS_400, M_STATUS_403,
+                     M_STATUS_404, M_STATUS_500, M_STATUS_502, M_STATUS_503, M_STATUS_OTHER,
+                     COUNTER_NUMBER};
+//由主线程设置的当前值
+enum METRIC_GAUGE {G_TIMER_HEAP_ENTRIES = 0, G_TIMER_HEAP_BYTES, G_CONNECTION_SLOTS, G_CONNECTION_OBJECTS,
+                   G_CONNECTION_BYTES, GAUGE_NUMBER};
+//直方图，单位纳秒
+enum METRIC_HISTOGRAM {H_QUEUE_WAIT = 0, H_PARSE_TIME, HISTOGRAM_NUMBER};
+
+class Metrics{
+public:
+    static void inc(METRIC_COUNTER counter, uint64_t n = 1){
+        shard().counters[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+    static void observe(METRIC_HISTOGRAM histogram, uint64_t ns){
+        Histogram &h = shard().histograms[histogram];
+        h.buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        h.sum.fetch_add(ns, std::memory_order_relaxed);
+    }
+    static void set(METRIC_GAUGE gauge, uint64_t value){
+        m_gauges[gauge].store(value, std::memory_order_relaxed);
+    }
+    //记录一个HTTP状态码
+    static void status(int code);
+    //单调时钟，单位纳秒
+    static uint64_t now_ns(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    //汇总所有线程的数据，追加到out中
+    static void render(std::string &out);
+
+public:
+    //每个2的幂之间再均分成4个桶，相对误差不超过25%
+    static const int SUB_BUCKETS = 4;
+    static const int BUCKET_NUMBER = 64 * SUB_BUCKETS;
+    //最多为这么多个线程分配独立的计数器，之后的线程共用最后一组，计数仍然正确，只是会有缓存行争用
+    static const int MAX_SHARDS = 64;
+
+private:
+    struct Histogram{
+        std::atomic<uint64_t> buckets[BUCKET_NUMBER];
+        std::atomic<uint64_t> sum;
+    };
+    struct alignas(64) Shard{
+        std::atomic<uint64_t> counters[COUNTER_NUMBER];
+        Histogram histograms[HISTOGRAM_NUMBER];
+    };
+
+    //小于4的值各占一个桶；其它值按最高位所在的位置和紧随其后的两位决定桶
+    static int bucket_of(uint64_t v){
+        if(v < SUB_BUCKETS){
+            return (int)v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        return (msb - 1) * SUB_BUCKETS + (int)((v >> (msb - 2)) & (SUB_BUCKETS - 1));
+    }
+    //桶中最大的值
+    static uint64_t bucket_upper(int bucket);
+    static Shard &shard(){
+        static thread_local Shard *t_shard = nullptr;
+        if(!t_shard){
+            t_shard = new_shard();
+        }
+        return *t_shard;
+    }
+    static Shard *new_shard();
+
+private:
+    static Shard m_shards[MAX_SHARDS];
+    static std::atomic<int> m_shard_number;
+    static std::atomic<uint64_t> m_gauges[GAUGE_NUMBER];
+};
+
+#endif //WEBSERVER_METRICS_H
@@ -0,0 +1,78 @@
+/*
+ * 处理器插件的C ABI。插件是一个共享库，导出ws_plugin_entry，服务器启动时dlopen并把它绑定到一个URL前缀上，
+ * 匹配的请求在线程池的工作线程中直接调用handle，没有进程创建和进程间通信。
+ * 这个头文件只使用C的类型，插件可以用C或C++编写；结构体只在末尾追加字段，不兼容的修改会提高WS_PLUGIN_ABI_VERSION
+ */
+
+#ifndef WEBSERVER_PLUGINAPI_H
+#define WEBSERVER_PLUGINAPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WS_PLUGIN_ABI_VERSION 1
+/* 插件必须导出的符号 */
+#define WS_PLUGIN_ENTRY "ws_plugin_entry"
+
+/* 解析好的请求。所有指针都指向连接的读缓冲区，只在handle返回之前有效，字符串不一定以'\0'结尾 */
+typedef struct ws_str{
+    const char *data;
+    size_t len;
+} ws_str;
+
+typedef struct ws_request{
+    ws_str method;
+    /* 不含查询字符串的路径，以绑定的前缀开头 */
+    ws_str path;
+    /* '?'之后的部分，没有时len为0 */
+    ws_str query;
+    ws_str host;
+    ws_str content_type;
+    ws_str body;
+    /* 客户端的IPv4地址，网络字节序 */
+    uint32_t remote_addr;
+    uint16_t remote_port;
+    /* 是否为HTTPS连接 */
+    int secure;
+} ws_request;
+
+/* 应答由服务器持有，插件只能通过ws_server_api操作 */
+typedef struct ws_response ws_response;
+
+/* 服务器提供给插件的函数，成功返回0，失败返回-1 */
+typedef struct ws_server_api{
+    uint32_t abi_version;
+    /* 设置状态码，默认200 OK */
+    int (*set_status)(ws_response *resp, int status, const char *reason);
+    /* 添加一个应答头部，Content-Length和Connection由服务器生成 */
+    int (*add_header)(ws_response *resp, const char *name, const char *value);
+    /* 追加应答体，数据被拷贝，handle返回后即可释放 */
+    int (*write)(ws_response *resp, const void *data, size_t len);
+    /* 零拷贝地追加应答体，服务器直接把data放进writev的iovec，
+     * 因此data必须在插件被卸载之前一直有效(静态数据、插件启动时加载的资源等) */
+    int (*write_ref)(ws_response *resp, const void *data, size_t len);
+} ws_server_api;
+
+typedef struct ws_plugin{
+    /* 必须为WS_PLUGIN_ABI_VERSION */
+    uint32_t abi_version;
+    const char *name;
+    /* 可选，加载时调用一次，arg为命令行中给出的参数(可能为NULL)，返回非0表示加载失败 */
+    int (*init)(const char *arg);
+    /* 处理一个请求，会被多个工作线程同时调用，必须是线程安全的。返回非0时服务器丢弃应答，返回500 */
+    int (*handle)(const ws_request *req, ws_response *resp, const ws_server_api *api);
+    /* 可选，服务器退出时调用 */
+    void (*fini)(void);
+} ws_plugin;
+
+typedef const ws_plugin *(*ws_plugin_entry_fn)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WEBSERVER_PLUGINAPI_H */
@@ -0,0 +1,82 @@
+//
+// 加载处理器插件，并为插件提供应答的构造接口
+//
+
+#ifndef WEBSERVER_PLUGINHOST_H
+#define WEBSERVER_PLUGINHOST_H
+
+#include <stddef.h>
+#include <string>
+#include "PluginApi.h"
+
+/* 插件构造的应答。在工作线程的线程局部变量中构造，handle返回后由HttpConnection生成头部，
+ * 拷贝的数据交给连接持有，零拷贝的数据直接作为iovec发送 */
+struct ws_response{
+    //应答体最多由多少段组成
+    static const int MAX_SEGMENTS = 16;
+    static const int HEADERS_SIZE = 512;
+
+    struct Segment{
+        //data为nullptr时表示拷贝进copy中的数据，offset为它在copy中的位置
+        const void *data;
+        size_t offset;
+        size_t len;
+    };
+
+    int status;
+    char reason[64];
+    char headers[HEADERS_SIZE];
+    int headers_len;
+    Segment segments[MAX_SEGMENTS];
+    int segment_count;
+    //拷贝的数据
+    std::string copy;
+    size_t body_len;
+
+    void reset();
+    bool append(const void *data, size_t len, bool ref);
+};
+
+class Plugin{
+public:
+    Plugin() : m_handle(nullptr), m_plugin(nullptr), m_prefix_len(0) { m_prefix[0] = '\0'; }
+
+    //解析"prefix=path.so[,arg]"并加载插件
+    bool load(const char *spec);
+    //加载失败时卸载共享库
+    void unload();
+    //调用插件的fini
+    void fini() const;
+    bool match(const char *url) const;
+    //调用插件处理请求，返回插件的返回值
+    int handle(const ws_request &req, ws_response &resp) const;
+    const char *name() const;
+
+private:
+    void *m_handle;
+    const ws_plugin *m_plugin;
+    char m_prefix[128];
+    size_t m_prefix_len;
+};
+
+class PluginHost{
+public:
+    //加载一个插件，由main函数在解析命令行(-p)时调用
+    static bool load(const char *spec);
+    //按加载顺序查找第一个前缀匹配url的插件
+    static const Plugin *match(const char *url);
+    //服务器退出时调用所有插件的fini，必须在工作线程都退出(线程池析构)之后调用，否则fini可能与handle同时执行。
+    //共享库不dlclose，由进程退出回收
+    static void shutdown();
+    //提供给插件的函数表
+    static const ws_server_api *api();
+
+public:
+    static const int MAX_PLUGIN_NUMBER = 8;
+
+private:
+    static Plugin m_plugins[MAX_PLUGIN_NUMBER];
+    static int m_plugin_number;
+};
+
+#endif //WEBSERVER_PLUGINHOST_H
@@ -9,6 +9,8 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
@@ -22,19 +24,50 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <time.h>
+#include <atomic>
+#include <new>
 
 //子进程类,m_pid是子进程的pid,m_pipe_fd是父进程与子进程通信用的管道
 class Process
 {
 public:
     //初始化m_pid为-1，代表没有被使用
-    Process() : m_pid(-1){}
+    Process() : m_pid(-1), m_sent(0), m_start_time(0){}
 public:
     pid_t m_pid;
     int m_pipe_fd[2];
+    //父进程已经发给子进程的连接总数
+    unsigned m_sent;
+    //子进程的启动时间，用于限制重启的频率
+    time_t m_start_time;
 };
 
-//进程池类，定义为模板类是为了代码复用，模板参数是处理逻辑任务的类
+//进程池的两种工作方式，由ProcessPoolTraits<T>::mode选择
+//父进程accept连接，再通过管道分给负载最小的子进程。T需要实现init(epoll_fd, sock_fd, client_address)和bool process()
+struct DispatchTag {};
+//子进程共享监听socket，各自accept并运行自己的事件循环，父进程只负责监督，重启意外退出的子进程。
+//ProcessPoolTraits<T>需要提供static int serve(int listen_fd, int idx)，它的返回值是子进程的退出码；
+//以及升级用的static int upgrade(int listen_fd)和static bool upgraded(int ready_fd)，
+//父进程收到SIGUSR2时调用upgrade启动新的可执行文件，ready_fd可读时调用upgraded，返回true后让子进程处理完连接退出
+struct SharedListenTag {};
+
+template<typename T>
+struct ProcessPoolTraits{
+    typedef DispatchTag mode;
+};
+
+//子进程的负载，放在fork之前创建的共享内存中，子进程更新，父进程分配连接时直接读取，不需要通过管道报告。
+//每个子进程独占一个缓存行，避免不同子进程的更新互相干扰
+struct alignas(64) ChildLoad{
+    //子进程当前处理的连接数
+    std::atomic<int> active;
+    //子进程已经从管道收到的连接总数，父进程用自己发送的总数减去它，得到还在管道中的连接数
+    std::atomic<unsigned> received;
+};
+
+//进程池类，定义为模板类是为了代码复用，模板参数是处理逻辑任务的类。
+//T需要实现init(epoll_fd, sock_fd, client_address)，以及bool process()，process返回false表示连接已经关闭
 template<typename T>
 class ProcessPool{
 private:
@@ -52,6 +85,7 @@ public:
     }
 
     ~ProcessPool(){
+        munmap(m_loads, sizeof(ChildLoad) * m_process_number);
         delete [] m_sub_process;
     }
 
@@ -61,8 +95,16 @@ public:
 private:
     //建立信号管道
     void setup_sig_pipe();
-    void run_parent();
-    void run_child();
+    void run_parent(DispatchTag);
+    void run_child(DispatchTag);
+    void run_parent(SharedListenTag);
+    void run_child(SharedListenTag);
+    //重新启动第k个子进程，只在SharedListenTag方式下使用
+    void respawn(int k);
+    //父进程估计的子进程k当前的连接数
+    int load_of(int k) const;
+    //把一次accept到的所有连接分给负载最小的子进程，每个子进程只发送一条消息
+    void dispatch(const int *conn_fds, const sockaddr_in *addresses, int count);
 
 private:
     //进程池静态实例
@@ -75,6 +117,10 @@ private:
     static const int USER_PER_PROCESS = 65536;
     //epoll最多能处理的事件数量
     static const int MAX_EVENT_NUMBER = 10000;
+    //父进程一次最多分配的连接数，也是一条消息最多携带的连接socket数量(不能超过内核的SCM_MAX_FD)
+    static const int MAX_BATCH = 64;
+    //子进程启动后不到这么多秒就退出时，推迟到这个时间之后再重启，避免启动即崩溃的子进程被不停地fork
+    static const int RESPAWN_INTERVAL = 1;
     //进程池的进程总数
     int m_process_number;
     //子进程在池中的序号，从0开始
@@ -87,6 +133,10 @@ private:
     int m_stop;
     //保存所有子进程的描述信息保存了哪些信息
     Process *m_sub_process;
+    //负载相同时从这个子进程开始找，使连接在空闲的子进程之间轮流分配
+    int m_next_process;
+    //所有子进程的负载，共享内存
+    ChildLoad *m_loads;
 };
 
 template<typename T>
@@ -118,6 +168,57 @@ static void delFd(int epoll_fd, int fd){
     close(fd);
 }
 
+//通过UNIX socket把一批连接socket(SCM_RIGHTS)和对应的客户端地址用一条消息发给子进程
+static bool send_fds(int pipe_fd, const int *fds, const sockaddr_in *addresses, int count){
+    struct iovec iov;
+    iov.iov_base = (void *)addresses;
+    iov.iov_len = sizeof(sockaddr_in) * count;
+    char control[CMSG_SPACE(sizeof(int) * 64)];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    return sendmsg(pipe_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)iov.iov_len;
+}
+
+//接收父进程发来的一批连接socket，返回连接数，没有消息(或父进程已退出)时返回-1
+static int recv_fds(int pipe_fd, int *fds, sockaddr_in *addresses, int max_count){
+    struct iovec iov;
+    iov.iov_base = addresses;
+    iov.iov_len = sizeof(sockaddr_in) * max_count;
+    char control[CMSG_SPACE(sizeof(int) * 64)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t ret = recvmsg(pipe_fd, &msg, MSG_CMSG_CLOEXEC);
+    if(ret <= 0){
+        return -1;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if(!cmsg || cmsg->cmsg_type != SCM_RIGHTS){
+        return 0;
+    }
+    //地址和socket一一对应，个数以两者中较少的为准，多出的socket关闭
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+    int address_count = ret / sizeof(sockaddr_in);
+    for(int i = address_count; i < count; ++i){
+        close(fds[i]);
+    }
+    return count < address_count ? count : address_count;
+}
+
 //信号处理函数，通过信号管道发送到子进程，让子进程处理
 static void sig_handler(int sig){
     //保留原来的errno，在函数最后恢复，以保证函数的可重入性
@@ -146,23 +247,34 @@ static void addSig(int sig, void (*handler)(int), bool restart = true){
 
 template<typename T>
 ProcessPool<T>::ProcessPool(int listen_fd, int process_number)
-        : m_listen_fd(listen_fd), m_process_number(process_number), m_idx(-1), m_stop(false)
+        : m_listen_fd(listen_fd), m_process_number(process_number), m_idx(-1), m_stop(false), m_next_process(0)
 {
     assert((process_number > 0) && process_number <= MAX_PROCESS_NUMBER);
 
     m_sub_process = new Process[process_number];
     assert(m_sub_process);
+    //负载计数在fork之前映射，父子进程看到的是同一块内存
+    void *loads = mmap(NULL, sizeof(ChildLoad) * process_number, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(loads != MAP_FAILED);
+    m_loads = new (loads) ChildLoad[process_number];
+    for(int i = 0; i < process_number; i++){
+        m_loads[i].active.store(0);
+        m_loads[i].received.store(0);
+    }
 
     //建立process_number个子进程，并建立他们和父进程之间的管道
     for(int i = 0; i < process_number; i++){
-        int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_sub_process[i].m_pipe_fd);
+        //SOCK_SEQPACKET保留消息边界，父进程发送的每条消息带一批连接socket和它们的客户端地址
+        int ret = socketpair(PF_UNIX, SOCK_SEQPACKET, 0, m_sub_process[i].m_pipe_fd);
         assert(ret == 0);
 
         m_sub_process[i].m_pid = fork();
         //只能是子进程或者父进程
         assert(m_sub_process[i].m_pid >= 0);
+        m_sub_process[i].m_start_time = time(NULL);
         if(m_sub_process[i].m_pid > 0){
-            //父进程只写,子进程只读，于是关闭父进程中管道的读端口
+            //父进程使用m_pipe_fd[1]，子进程使用m_pipe_fd[0]，各自关闭另一端
             close(m_sub_process[i].m_pipe_fd[0]);
         }else{
             close(m_sub_process[i].m_pipe_fd[1]);
@@ -191,6 +303,9 @@ void ProcessPool<T>::setup_sig_pipe() {
     addSig(SIGCHLD, sig_handler);
     addSig(SIGTERM, sig_handler);
     addSig(SIGINT, sig_handler);
+    addSig(SIGHUP, sig_handler);
+    addSig(SIGQUIT, sig_handler);
+    addSig(SIGUSR2, sig_handler);
     //往一个读端关闭的管道或socket连接中写数据将引发SIGPIPE信号
     addSig(SIGPIPE, SIG_IGN);
 }
@@ -198,28 +313,33 @@ void ProcessPool<T>::setup_sig_pipe() {
 //父进程的m_idx值为-1，子进程中m_idx值大于等于0，我们据此判断接下来要运行的是父进程代码还是子进程代码
 template<typename T>
 void ProcessPool<T>::run() {
+    //按T选择工作方式，另一种方式的成员函数不会被实例化，T不需要实现它要求的接口
+    typedef typename ProcessPoolTraits<T>::mode mode;
     if(m_idx == -1){
-        run_parent();
+        run_parent(mode());
     }else{
-        run_child();
+        run_child(mode());
     }
 }
 
 template<typename T>
-void ProcessPool<T>::run_child() {
+void ProcessPool<T>::run_child(DispatchTag) {
     setup_sig_pipe();
 
     //每个子进程都通过其在进程池中的序号值m_idx找到与父进程通信的管道
     //所有进程都保留了一份进程池的副本
     int pipe_fd = m_sub_process[m_idx].m_pipe_fd[0];
-    //子进程需要需要建管道文件描述符,因为父进程将通过它来通知子进程accept新连接
+    //父进程通过管道把accept得到的连接socket传给子进程，子进程不再accept，关闭继承来的监听socket
     addFd(m_epoll_fd, pipe_fd);
+    close(m_listen_fd);
 
     epoll_event events[MAX_EVENT_NUMBER];
     T *users = new T[USER_PER_PROCESS];
     assert(users);
     int number = 0;
     int ret = -1;
+    //本进程在共享内存中的负载计数
+    ChildLoad &load = m_loads[m_idx];
 
     while(!m_stop){
         number = epoll_wait(m_epoll_fd, events, MAX_EVENT_NUMBER, -1);
@@ -231,27 +351,24 @@ void ProcessPool<T>::run_child() {
         for(int i = 0; i < number; ++i){
             int sock_fd = events[i].data.fd;
             if((sock_fd == pipe_fd) && (events[i].events & EPOLLIN)){
-                int client = 0;
-                //从父子进程之间的管道读取数据，并将结果保存到变量client中。
-                //如果读取成功，则表示新客户连接到来
-                ret = recv(sock_fd, (char *)&client, sizeof(client), 0);
-                //如果是读取出错且没有提示再尝试一次，或者读取到0字节，那就直接下一次循环
-                if(((ret < 0) && (errno != EAGAIN)) || ret == 0){
-                    continue;
-                }else{
-                    struct sockaddr_in client_address;
-                    socklen_t client_addr_len = sizeof (client_address);
-                    int conn_fd = accept(m_listen_fd, (struct sockaddr *)&client_address, &client_addr_len);
-                    if(conn_fd < 0){
-                        printf("errno is : %d\n", errno);
-                        continue;
+                //管道以ET模式注册，一次把父进程发来的消息全部收完，每条消息带一批连接
+                int conn_fds[MAX_BATCH];
+                struct sockaddr_in client_addresses[MAX_BATCH];
+                while((ret = recv_fds(pipe_fd, conn_fds, client_addresses, MAX_BATCH)) >= 0){
+                    load.received.fetch_add(ret, std::memory_order_relaxed);
+                    for(int j = 0; j < ret; ++j){
+                        int conn_fd = conn_fds[j];
+                        if(conn_fd >= USER_PER_PROCESS){
+                            close(conn_fd);
+                            continue;
+                        }
+                        load.active.fetch_add(1, std::memory_order_relaxed);
+                        addFd(m_epoll_fd, conn_fd);
+                        //模板类T必须实现init方法，以初始化一个客户端连接。我们直接使用connfd来
+                        //索引逻辑处理对象(T类型的对象)，以提高程序效率
+                        //client_address传递给任务类，使其可以给客户端发信息
+                        users[conn_fd].init(m_epoll_fd, conn_fd, client_addresses[j]);
                     }
-
-                    addFd(m_epoll_fd, conn_fd);
-                    //模板类T必须实现init方法，以初始化一个客户端连接。我们直接使用connfd来
-                    //索引逻辑处理对象(T类型的对象)，以提高程序效率
-                    //client_address传递给任务类，使其可以给客户端发信息
-                    users[conn_fd].init(m_epoll_fd, conn_fd, client_address);
                 }
             }
             //下面处理子进程接收到的信号
@@ -291,7 +408,9 @@ void ProcessPool<T>::run_child() {
             }
             //如果是其他刻度数据，那么必然是客户请求到来。调用逻辑处理对象的process方法进行处理
             else if(events[i].events & EPOLLIN){
-                users[sock_fd].process();
+                if(!users[sock_fd].process()){
+                    load.active.fetch_sub(1, std::memory_order_relaxed);
+                }
             }else{
                 continue;
             }
@@ -304,13 +423,10 @@ void ProcessPool<T>::run_child() {
 }
 
 template<typename T>
-void ProcessPool<T>::run_parent() {
+void ProcessPool<T>::run_parent(DispatchTag) {
     setup_sig_pipe();
     addFd(m_epoll_fd, m_listen_fd);
     epoll_event events[MAX_EVENT_NUMBER];
-    //用于round robin算法
-    int sub_process_counter = 0;
-    int new_conn = 1;
     int number = 0;
     int ret = -1;
 
@@ -324,22 +440,29 @@ void ProcessPool<T>::run_parent() {
         for(int i = 0; i < number; ++i){
             int sock_fd = events[i].data.fd;
             if(sock_fd == m_listen_fd){
-                //如果有新的连接到来，就采用Round Robin方式将其分配给一个子进程
-                int j = sub_process_counter;
-                do{
-                    if(m_sub_process[j].m_pid != -1){
+                //由父进程accept新连接，再把连接socket交给负载最小的子进程，子进程之间不再争抢accept。
+                //监听socket以ET模式注册，要accept到EAGAIN为止；攒够一批再分配，连接风暴时每个子进程每批只收到一条消息
+                int conn_fds[MAX_BATCH];
+                struct sockaddr_in client_addresses[MAX_BATCH];
+                int count = 0;
+                while(true){
+                    socklen_t client_addr_len = sizeof (client_addresses[count]);
+                    int conn_fd = accept(m_listen_fd, (struct sockaddr *)&client_addresses[count], &client_addr_len);
+                    if(conn_fd < 0){
+                        if(errno != EAGAIN && errno != EWOULDBLOCK){
+                            printf("errno is : %d\n", errno);
+                        }
                         break;
                     }
-                    j = (j + 1) % m_process_number;
-                }while(j != sub_process_counter);
-
-                if(m_sub_process[j].m_pid == -1){
-                    m_stop = true;
-                    break;
+                    conn_fds[count++] = conn_fd;
+                    if(count == MAX_BATCH){
+                        dispatch(conn_fds, client_addresses, count);
+                        count = 0;
+                    }
+                }
+                if(count > 0){
+                    dispatch(conn_fds, client_addresses, count);
                 }
-                sub_process_counter = (j + 1) % m_process_number;
-                send(m_sub_process[j].m_pipe_fd[1], (char *)&new_conn, sizeof (new_conn), 0);
-                printf("send request to child %d\n", j);
             }
             //下面处理父进程接收到信号
             else if((sock_fd == sig_pipe_fd[0]) && (events[i].events & EPOLLIN)){
@@ -406,4 +529,242 @@ void ProcessPool<T>::run_parent() {
     close(m_epoll_fd);
 }
 
+template<typename T>
+void ProcessPool<T>::run_child(SharedListenTag) {
+    //与父进程之间的管道在这种方式下不使用。子进程直接运行T的事件循环，返回后退出，不回到调用run()的地方
+    if(m_sub_process[m_idx].m_pipe_fd[0] != -1){
+        close(m_sub_process[m_idx].m_pipe_fd[0]);
+    }
+    exit(ProcessPoolTraits<T>::serve(m_listen_fd, m_idx));
+}
+
+template<typename T>
+void ProcessPool<T>::run_parent(SharedListenTag) {
+    setup_sig_pipe();
+    //父进程不accept，关闭管道后只监听信号
+    for(int k = 0; k < m_process_number; ++k){
+        close(m_sub_process[k].m_pipe_fd[1]);
+        m_sub_process[k].m_pipe_fd[0] = m_sub_process[k].m_pipe_fd[1] = -1;
+    }
+    epoll_event events[MAX_PROCESS_NUMBER];
+    int number = 0;
+    int ret = -1;
+    //收到终止信号后不再重启子进程，等它们全部退出
+    bool terminating = false;
+    //升级时新进程的就绪管道
+    int ready_fd = -1;
+
+    while(!m_stop){
+        //有子进程等待重启时，epoll_wait最多等待1秒
+        int timeout = -1;
+        for(int k = 0; k < m_process_number; ++k){
+            if(m_sub_process[k].m_pid == -1 && !terminating){
+                timeout = RESPAWN_INTERVAL * 1000;
+            }
+        }
+        number = epoll_wait(m_epoll_fd, events, MAX_PROCESS_NUMBER, timeout);
+        if((number < 0) && (errno != EINTR)){
+            printf("epoll failure\n");
+            break;
+        }
+
+        for(int i = 0; i < number; ++i){
+            if(events[i].data.fd == ready_fd){
+                epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, ready_fd, 0);
+                if(ProcessPoolTraits<T>::upgraded(ready_fd) && !terminating){
+                    //新进程已经在accept，让子进程停止accept并处理完已有的连接
+                    terminating = true;
+                    for(int k = 0; k < m_process_number; ++k){
+                        if(m_sub_process[k].m_pid != -1){
+                            kill(m_sub_process[k].m_pid, SIGQUIT);
+                        }
+                    }
+                }
+                ready_fd = -1;
+                continue;
+            }
+            if((events[i].data.fd != sig_pipe_fd[0]) || !(events[i].events & EPOLLIN)){
+                continue;
+            }
+            char signals[1024];
+            ret = recv(sig_pipe_fd[0], signals, sizeof (signals), 0);
+            for(int j = 0; j < ret; ++j){
+                switch (signals[j]) {
+                    case SIGCHLD:
+                    {
+                        pid_t pid;
+                        int stat;
+                        while((pid = waitpid(-1, &stat, WNOHANG)) > 0){
+                            for(int k = 0; k < m_process_number; ++k){
+                                if(m_sub_process[k].m_pid != pid){
+                                    continue;
+                                }
+                                if(WIFSIGNALED(stat)){
+                                    printf("child %d (pid %d) killed by signal %d\n", k, pid, WTERMSIG(stat));
+                                }else{
+                                    printf("child %d (pid %d) exited with status %d\n", k, pid, WEXITSTATUS(stat));
+                                }
+                                m_sub_process[k].m_pid = -1;
+                            }
+                        }
+                        break;
+                    }
+                    case SIGHUP:
+                    {
+                        //重新加载由每个子进程自己完成
+                        for(int k = 0; k < m_process_number; ++k){
+                            if(m_sub_process[k].m_pid != -1){
+                                kill(m_sub_process[k].m_pid, SIGHUP);
+                            }
+                        }
+                        break;
+                    }
+                    case SIGUSR2:
+                    {
+                        if(ready_fd == -1 && !terminating){
+                            ready_fd = ProcessPoolTraits<T>::upgrade(m_listen_fd);
+                            if(ready_fd >= 0){
+                                addFd(m_epoll_fd, ready_fd);
+                            }
+                        }
+                        break;
+                    }
+                    case SIGQUIT:
+                    {
+                        //子进程停止accept，处理完已有的连接后退出
+                        terminating = true;
+                        for(int k = 0; k < m_process_number; ++k){
+                            if(m_sub_process[k].m_pid != -1){
+                                kill(m_sub_process[k].m_pid, SIGQUIT);
+                            }
+                        }
+                        break;
+                    }
+                    case SIGTERM:
+                    case SIGINT:
+                    {
+                        printf("kill all the child now\n");
+                        terminating = true;
+                        for(int k = 0; k < m_process_number; ++k){
+                            if(m_sub_process[k].m_pid != -1){
+                                kill(m_sub_process[k].m_pid, SIGTERM);
+                            }
+                        }
+                        break;
+                    }
+                    default:
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+
+        m_stop = terminating;
+        time_t now = time(NULL);
+        for(int k = 0; k < m_process_number; ++k){
+            if(m_sub_process[k].m_pid != -1){
+                m_stop = false;
+            }else if(!terminating && now - m_sub_process[k].m_start_time >= RESPAWN_INTERVAL){
+                respawn(k);
+            }
+        }
+    }
+    close(m_epoll_fd);
+}
+
+template<typename T>
+void ProcessPool<T>::respawn(int k) {
+    //先把父进程缓冲的输出写出去，否则子进程退出时会再输出一遍
+    fflush(stdout);
+    pid_t pid = fork();
+    //fork失败时等下一个间隔再试
+    m_sub_process[k].m_start_time = time(NULL);
+    if(pid < 0){
+        printf("failed to respawn child %d\n", k);
+        return;
+    }
+    if(pid == 0){
+        //新的子进程不继承父进程的信号处理函数和事件循环，由serve重新设置
+        addSig(SIGCHLD, SIG_DFL);
+        addSig(SIGTERM, SIG_DFL);
+        addSig(SIGINT, SIG_DFL);
+        addSig(SIGHUP, SIG_DFL);
+        addSig(SIGQUIT, SIG_DFL);
+        addSig(SIGUSR2, SIG_DFL);
+        close(m_epoll_fd);
+        close(sig_pipe_fd[0]);
+        close(sig_pipe_fd[1]);
+        m_idx = k;
+        run_child(SharedListenTag());
+    }
+    m_sub_process[k].m_pid = pid;
+    printf("child %d respawned (pid %d)\n", k, pid);
+}
+
+template<typename T>
+int ProcessPool<T>::load_of(int k) const {
+    //子进程还没有从管道中取走的连接也算作它的负载
+    const ChildLoad &load = m_loads[k];
+    return load.active.load(std::memory_order_relaxed)
+           + (int)(m_sub_process[k].m_sent - load.received.load(std::memory_order_relaxed));
+}
+
+template<typename T>
+void ProcessPool<T>::dispatch(const int *conn_fds, const sockaddr_in *addresses, int count) {
+    //先在本地为每个连接选出负载最小的子进程，再给每个子进程发送一条带着它那一批连接的消息
+    int loads[MAX_PROCESS_NUMBER];
+    int batch_fds[MAX_PROCESS_NUMBER][MAX_BATCH];
+    sockaddr_in batch_addresses[MAX_PROCESS_NUMBER][MAX_BATCH];
+    int batch_size[MAX_PROCESS_NUMBER] = {0};
+    for(int k = 0; k < m_process_number; ++k){
+        loads[k] = load_of(k);
+    }
+    for(int i = 0; i < count; ++i){
+        int best = -1;
+        for(int n = 0; n < m_process_number; ++n){
+            int k = (m_next_process + n) % m_process_number;
+            if(m_sub_process[k].m_pid == -1){
+                continue;
+            }
+            if(best == -1 || loads[k] < loads[best]){
+                best = k;
+            }
+        }
+        if(best == -1){
+            printf("no child can take the connection\n");
+            close(conn_fds[i]);
+            continue;
+        }
+        loads[best]++;
+        m_next_process = (best + 1) % m_process_number;
+        batch_fds[best][batch_size[best]] = conn_fds[i];
+        batch_addresses[best][batch_size[best]] = addresses[i];
+        batch_size[best]++;
+    }
+    for(int k = 0; k < m_process_number; ++k){
+        if(batch_size[k] == 0){
+            continue;
+        }
+        //发送失败(子进程的接收队列已满或者已经退出)时整批交给下一个还活着的子进程
+        int target = k;
+        for(int n = 0; n < m_process_number; ++n){
+            target = (k + n) % m_process_number;
+            if(m_sub_process[target].m_pid != -1
+               && send_fds(m_sub_process[target].m_pipe_fd[1], batch_fds[k], batch_addresses[k], batch_size[k])){
+                m_sub_process[target].m_sent += batch_size[k];
+                break;
+            }
+            target = -1;
+        }
+        if(target == -1){
+            printf("no child can take %d connections\n", batch_size[k]);
+        }
+        //连接socket已经在子进程中(或者被放弃)，父进程关闭自己的副本
+        for(int j = 0; j < batch_size[k]; ++j){
+            close(batch_fds[k][j]);
+        }
+    }
+}
+
 #endif //WEBSERVER_PROCESSPOOL_H
@@ -0,0 +1,56 @@
+//
+// 文件元数据缓存：开放定址的哈希表放在fork之前映射的共享内存中，所有服务进程和线程无锁地读取。
+// 每个槽由顺序锁(seqlock)保护，写者把序号改成奇数后写入，写完再加1；读者在读之前和之后各读一次序号，
+// 两次相同且为偶数时读到的数据才是完整的。未命中时由抢到槽的那一个进程stat，其它进程等它写完再读
+//
+
+#ifndef WEBSERVER_STATCACHE_H
+#define WEBSERVER_STATCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <atomic>
+
+class StatCache{
+public:
+    //映射共享内存，必须在fork出服务进程之前调用。valid_ms是缓存的结果被信任的时间，单位毫秒
+    static bool init(int valid_ms);
+    //与stat(2)相同的接口。没有调用init时直接stat；文件不存在的结果也会被缓存
+    static int stat(const char *path, struct stat *st);
+    static bool enabled(){ return m_slots != nullptr; }
+
+public:
+    static const int SLOT_NUMBER = 4096;
+    //开放定址时最多探测的槽数
+    static const int MAX_PROBE = 8;
+    static const int PATH_LEN = 256;
+    //等待别的进程写完一个槽时最多自旋的次数。超过后如果持有者已经退出就接管这个槽，否则这次不缓存
+    static const int MAX_SPIN = 1000;
+
+private:
+    struct alignas(64) Slot{
+        //偶数表示槽稳定，奇数表示有进程正在写
+        std::atomic<uint32_t> seq;
+        //stat失败时的errno，0表示成功
+        int error;
+        //最后一个写这个槽的进程，序号一直是奇数时用来判断它是不是在写的过程中退出了
+        pid_t owner;
+        //路径的哈希值，0表示空槽
+        uint64_t hash;
+        //过期时间，单位毫秒(CLOCK_MONOTONIC)
+        int64_t expire;
+        struct stat st;
+        char path[PATH_LEN];
+    };
+
+    //stat path并把结果写入槽中，调用者已经把seq改成了奇数，返回值与stat(2)相同
+    static int fill(Slot &slot, const char *path, size_t len, uint64_t hash, uint32_t seq, struct stat *st);
+
+private:
+    static Slot *m_slots;
+    static int m_valid_ms;
+};
+
+#endif //WEBSERVER_STATCACHE_H
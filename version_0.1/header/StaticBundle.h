@@ -0,0 +1,70 @@
+//
+// 静态资源包：BundlePack在构建时把网站根目录打包成一个带索引的文件，
+// 服务器启动时把它整个mmap进来，请求直接在内存中二分查找，不再对每个请求做stat/open/mmap
+//
+
+#ifndef WEBSERVER_STATICBUNDLE_H
+#define WEBSERVER_STATICBUNDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+/* 资源包的文件布局，所有偏移都相对于文件开头:
+ * | BundleHeader | BundleEntry[entry_count](按路径排序) | 字符串区(路径和预先生成的头部) | 数据区 | */
+static const char BUNDLE_MAGIC[8] = {'W', 'S', 'B', 'U', 'N', 'D', 'L', '1'};
+
+struct BundleHeader{
+    char magic[8];
+    uint32_t entry_count;
+    uint32_t reserved;
+    uint64_t file_size;
+};
+
+struct BundleEntry{
+    //请求路径，例如"/index.html"，不以'\0'结尾
+    uint64_t path_offset;
+    uint32_t path_len;
+    //预先生成的头部(Content-Length、Content-Type)
+    uint32_t header_len;
+    uint64_t header_offset;
+    uint64_t data_offset;
+    uint64_t data_len;
+    //gzip预压缩版本，没有时gzip_len为0
+    uint64_t gzip_header_offset;
+    uint32_t gzip_header_len;
+    uint32_t reserved;
+    uint64_t gzip_offset;
+    uint64_t gzip_len;
+};
+
+class StaticBundle{
+public:
+    ~StaticBundle();
+
+    //mmap资源包并检查索引，失败返回空指针
+    static std::shared_ptr<StaticBundle> open(const char *file);
+    //当前正在使用的资源包，没有加载时返回空指针
+    static std::shared_ptr<StaticBundle> current();
+    //原子地替换当前资源包，正在发送旧资源包内容的连接持有旧资源包的引用，发送完后旧资源包才会被munmap
+    static void publish(const std::shared_ptr<StaticBundle> &bundle);
+
+    //按请求路径查找，找不到返回空指针
+    const BundleEntry *find(const char *url) const;
+    const char *at(uint64_t offset) const { return m_address + offset; }
+    uint32_t size() const { return m_header->entry_count; }
+
+private:
+    StaticBundle() : m_address(nullptr), m_size(0), m_header(nullptr), m_entries(nullptr) {}
+    bool validate() const;
+
+private:
+    char *m_address;
+    size_t m_size;
+    const BundleHeader *m_header;
+    const BundleEntry *m_entries;
+
+    static std::shared_ptr<StaticBundle> m_current;
+};
+
+#endif //WEBSERVER_STATICBUNDLE_H
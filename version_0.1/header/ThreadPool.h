@@ -5,10 +5,12 @@
 
 #ifndef WEBSERVER_THREADPOOL_H
 #define WEBSERVER_THREADPOOL_H
-#include <list>
 #include <stdio.h>
+#include <stdint.h>
 #include "Locker.h"
 #include "TimeHeap.h"
+#include "Metrics.h"
+#include "Admission.h"
 
 template<typename T>
 //线程池，模板参数T是任务类
@@ -18,13 +20,17 @@ public:
 //允许的、等待处理的请求的数量
 ThreadPool(int thread_number = 4, int max_requests = 100000);
 ~ThreadPool();
-//向请求队列中添加任务
+//向请求队列中添加任务，队列已满时返回false
 bool append(T *request);
+//请求队列中等待的请求数
+int size();
 
 private:
     //工作线程运行的函数，它不断从工作队列中去除任务并执行
     static void *worker(void *arg);
     void run();
+    //通知已经启动的started个线程退出并等待它们结束
+    void stop(int started);
 
 private:
     //线程池中的线程数量
@@ -33,8 +39,16 @@ private:
     int m_max_requests;
     //线程池(线程指针数组)
     pthread_t *m_threads;
-    //请求队列
-    std::list<T *> m_work_queue;
+    //请求队列，和请求入队的时间一起保存，用于统计排队时间。
+    //构造时按m_max_requests分配好的环形数组，入队出队都不分配内存
+    struct Task{
+        T *request;
+        uint64_t enqueue_time;
+    };
+    Task *m_work_queue;
+    //队头的位置和队列中的请求数
+    int m_queue_head;
+    int m_queue_size;
     //保护请求队列的互斥锁
     Locker m_queue_locker;
     //是否有任务需要处理
@@ -48,23 +62,22 @@ private:
 
 template<typename T>
 ThreadPool<T>::ThreadPool(int thread_number, int max_requests): m_thread_number(thread_number),
-m_max_requests(max_requests), m_stop(false), m_threads(NULL){
+m_max_requests(max_requests), m_stop(false), m_threads(NULL), m_work_queue(NULL), m_queue_head(0), m_queue_size(0){
     if(m_thread_number <= 0 || m_max_requests <= 0){
         throw std::exception();
     }
 
+    m_work_queue = new Task[m_max_requests];
+
     //这里只是new了数组,没有调用pthread_t的构造函数
     m_threads = new pthread_t[m_thread_number];
 
-    //创建thread_number个线程，并将它们都设置为脱离线程
+    //创建thread_number个线程。线程不再设置为脱离线程，析构时要等它们退出，否则它们会访问已经释放的线程池
     for(int i = 0; i < m_thread_number; i++){
         printf("create the %d-th thead\n", i);
         if(pthread_create(m_threads + i, NULL, worker, this) != 0){
-            delete[] m_threads;
-            throw std::exception();
-        }
-        if(pthread_detach(m_threads[i])){
-            delete[] m_threads;
+            stop(i);
+            delete[] m_work_queue;
             throw std::exception();
         }
     }
@@ -72,25 +85,54 @@ m_max_requests(max_requests), m_stop(false), m_threads(NULL){
 
 template <typename T>
 ThreadPool<T>::~ThreadPool<T>() {
-    delete[] m_threads;
+    stop(m_thread_number);
+    delete[] m_work_queue;
+}
+
+template <typename T>
+void ThreadPool<T>::stop(int started) {
+    m_queue_locker.lock();
     m_stop = true;
+    m_queue_locker.unlock();
+    //每个线程都可能阻塞在信号量上，各唤醒一次
+    for(int i = 0; i < started; ++i){
+        m_queue_stat.post();
+    }
+    for(int i = 0; i < started; ++i){
+        pthread_join(m_threads[i], NULL);
+    }
+    delete[] m_threads;
+    m_threads = NULL;
 }
 
 template<typename T>
 bool ThreadPool<T>::append(T *request) {
     //操作工作队列一定要加锁，因为被所有线程共享
     m_queue_locker.lock();
-    if(m_work_queue.size() > m_max_requests){
+    if(m_queue_size >= m_max_requests){
         m_queue_locker.unlock();
+        Metrics::inc(M_QUEUE_REJECTED);
         return false;
     }
 
-    m_work_queue.push_back(request);
+    Task &task = m_work_queue[(m_queue_head + m_queue_size) % m_max_requests];
+    task.request = request;
+    task.enqueue_time = Metrics::now_ns();
+    ++m_queue_size;
     m_queue_locker.unlock();
-//    m_queue_stat.post();
+    Metrics::inc(M_QUEUE_PUSHED);
+    m_queue_stat.post();
     return true;
 }
 
+template <typename T>
+int ThreadPool<T>::size() {
+    m_queue_locker.lock();
+    int size = m_queue_size;
+    m_queue_locker.unlock();
+    return size;
+}
+
 template <typename T>
 void* ThreadPool<T>::worker(void *arg){
     ThreadPool<T> *pool = (ThreadPool<T> *)arg;
@@ -102,17 +144,30 @@ void* ThreadPool<T>::worker(void *arg){
 
 template <typename T>
 void ThreadPool<T>::run(){
-    while(!m_stop){
-        //等待信号量不用加锁
-//        m_queue_stat.wait();
+    while(true){
+        //等待信号量不用加锁。队列为空时线程阻塞在这里，不再空转占用CPU
+        m_queue_stat.wait();
         m_queue_locker.lock();
-        if(m_work_queue.empty()){
+        if(m_stop){
+            m_queue_locker.unlock();
+            break;
+        }
+        if(m_queue_size == 0){
+            //被信号打断的等待
             m_queue_locker.unlock();
             continue;
         }
-        T* request = m_work_queue.front();
-        m_work_queue.pop_front();
+        T* request = m_work_queue[m_queue_head].request;
+        uint64_t enqueue_time = m_work_queue[m_queue_head].enqueue_time;
+        m_queue_head = (m_queue_head + 1) % m_max_requests;
+        --m_queue_size;
         m_queue_locker.unlock();
+        Metrics::inc(M_QUEUE_POPPED);
+        uint64_t now = Metrics::now_ns();
+        Metrics::observe(H_QUEUE_WAIT, now - enqueue_time);
+        if(Admission::enabled()){
+            Admission::dequeued(now, now - enqueue_time);
+        }
         if(!request){
             continue;
         }
@@ -3,7 +3,9 @@
 // 最小堆实现定时器
 /* 主线程和工作线程都需要使用定时器堆，
  * 主线程在第一次addFd时添加定时器，
- * 工作线程在process_read()判定为NO_REQUEST时modFd之前添加定时器*/
+ * 工作线程在process_read()判定为NO_REQUEST时modFd之前添加定时器
+ * 定时器由使用者拥有(每个HttpConnection内嵌一个)，堆只保存指针，并在定时器中记下它在堆数组中的位置，
+ * 删除和重新计时都直接在原位置调整，不分配也不释放内存*/
 //
 
 #ifndef WEBSERVER_TIMEHEAP_H
@@ -29,7 +31,7 @@ class Timer; //前向声明
 //定时器类
 class Timer{
 public:
-    Timer(int delay, HttpConnection* httpConnection) : conn(httpConnection) {
+    Timer(int delay, HttpConnection* httpConnection) : conn(httpConnection), index(-1) {
         //time(NULL)返回的是1970到当前的秒数
         expire = time(nullptr) + delay;
     }
@@ -38,6 +40,8 @@ public:
 //    void (*cb_func)();//定时器回调函数
     time_t expire; //定时器生效的绝对时间
     HttpConnection* conn;
+    int index; //在堆数组中的位置，不在堆中时为-1
+    bool in_heap() const {return index >= 0;}
     bool isvalid(){
         time_t cur = time(nullptr);
         //判断定时器是否有效
@@ -77,6 +81,7 @@ public:
             //初始化堆数组
             for(int i = 0; i < size; ++i){
                 array[i] = init_array[i];
+                array[i]->index = i;
             }
             //(index-1)/2表示的是index位置的节点的父节点
             //(cur_size-1)/2表示最后一个节点的下一个空位的父节点，即倒数第一个非叶子节点
@@ -88,50 +93,47 @@ public:
         }
     }
 
-    //销毁时间堆
+    //销毁时间堆，定时器属于使用者，不在这里释放
     ~TimeHeap(){
-        for(int i = 0; i < cur_size; ++i){
-            delete array[i];
-        }
-        //因为存储的是类对象的指针，所以上一条先删除对象
-        //这一条再删除array中的全部指针
         delete [] array;
     }
 
 public:
-    //添加目标定时器timer
+    //添加目标定时器timer，已经在堆中时按新的过期时间调整位置
     void add_timer(Timer* timer) throw (std::exception){
         if(!timer){
             return;
         }
+        if(timer->in_heap()){
+            del_timer(timer);
+        }
         if(cur_size >= capacity){
             //如果当前堆数组容量不够，则将其扩大1倍
             resize();
         }
-        //新插入了一个元素，当前堆大小加1，hole是新建空穴的位置
-        int hole = cur_size++;
-        int parent = 0;
-        //插入时
-        //对从空穴到根节点的路径上所有节点执行上滤操作
-        for(; hole > 0; hole = parent){
-            parent = (hole-1) / 2;
-            if(array[parent]->expire <= timer->expire){
-                break;
-            }
-            array[hole] = array[parent];
-        }
-        array[hole] = timer;
+        //新插入了一个元素，当前堆大小加1，在新建的空穴上执行上滤操作
+        array[cur_size] = timer;
+        percolate_up(cur_size++);
     }
 
-    //删除目标定时timer
+    //把目标定时器timer从堆中删除。用堆数组中最后一个元素填补它的位置，再按需要上滤或下滤，
+    //堆中只有仍在计时的定时器，不会因为反复重新计时而膨胀
     void del_timer(Timer* timer){
-        if(!timer){
+        if(!timer || !timer->in_heap()){
+            return;
+        }
+        int hole = timer->index;
+        timer->index = -1;
+        if(hole == --cur_size){
             return;
         }
-        //仅仅将目标定时器的回调函数设置为空，即所谓的延迟销毁。这将节省真正删除该定时器造成的开销，
-        //但是这样做容易使堆数组膨胀
-        //timer->cb_func = nullptr;
-        timer->conn = nullptr;
+        array[hole] = array[cur_size];
+        array[hole]->index = hole;
+        if(hole > 0 && array[hole]->expire < array[(hole-1) / 2]->expire){
+            percolate_up(hole);
+        }else{
+            percolate_down(hole);
+        }
     }
     //获得堆顶部的定时器
     Timer* top() const
@@ -146,10 +148,10 @@ public:
         if(empty()){
             return;
         }
-        if(array[0]){
-            delete array[0];
-            //将原来的堆顶元素替换为堆数组中最后一个元素
-            array[0] = array[--cur_size];
+        array[0]->index = -1;
+        //将原来的堆顶元素替换为堆数组中最后一个元素
+        array[0] = array[--cur_size];
+        if(cur_size > 0){
             //对新的对丁元素执行下滤操作
             percolate_down(0);
         }
@@ -188,8 +190,28 @@ public:
 //    }
 
     bool empty() const {return cur_size == 0;}
+    //堆中定时器的个数
+    int size() const {return cur_size;}
+    //堆数组占用的字节数，定时器本身在使用者的对象中
+    size_t bytes() const {return (size_t)capacity * sizeof(Timer*);}
 
 private:
+    //最小堆的上滤操作，对从hole到根节点的路径上所有节点执行
+    void percolate_up(int hole){
+        Timer* temp = array[hole];
+        int parent = 0;
+        for(; hole > 0; hole = parent){
+            parent = (hole-1) / 2;
+            if(array[parent]->expire <= temp->expire){
+                break;
+            }
+            array[hole] = array[parent];
+            array[hole]->index = hole;
+        }
+        array[hole] = temp;
+        temp->index = hole;
+    }
+
     //最小堆的下滤操作，确保堆数组中以第hole个节点作为根的子树拥有最小堆性质
     void percolate_down(int hole){
         Timer* temp = array[hole];
@@ -205,6 +227,7 @@ private:
             //将小的子节点放到父亲节点上去，子节点变成了空的
             if(array[child]->expire < temp->expire){
                 array[hole] = array[child];
+                array[hole]->index = hole;
             }else{
                 //如果已经形成小顶堆那么就可以结束了留出一个节点来给hole插入
                 break;
@@ -212,6 +235,7 @@ private:
         }
         //将节点插入空穴
         array[hole] = temp;
+        temp->index = hole;
     }
 
     //将堆数组容量扩大一倍
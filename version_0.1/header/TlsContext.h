@@ -0,0 +1,64 @@
+//
+// HTTPS支持：用OpenSSL完成握手，握手完成后把记录层的加密交给内核(kTLS)，
+// 这样mmap + writev的静态文件发送路径在加密的情况下依然没有用户态拷贝
+//
+
+#ifndef WEBSERVER_TLSCONTEXT_H
+#define WEBSERVER_TLSCONTEXT_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+//OpenSSL中SSL和SSL_CTX的前向声明，未开启WEBSERVER_TLS编译时不需要OpenSSL头文件
+struct ssl_st;
+struct ssl_ctx_st;
+
+//全局TLS上下文，所有连接共享证书和会话票据密钥
+class TlsContext{
+public:
+    //加载证书和私钥，开启kTLS和会话票据复用，失败返回false
+    static bool init(const char *cert_file, const char *key_file);
+    //是否已经初始化，即监听socket上的连接是否都是HTTPS连接
+    static bool enabled(){ return m_ctx != nullptr; }
+    static struct ssl_ctx_st *get(){ return m_ctx; }
+
+private:
+    static struct ssl_ctx_st *m_ctx;
+};
+
+//单个连接的TLS状态
+class TlsConn{
+public:
+    //握手的结果
+    enum HANDSHAKE {HS_DONE = 0, HS_WANT_READ, HS_WANT_WRITE, HS_ERROR};
+
+    TlsConn() : m_ssl(nullptr), m_ktls_send(false), m_ktls_recv(false), m_established(false), m_want_write(false) {}
+
+    //为新连接创建SSL对象
+    bool attach(int sock_fd);
+    //握手完成的连接先尽力发送一次close_notify，然后释放SSL对象。
+    //没有close_notify时客户端会认为连接被截断，不会复用这个会话
+    void reset();
+    //继续非阻塞握手，握手完成后检查内核是否接管了发送和接收方向的加密
+    HANDSHAKE handshake();
+    //读取解密后的数据，语义同recv：没有数据可读时返回-1并把errno置为EAGAIN，对方关闭返回0
+    ssize_t recv(char *buf, size_t len);
+    //发送数据，语义同writev。kTLS接管发送方向时直接对socket调用writev，否则退回SSL_write
+    ssize_t writev(int sock_fd, const struct iovec *iov, int iov_count);
+
+    bool active() const { return m_ssl != nullptr; }
+    bool established() const { return m_established; }
+    bool ktls_send() const { return m_ktls_send; }
+    bool ktls_recv() const { return m_ktls_recv; }
+    //握手消息没能全部写入socket，需要等待EPOLLOUT后继续握手
+    bool want_write() const { return m_want_write; }
+
+private:
+    struct ssl_st *m_ssl;
+    bool m_ktls_send;
+    bool m_ktls_recv;
+    bool m_established;
+    bool m_want_write;
+};
+
+#endif //WEBSERVER_TLSCONTEXT_H
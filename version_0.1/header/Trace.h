@@ -0,0 +1,99 @@
+//
+// 请求跟踪：按采样率选中的请求在每个处理阶段记下单调时钟的时间，应答发送完后把记录写入当前线程的环形缓冲区。
+// 每个环只有一个写者(所属线程)，写完一条记录才推进head，不需要锁；主线程定期把新的记录追加到二进制文件中，
+// 由tools/TraceDecode解析
+//
+
+#ifndef WEBSERVER_TRACE_H
+#define WEBSERVER_TRACE_H
+
+#include <stdint.h>
+#include <atomic>
+
+//处理阶段，按发生的先后排列。T_START是连接被accept或者上一个应答发送完的时刻，其余阶段相对它计时
+enum TRACE_PHASE {T_START = 0,
+                  T_READ,       //读到请求的第一批数据
+                  T_QUEUED,     //放入线程池的请求队列
+                  T_PROCESS,    //工作线程开始处理
+                  T_PARSED,     //请求解析完成，开始do_request
+                  T_RESOLVED,   //do_request返回，文件已经找到并映射
+                  T_WRITE,      //开始发送应答
+                  T_SENT,       //应答发送完(中间可能等待过EPOLLOUT)
+                  PHASE_NUMBER};
+
+//文件中的一条记录，定长，按本机字节序
+struct TraceRecord{
+    //T_START的时间，CLOCK_MONOTONIC纳秒
+    uint64_t start;
+    //各阶段相对start的纳秒数，0表示请求没有经过这个阶段(例如没有线程池时的T_QUEUED)
+    uint32_t phase[PHASE_NUMBER];
+    //应答的字节数和状态码
+    uint32_t bytes;
+    uint16_t status;
+    uint16_t reserved;
+    //记录所在的进程，多进程时所有进程写入同一个文件
+    uint32_t pid;
+    //请求的URL，超长时截断
+    char url[52];
+};
+
+//文件头，后面紧跟着若干条记录
+struct TraceFileHeader{
+    char magic[8];
+    uint32_t record_size;
+    uint32_t phase_number;
+};
+
+#define TRACE_MAGIC "WSTRACE1"
+
+class Trace{
+public:
+    //截断文件并写入文件头，必须在fork出服务进程之前调用。每sample_every个请求记录一个
+    static bool init(const char *file, int sample_every);
+    static bool enabled(){ return m_sample_every > 0; }
+    //新的请求开始时调用，返回这个请求是否被采样
+    static bool sample(){
+        if(m_sample_every <= 0){
+            return false;
+        }
+        static thread_local int t_countdown = 1;
+        if(--t_countdown > 0){
+            return false;
+        }
+        t_countdown = m_sample_every;
+        return true;
+    }
+    //记下一个阶段的时间，同一个阶段只记第一次
+    static void mark(TraceRecord &record, TRACE_PHASE phase, uint64_t now);
+    //请求完成，把记录放入当前线程的环形缓冲区
+    static void commit(const TraceRecord &record);
+    //把各线程环中还没有写出的记录追加到文件，只能由一个线程调用
+    static void dump();
+
+public:
+    //每个线程的环能容纳的记录数，两次dump之间超过的部分被覆盖
+    static const int RING_SIZE = 4096;
+    static const int MAX_RINGS = 64;
+    //主线程两次dump之间的间隔，单位秒
+    static const int DUMP_INTERVAL = 1;
+
+private:
+    struct Ring{
+        TraceRecord records[RING_SIZE];
+        //已经写入的记录总数，记录写完后才以release语义推进
+        std::atomic<uint64_t> head;
+        //已经写出到文件的记录总数，只由dump访问
+        uint64_t dumped;
+    };
+    static Ring *ring();
+
+private:
+    static const char *m_file;
+    static int m_sample_every;
+    static std::atomic<Ring *> m_rings[MAX_RINGS];
+    static std::atomic<int> m_ring_number;
+    //环被覆盖或者线程太多而丢掉的记录数
+    static std::atomic<uint64_t> m_dropped;
+};
+
+#endif //WEBSERVER_TRACE_H
@@ -0,0 +1,32 @@
+//
+// 不停机升级：收到SIGUSR2的进程fork并exec新的可执行文件，监听socket通过环境变量中的文件描述符交给新进程，
+// 新进程不再bind/listen，初始化完成后通过就绪管道通知旧进程，旧进程这才停止accept，处理完已有的连接后退出。
+// 两个进程共用同一个监听socket和它的accept队列，升级过程中不会有连接被拒绝
+//
+
+#ifndef WEBSERVER_UPGRADE_H
+#define WEBSERVER_UPGRADE_H
+
+class BinaryUpgrade{
+public:
+    //保存命令行参数，升级时用同样的参数exec新的可执行文件
+    static void save_argv(char **argv);
+    //返回从旧进程继承的监听socket，不是升级启动的时候返回-1
+    static int inherited_listen_fd();
+    //新进程初始化完成，通知旧进程开始退出。不是升级启动的时候什么也不做
+    static void notify_ready();
+
+    //在旧进程中启动新的可执行文件，返回就绪管道的读端(非阻塞)，由调用者注册到epoll中，失败时返回-1
+    static int start(int listen_fd);
+    //就绪管道可读时调用，返回新进程是否已经就绪。新进程启动失败时管道被关闭，返回false。ready_fd在这里被关闭
+    static bool finish(int ready_fd);
+
+public:
+    //旧进程停止accept之后，等待已有连接处理完的最长时间，单位秒
+    static const int DRAIN_TIMEOUT = 30;
+
+private:
+    static char **m_argv;
+};
+
+#endif //WEBSERVER_UPGRADE_H
@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+# 参数搜索：在本机上对线程数(-t)、请求队列长度(-q)和读写缓冲区大小(-u)的每种组合启动WebServer，
+# 用同一个负载(默认256个保持连接闭环请求4KB的文件，也可以是开环速率或者回放-C捕获的文件)压测，
+# 记录吞吐量和p99延迟，输出吞吐量与p99延迟的Pareto最优组合(没有别的组合吞吐量更高同时p99更低)。
+# 错误比例超过--max-error的组合不参与比较
+#
+# 用法: autotune.py --server path/WebServer --loadgen path/loadgen [--threads 1,2,4,8] [--queues 64,1024,100000]
+#                   [--buffers 2048:1024,4096:2048,16384:4096] [--connections 256] [--file-size 4096] [--close]
+#                   [--rate 0] [--capture file [--speed 1]] [--duration 5] [--out autotune.json]
+
+import argparse
+import itertools
+import json
+import os
+import platform
+import shutil
+import signal
+import subprocess
+import sys
+import time
+
+from perf_regress import free_port, raise_fd_limit, wait_listening
+
+
+def run(args, threads, queue, read_buf, write_buf, work):
+    name = f"t{threads}_q{queue}_u{read_buf}_{write_buf}"
+    server_args = ["-t", str(threads), "-q", str(queue), "-u", f"{read_buf},{write_buf}"] + args.server_args.split()
+    port = free_port()
+    log = open(os.path.join(work, f"{name}.log"), "w")
+    server = subprocess.Popen([args.server, "-r", args.doc_root] + server_args + ["127.0.0.1", str(port)],
+                              stdout=log, stderr=subprocess.STDOUT, preexec_fn=raise_fd_limit)
+    try:
+        if not wait_listening(port):
+            raise RuntimeError(f"{name}: server did not start, see {log.name}")
+        url = f"http://127.0.0.1:{port}/tune.bin"
+        if args.capture:
+            loadgen = [args.loadgen, "-r", args.capture, "-S", str(args.speed), "-T", str(args.loadgen_threads)]
+        else:
+            loadgen = [args.loadgen, "-c", str(args.connections), "-T", str(args.loadgen_threads), "-s", "1000"]
+            if args.close:
+                loadgen.append("-K")
+            if args.rate > 0:
+                loadgen += ["-R", str(args.rate)]
+        if args.warmup > 0 and not args.capture:
+            subprocess.run(loadgen + ["-d", str(args.warmup), url], stdout=subprocess.DEVNULL,
+                           preexec_fn=raise_fd_limit, check=False)
+        result_file = os.path.join(work, f"{name}.json")
+        done = subprocess.run(loadgen + ["-d", str(args.duration), "-J", result_file, url], stdout=subprocess.PIPE,
+                              stderr=subprocess.STDOUT, preexec_fn=raise_fd_limit, text=True, check=False)
+        if not os.path.exists(result_file):
+            raise RuntimeError(f"{name}: loadgen failed:\n{done.stdout}")
+        with open(result_file) as f:
+            load = json.load(f)
+    finally:
+        server.send_signal(signal.SIGINT)
+        try:
+            server.wait(timeout=10)
+        except subprocess.TimeoutExpired:
+            server.kill()
+            server.wait()
+        log.close()
+
+    errors = sum(load["errors"].values())
+    return {
+        "threads": threads,
+        "queue_size": queue,
+        "read_buffer": read_buf,
+        "write_buffer": write_buf,
+        "server_args": " ".join(server_args),
+        "requests_per_second": load["requests_per_second"],
+        "p50_ms": load["latency_ms"]["p50"],
+        "p99_ms": load["latency_ms"]["p99"],
+        "error_ratio": round(errors / max(load["requests"] + errors, 1), 5),
+    }
+
+
+def pareto(results):
+    """吞吐量越高越好、p99越低越好，返回不被任何其它结果同时在两方面超过的结果，按吞吐量排序"""
+    front = []
+    for r in results:
+        dominated = any(o is not r and o["requests_per_second"] >= r["requests_per_second"] and o["p99_ms"] <= r["p99_ms"]
+                        and (o["requests_per_second"] > r["requests_per_second"] or o["p99_ms"] < r["p99_ms"])
+                        for o in results)
+        if not dominated:
+            front.append(r)
+    return sorted(front, key=lambda r: -r["requests_per_second"])
+
+
+def int_list(text):
+    return [int(v) for v in text.split(",") if v]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Search WebServer thread, queue and buffer settings on this host")
+    parser.add_argument("--server", required=True)
+    parser.add_argument("--loadgen", required=True)
+    parser.add_argument("--threads", type=int_list, default=[1, 2, 4, 8], help="values for -t")
+    parser.add_argument("--queues", type=int_list, default=[64, 1024, 100000], help="values for -q")
+    parser.add_argument("--buffers", default="2048:1024,4096:2048,16384:4096", help="read:write values for -u")
+    parser.add_argument("--server-args", default="", help="other WebServer options kept fixed, e.g. '-a 1'")
+    parser.add_argument("--connections", type=int, default=256)
+    parser.add_argument("--file-size", type=int, default=4096, help="bytes of the requested file")
+    parser.add_argument("--close", action="store_true", help="one connection per request instead of keep-alive")
+    parser.add_argument("--rate", type=float, default=0, help="open loop request rate, 0 for closed loop")
+    parser.add_argument("--capture", help="replay this file captured with WebServer -C instead")
+    parser.add_argument("--speed", type=float, default=1.0, help="replay speed with --capture")
+    parser.add_argument("--loadgen-threads", type=int, default=min(os.cpu_count() or 1, 4))
+    parser.add_argument("--duration", type=int, default=5, help="seconds per setting")
+    parser.add_argument("--warmup", type=int, default=1, help="seconds of unrecorded load before each setting")
+    parser.add_argument("--max-error", type=float, default=0.01, help="error ratio above which a setting is rejected")
+    parser.add_argument("--out", default="autotune.json")
+    parser.add_argument("--work", default="autotune_work", help="directory for the doc_root fixture and logs")
+    args = parser.parse_args()
+
+    buffers = [tuple(int(v) for v in b.split(":")) for b in args.buffers.split(",") if b]
+    work = os.path.abspath(args.work)
+    args.doc_root = os.path.join(work, "doc_root")
+    shutil.rmtree(work, ignore_errors=True)
+    os.makedirs(args.doc_root)
+    with open(os.path.join(args.doc_root, "tune.bin"), "wb") as f:
+        f.write(bytes(range(256)) * (args.file_size // 256) + bytes(args.file_size % 256))
+
+    results = []
+    print(f"{'threads':>7} {'queue':>7} {'buffers':>12} {'req/s':>10} {'p50 ms':>9} {'p99 ms':>9} {'errors':>7}")
+    for threads, queue, (read_buf, write_buf) in itertools.product(args.threads, args.queues, buffers):
+        try:
+            r = run(args, threads, queue, read_buf, write_buf, work)
+        except RuntimeError as e:
+            print(e, file=sys.stderr)
+            return 2
+        results.append(r)
+        print(f"{threads:7d} {queue:7d} {f'{read_buf}:{write_buf}':>12} {r['requests_per_second']:10.0f} "
+              f"{r['p50_ms']:9.3f} {r['p99_ms']:9.3f} {r['error_ratio']:7.4f}", flush=True)
+
+    valid = [r for r in results if r["error_ratio"] <= args.max_error]
+    front = pareto(valid)
+    print(f"\nPareto-optimal settings ({len(front)} of {len(valid)} within the error limit), throughput versus p99:")
+    for r in front:
+        print(f"  {r['requests_per_second']:10.0f} req/s  p99 {r['p99_ms']:9.3f} ms   {r['server_args']}")
+
+    report = {
+        "context": {
+            "date": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+            "host_name": platform.node(),
+            "num_cpus": os.cpu_count(),
+            "kernel": platform.release(),
+            "load": {"connections": args.connections, "file_size": args.file_size, "keep_alive": not args.close,
+                     "rate": args.rate, "capture": args.capture, "speed": args.speed, "duration": args.duration},
+            "server_args": args.server_args,
+        },
+        "results": results,
+        "pareto": front,
+    }
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2)
+    print(f"results written to {args.out}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
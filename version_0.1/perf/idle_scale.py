@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+# 空闲连接的扩展性测试(C10K/C100K)：对每个连接数N，启动WebServer，用loadgen -I建立N个空闲的保持连接，
+# 再以固定速率发送少量活动请求，测服务器同时持有这些连接时：
+#   - 进程的常驻内存，以及每增加一个连接增加的内存
+#   - 定时器堆的条目数和字节数(来自-m输出的运行指标)
+#   - 内核中epoll条目(eventpoll_epi)和整个slab的增长，回环地址上客户端和服务器两端的socket都计入slab
+#   - 活动请求的延迟
+# 连接表按MAX_FD预先分配，每个槽只是一个指针，这是唯一与N无关的固定开销，单独列出；连接对象和它的缓冲区
+# 在描述符号第一次被accept时创建(webserver_connection_objects × webserver_connection_object_bytes)，计入每个连接的增量。
+# 空载的常驻内存达到所有槽都构造出连接对象的一半时给出警告，说明连接对象又在启动时被整体构造了。
+# N超过进程的描述符号上限或者MAX_FD时实际持有的连接会少于N，以held列为准
+#
+# 用法: idle_scale.py --server path/WebServer --loadgen path/loadgen [--counts 0,1000,10000,50000,100000]
+#                     [--rate 200] [--duration 5] [--out idle_scale.json]
+
+import argparse
+import json
+import os
+import platform
+import resource
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import time
+
+# 每个连接在loadgen和服务器中各占一个描述符号，留一些给其它文件
+FD_RESERVE = 64
+
+
+def raise_fd_limit():
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < hard:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def fetch_metrics(port):
+    """读取服务器的运行指标，返回{名字: 值}，只保留没有标签的行"""
+    try:
+        with socket.create_connection(("127.0.0.1", port), timeout=2) as s:
+            s.sendall(b"GET /metrics HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n")
+            data = b""
+            while True:
+                chunk = s.recv(65536)
+                if not chunk:
+                    break
+                data += chunk
+    except OSError:
+        return None
+    metrics = {}
+    for line in data.decode(errors="replace").split("\r\n\r\n", 1)[-1].splitlines():
+        if line.startswith("#") or "{" in line:
+            continue
+        parts = line.split()
+        if len(parts) == 2:
+            metrics[parts[0]] = float(parts[1])
+    return metrics
+
+
+def proc_rss_kb(pid):
+    with open(f"/proc/{pid}/status") as f:
+        for line in f:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+
+def kernel_memory():
+    """slab的总量(kB)和epoll条目的个数、大小，没有权限读slabinfo时epoll一项为None"""
+    slab = 0
+    with open("/proc/meminfo") as f:
+        for line in f:
+            if line.startswith("Slab:"):
+                slab = int(line.split()[1])
+    epi = None
+    try:
+        with open("/proc/slabinfo") as f:
+            for line in f:
+                if line.startswith("eventpoll_epi "):
+                    fields = line.split()
+                    epi = (int(fields[1]), int(fields[3]))
+    except OSError:
+        pass
+    return slab, epi
+
+
+def sample(server, port):
+    metrics = fetch_metrics(port) or {}
+    slab, epi = kernel_memory()
+    return {"rss_kb": proc_rss_kb(server.pid), "metrics": metrics, "slab_kb": slab, "epi": epi}
+
+
+def run_count(args, count, work):
+    port = free_port()
+    log = open(os.path.join(work, f"server_{count}.log"), "w")
+    server = subprocess.Popen([args.server, "-r", args.doc_root, "-m", "/metrics"] + args.server_args.split()
+                              + ["127.0.0.1", str(port)], stdout=log, stderr=subprocess.STDOUT,
+                              preexec_fn=raise_fd_limit)
+    try:
+        deadline = time.time() + 5
+        while fetch_metrics(port) is None:
+            if time.time() > deadline or server.poll() is not None:
+                raise RuntimeError(f"server did not start, see {log.name}")
+            time.sleep(0.05)
+        before = sample(server, port)
+        result_file = os.path.join(work, f"load_{count}.json")
+        loadgen = subprocess.Popen([args.loadgen, "-c", str(args.connections), "-R", str(args.rate),
+                                    "-d", str(args.duration), "-s", "10000", "-J", result_file]
+                                   + (["-I", str(count)] if count else [])
+                                   + [f"http://127.0.0.1:{port}/small.bin"],
+                                   stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True,
+                                   preexec_fn=raise_fd_limit)
+        # 压测期间反复采样，取服务器持有连接最多的一次
+        peak = before
+        while loadgen.poll() is None:
+            time.sleep(0.25)
+            s = sample(server, port)
+            if s["metrics"].get("webserver_connections_active", 0) >= \
+                    peak["metrics"].get("webserver_connections_active", 0):
+                peak = s
+        output = loadgen.stdout.read()
+        if loadgen.returncode != 0 or not os.path.exists(result_file):
+            raise RuntimeError(f"loadgen failed:\n{output}")
+        with open(result_file) as f:
+            load = json.load(f)
+    finally:
+        server.send_signal(signal.SIGINT)
+        try:
+            server.wait(timeout=30)
+        except subprocess.TimeoutExpired:
+            server.kill()
+            server.wait()
+        log.close()
+
+    m = peak["metrics"]
+    # 活动连接也计入held，每连接的增量按空闲连接和活动连接一起算
+    held = int(m.get("webserver_connections_active", 0))
+    added = max(held - int(before["metrics"].get("webserver_connections_active", 0)), 1)
+    result = {
+        "requested": count,
+        "idle_opened": load.get("idle_connections", 0),
+        "idle_alive": load.get("idle_alive", 0),
+        "held": held,
+        "rss_kb": peak["rss_kb"],
+        "rss_start_kb": before["rss_kb"],
+        "rss_bytes_per_connection": round((peak["rss_kb"] - before["rss_kb"]) * 1024 / added, 1),
+        "connection_slots": int(m.get("webserver_connection_slots", 0)),
+        "connection_objects": int(m.get("webserver_connection_objects", 0)),
+        "connection_object_bytes": int(m.get("webserver_connection_object_bytes", 0)),
+        # 连接表本身的固定开销，每个槽一个指针
+        "connection_table_kb": int(m.get("webserver_connection_slots", 0) * 8 / 1024),
+        "timer_heap_entries": int(m.get("webserver_timer_heap_entries", 0)),
+        "timer_heap_bytes": int(m.get("webserver_timer_heap_bytes", 0)),
+        "kernel_slab_bytes_per_connection": round((peak["slab_kb"] - before["slab_kb"]) * 1024 / added, 1),
+        "latency_ms": {k: load["latency_ms"][k] for k in ("p50", "p90", "p99", "p99.9", "max")},
+        "requests_per_second": load["requests_per_second"],
+        "errors": sum(load["errors"].values()),
+    }
+    if peak["epi"] and before["epi"]:
+        result["epoll_entries"] = peak["epi"][0] - before["epi"][0]
+        result["epoll_bytes"] = result["epoll_entries"] * peak["epi"][1]
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Idle connection scaling benchmark for WebServer")
+    parser.add_argument("--server", required=True)
+    parser.add_argument("--loadgen", required=True)
+    parser.add_argument("--counts", default="0,1000,10000,50000,100000", help="idle connection counts")
+    parser.add_argument("--connections", type=int, default=10, help="active connections")
+    parser.add_argument("--rate", type=float, default=200, help="active requests per second")
+    parser.add_argument("--duration", type=int, default=5, help="seconds of active load per count")
+    parser.add_argument("--out", default="idle_scale.json")
+    parser.add_argument("--work", default="idle_work", help="directory for the doc_root fixture and logs")
+    parser.add_argument("--server-args", default="", help="extra WebServer options, e.g. '-t 8'")
+    args = parser.parse_args()
+
+    work = os.path.abspath(args.work)
+    args.doc_root = os.path.join(work, "doc_root")
+    shutil.rmtree(work, ignore_errors=True)
+    os.makedirs(args.doc_root)
+    with open(os.path.join(args.doc_root, "small.bin"), "wb") as f:
+        f.write(bytes(range(256)) * 4)
+
+    raise_fd_limit()
+    fd_limit = resource.getrlimit(resource.RLIMIT_NOFILE)[1] - FD_RESERVE - args.connections
+    results = []
+    print(f"{'requested':>9} {'held':>7} {'rss MB':>8} {'B/conn':>8} {'timers':>8} {'timer kB':>9} "
+          f"{'epoll kB':>9} {'kernel B/conn':>13} {'p50 ms':>8} {'p99 ms':>8} {'max ms':>8}")
+    for count in [int(c) for c in args.counts.split(",") if c]:
+        if count > fd_limit:
+            print(f"{count:9d} skipped: needs more than the {fd_limit + FD_RESERVE + args.connections} "
+                  f"file descriptors allowed (ulimit -Hn)")
+            continue
+        try:
+            r = run_count(args, count, work)
+        except RuntimeError as e:
+            print(f"{count:9d} failed: {e}", file=sys.stderr)
+            return 2
+        results.append(r)
+        print(f"{count:9d} {r['held']:7d} {r['rss_kb'] / 1024:8.1f} {r['rss_bytes_per_connection']:8.0f} "
+              f"{r['timer_heap_entries']:8d} {r['timer_heap_bytes'] / 1024:9.1f} "
+              f"{r.get('epoll_bytes', 0) / 1024:9.1f} {r['kernel_slab_bytes_per_connection']:13.0f} "
+              f"{r['latency_ms']['p50']:8.3f} {r['latency_ms']['p99']:8.3f} {r['latency_ms']['max']:8.3f}", flush=True)
+
+    if results:
+        r = results[0]
+        print(f"connection objects: {r['connection_object_bytes']} bytes each with buffers, created on first accept; "
+              f"connection table: {r['connection_slots']} slots, {r['connection_table_kb']} kB fixed")
+        full_table_kb = r["connection_slots"] * r["connection_object_bytes"] / 1024
+        if r["rss_start_kb"] >= full_table_kb / 2:
+            print(f"WARNING: idle RSS {r['rss_start_kb'] / 1024:.1f} MB is close to a connection object for every slot "
+                  f"({full_table_kb / 1024:.1f} MB), the objects are probably constructed at startup")
+    report = {
+        "context": {
+            "date": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+            "host_name": platform.node(),
+            "num_cpus": os.cpu_count(),
+            "kernel": platform.release(),
+            "rate": args.rate,
+            "duration": args.duration,
+            "server_args": args.server_args,
+        },
+        "results": results,
+    }
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2)
+    print(f"results written to {args.out}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
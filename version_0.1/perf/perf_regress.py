@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+# 端到端的性能回归测试：在回环地址上启动WebServer，用生成的网站根目录作为测试数据，
+# 用loadgen依次压测小文件/大文件、保持连接/每个请求一个连接、1千/1万个连接的组合，
+# 记录每秒请求数、延迟分位数、每个请求消耗的服务器CPU时间和内存，写入JSON并与保存的基线比较，超出容差时返回1。
+# 1千个连接是闭环测试，测最大吞吐量；1万个连接同时全速请求时每个应答都要排很久的队，改为按固定速率的开环测试，
+# 测这么多连接下的延迟、CPU和内存
+#
+# 用法: perf_regress.py --server path/WebServer --loadgen path/loadgen [--baseline baseline.json] [--out perf.json]
+#                       [--update-baseline] [--duration 5] [--filter small]
+# 基线与机器有关，在做比较的机器上用--update-baseline生成。基线文件不存在或者其中没有要测的组合时不做测试，
+# 返回SKIPPED，ctest把测试报告为跳过而不是通过
+
+import argparse
+import json
+import os
+import platform
+import resource
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import time
+
+# (名字, 文件, 是否保持连接, 连接数, 每秒请求数)，速率为0时是闭环测试
+OPEN_LOOP_RATE = {"small": 1000, "large": 50}
+SCENARIOS = [
+    (f"{size}_{'keepalive' if keep_alive else 'close'}_{conns // 1000}k", f"/{size}.bin", keep_alive, conns,
+     OPEN_LOOP_RATE[size] if conns >= 10000 else 0)
+    for size in ("small", "large")
+    for keep_alive in (True, False)
+    for conns in (1000, 10000)
+]
+FILE_SIZES = {"small": 1024, "large": 1 << 20}
+
+# 与CMakeLists.txt中perf测试的SKIP_RETURN_CODE相同
+SKIPPED = 77
+
+# 各项指标变差多少算回归，以及延迟的绝对下限(小于它的变化是噪声)。基线文件中的tolerance覆盖这里的值
+DEFAULT_TOLERANCE = {
+    "requests_per_second": 0.10,
+    "latency": 0.50,
+    "cpu_us_per_request": 0.20,
+    "rss_kb": 0.20,
+    "latency_floor_ms": 1.0,
+    "error_ratio": 0.01,
+}
+
+
+def make_doc_root(path):
+    os.makedirs(path, exist_ok=True)
+    for name, size in FILE_SIZES.items():
+        # 内容固定，各次运行完全相同
+        block = bytes(range(256)) * 4
+        with open(os.path.join(path, f"{name}.bin"), "wb") as f:
+            for _ in range(size // len(block)):
+                f.write(block)
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def wait_listening(port, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=0.2).close()
+            return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def raise_fd_limit():
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < hard:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+
+def proc_cpu_seconds(pid):
+    with open(f"/proc/{pid}/stat") as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    # utime和stime是第14、15个字段，去掉前两个字段之后的下标为11、12
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def proc_memory_kb(pid):
+    rss = hwm = 0
+    with open(f"/proc/{pid}/status") as f:
+        for line in f:
+            if line.startswith("VmRSS:"):
+                rss = int(line.split()[1])
+            elif line.startswith("VmHWM:"):
+                hwm = int(line.split()[1])
+    return rss, hwm
+
+
+def run_scenario(args, name, path, keep_alive, conns, rate, work):
+    port = free_port()
+    log = open(os.path.join(work, f"{name}.server.log"), "w")
+    server = subprocess.Popen([args.server, "-r", args.doc_root] + args.server_args.split() + ["127.0.0.1", str(port)],
+                              stdout=log, stderr=subprocess.STDOUT, preexec_fn=raise_fd_limit)
+    try:
+        if not wait_listening(port):
+            raise RuntimeError(f"{name}: server did not start, see {log.name}")
+        url = f"http://127.0.0.1:{port}{path}"
+        loadgen = [args.loadgen, "-c", str(conns), "-T", str(args.threads), "-s", "5000"]
+        if not keep_alive:
+            loadgen.append("-K")
+        if rate > 0:
+            loadgen += ["-R", str(rate * args.rate_scale)]
+        if args.warmup > 0:
+            subprocess.run(loadgen + ["-d", str(args.warmup), url], stdout=subprocess.DEVNULL,
+                           preexec_fn=raise_fd_limit, check=False)
+        result_file = os.path.join(work, f"{name}.json")
+        cpu_before = proc_cpu_seconds(server.pid)
+        done = subprocess.run(loadgen + ["-d", str(args.duration), "-J", result_file, url], stdout=subprocess.PIPE,
+                              stderr=subprocess.STDOUT, preexec_fn=raise_fd_limit, text=True, check=False)
+        cpu = proc_cpu_seconds(server.pid) - cpu_before
+        rss, hwm = proc_memory_kb(server.pid)
+        if done.returncode != 0 or not os.path.exists(result_file):
+            raise RuntimeError(f"{name}: loadgen failed:\n{done.stdout}")
+        with open(result_file) as f:
+            load = json.load(f)
+    finally:
+        server.send_signal(signal.SIGINT)
+        try:
+            server.wait(timeout=10)
+        except subprocess.TimeoutExpired:
+            server.kill()
+            server.wait()
+        log.close()
+
+    requests = load["requests"]
+    errors = sum(load["errors"].values())
+    return {
+        "file": path,
+        "keep_alive": keep_alive,
+        "connections": conns,
+        "rate": rate * args.rate_scale,
+        "requests": requests,
+        "requests_per_second": load["requests_per_second"],
+        "mb_per_second": round(load["bytes"] / load["elapsed"] / (1 << 20), 2),
+        "error_ratio": round(errors / max(requests + errors, 1), 5),
+        # 开环测试时从计划发送的时刻算起，闭环测试时就是服务时间
+        "latency_ms": {k: load["latency_ms"][k] for k in ("mean", "p50", "p90", "p99", "p99.9", "max")},
+        "cpu_us_per_request": round(cpu * 1e6 / max(requests, 1), 2),
+        "rss_kb": rss,
+        "peak_rss_kb": hwm,
+    }
+
+
+def median_result(runs):
+    """每项指标取几次重复的中位数"""
+    def median(values):
+        values = sorted(values)
+        return values[len(values) // 2]
+    merged = dict(runs[0])
+    for key, value in runs[0].items():
+        if isinstance(value, dict):
+            merged[key] = {k: median([r[key][k] for r in runs]) for k in value}
+        elif isinstance(value, (int, float)) and not isinstance(value, bool):
+            merged[key] = median([r[key] for r in runs])
+    merged["repetitions"] = len(runs)
+    return merged
+
+
+def compare(results, baseline, tolerance):
+    """返回回归的描述列表"""
+    failures = []
+    for name, cur in results.items():
+        base = baseline.get("scenarios", {}).get(name)
+        if not base:
+            print(f"  {name}: no baseline")
+            continue
+        checks = []
+        floor = base["requests_per_second"] * (1 - tolerance["requests_per_second"])
+        checks.append(("requests_per_second", cur["requests_per_second"] < floor,
+                       f"{cur['requests_per_second']:.0f} < {floor:.0f}"))
+        for p in ("p50", "p99"):
+            b, c = base["latency_ms"][p], cur["latency_ms"][p]
+            limit = max(b * (1 + tolerance["latency"]), b + tolerance["latency_floor_ms"])
+            checks.append((f"latency {p}", c > limit, f"{c:.3f} ms > {limit:.3f} ms"))
+        limit = base["cpu_us_per_request"] * (1 + tolerance["cpu_us_per_request"])
+        checks.append(("cpu_us_per_request", cur["cpu_us_per_request"] > limit,
+                       f"{cur['cpu_us_per_request']:.2f} > {limit:.2f}"))
+        limit = base["peak_rss_kb"] * (1 + tolerance["rss_kb"])
+        checks.append(("peak_rss_kb", cur["peak_rss_kb"] > limit, f"{cur['peak_rss_kb']} > {limit:.0f}"))
+        limit = base["error_ratio"] + tolerance["error_ratio"]
+        checks.append(("error_ratio", cur["error_ratio"] > limit, f"{cur['error_ratio']:.4f} > {limit:.4f}"))
+        bad = [f"{metric} {detail}" for metric, failed, detail in checks if failed]
+        print(f"  {name}: {'REGRESSION ' + '; '.join(bad) if bad else 'ok'}")
+        failures += [f"{name}: {b}" for b in bad]
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description="End-to-end performance regression test for WebServer")
+    parser.add_argument("--server", required=True)
+    parser.add_argument("--loadgen", required=True)
+    parser.add_argument("--baseline", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "baseline.json"))
+    parser.add_argument("--out", default="perf.json")
+    parser.add_argument("--work", default="perf_work", help="directory for the doc_root fixture and logs")
+    parser.add_argument("--update-baseline", action="store_true", help="store the results as the new baseline")
+    parser.add_argument("--duration", type=int, default=5, help="seconds per scenario")
+    parser.add_argument("--repetitions", type=int, default=3, help="runs per scenario, the median is kept")
+    parser.add_argument("--warmup", type=int, default=1, help="seconds of unrecorded load before each scenario")
+    parser.add_argument("--threads", type=int, default=min(os.cpu_count() or 1, 4), help="loadgen threads")
+    parser.add_argument("--rate-scale", type=float, default=1.0,
+                        help="multiply the request rates of the open loop (10k connection) scenarios")
+    parser.add_argument("--server-args", default="", help="extra WebServer options, e.g. '-a 1 -t 8'")
+    parser.add_argument("--filter", default="", help="only run scenarios whose name contains this")
+    args = parser.parse_args()
+
+    #没有基线时压测的结果无从比较，不必花几分钟跑完再报告通过
+    if not args.update_baseline and not os.path.exists(args.baseline):
+        print(f"no baseline at {args.baseline}, run with --update-baseline on this machine to create one, skipped")
+        return SKIPPED
+
+    work = os.path.abspath(args.work)
+    args.doc_root = os.path.join(work, "doc_root")
+    shutil.rmtree(work, ignore_errors=True)
+    make_doc_root(args.doc_root)
+
+    results = {}
+    for name, path, keep_alive, conns, rate in SCENARIOS:
+        if args.filter not in name:
+            continue
+        try:
+            runs = [run_scenario(args, name, path, keep_alive, conns, rate, work) for _ in range(args.repetitions)]
+        except RuntimeError as e:
+            print(e, file=sys.stderr)
+            return 2
+        r = median_result(runs)
+        results[name] = r
+        print(f"{name:24s} {r['requests_per_second']:10.0f} req/s  p50 {r['latency_ms']['p50']:8.3f} ms  "
+              f"p99 {r['latency_ms']['p99']:8.3f} ms  {r['cpu_us_per_request']:8.2f} us cpu/req  "
+              f"rss {r['peak_rss_kb']} kB  errors {r['error_ratio']:.4f}", flush=True)
+
+    report = {
+        "context": {
+            "date": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+            "host_name": platform.node(),
+            "num_cpus": os.cpu_count(),
+            "kernel": platform.release(),
+            "duration": args.duration,
+            "server_args": args.server_args,
+            "rate_scale": args.rate_scale,
+        },
+        "tolerance": DEFAULT_TOLERANCE,
+        "scenarios": results,
+    }
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2)
+    print(f"results written to {args.out}")
+
+    if args.update_baseline:
+        shutil.copyfile(args.out, args.baseline)
+        print(f"baseline updated: {args.baseline}")
+        return 0
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    if not any(name in baseline.get("scenarios", {}) for name in results):
+        print(f"none of the scenarios run is in {args.baseline}, skipped")
+        return SKIPPED
+    print(f"comparing with {args.baseline} ({baseline['context']['host_name']}, {baseline['context']['date']})")
+    tolerance = dict(DEFAULT_TOLERANCE, **baseline.get("tolerance", {}))
+    failures = compare(results, baseline, tolerance)
+    if failures:
+        print(f"{len(failures)} regressions")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,85 @@
+/*
+ * 插件示例：用C编写，只依赖PluginApi.h。静态的页面片段零拷贝输出，动态的部分拷贝输出
+ * 用法: ./WebServer -p /hello=./libHelloPlugin.so,greeting ip_address port
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "PluginApi.h"
+
+static const char page_head[] = "<html><body><h1>";
+static const char page_tail[] = "</h1></body></html>\n";
+static char greeting[64] = "hello";
+
+static int hello_init(const char *arg){
+    if(arg){
+        snprintf(greeting, sizeof(greeting), "%s", arg);
+    }
+    return 0;
+}
+
+/* 把文本转义后放进HTML页面，路径和查询串来自客户端，原样输出会造成XSS */
+static int write_escaped(ws_response *resp, const ws_server_api *api, const char *data, size_t len){
+    char buf[256];
+    size_t n = 0;
+    for(size_t i = 0; i < len; ++i){
+        const char *entity = NULL;
+        switch(data[i]){
+            case '<': entity = "&lt;"; break;
+            case '>': entity = "&gt;"; break;
+            case '&': entity = "&amp;"; break;
+            case '"': entity = "&quot;"; break;
+            case '\'': entity = "&#39;"; break;
+        }
+        size_t entity_len = entity ? strlen(entity) : 1;
+        if(n + entity_len > sizeof(buf)){
+            if(api->write(resp, buf, n) != 0){
+                return -1;
+            }
+            n = 0;
+        }
+        if(entity){
+            memcpy(buf + n, entity, entity_len);
+        }else{
+            buf[n] = data[i];
+        }
+        n += entity_len;
+    }
+    return api->write(resp, buf, n);
+}
+
+static int hello_handle(const ws_request *req, ws_response *resp, const ws_server_api *api){
+    char addr[INET_ADDRSTRLEN];
+    struct in_addr in;
+    in.s_addr = req->remote_addr;
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+
+    char body[128];
+    int len = snprintf(body, sizeof(body), ", %s:%u! path=", addr, req->remote_port);
+    if(len < 0 || len >= (int)sizeof(body)){
+        return -1;
+    }
+    api->add_header(resp, "Content-Type", "text/html; charset=utf-8");
+    api->write_ref(resp, page_head, sizeof(page_head) - 1);
+    if(write_escaped(resp, api, greeting, strlen(greeting)) != 0 || api->write(resp, body, len) != 0
+       || write_escaped(resp, api, req->path.data, req->path.len) != 0
+       || api->write(resp, " query=", 7) != 0
+       || write_escaped(resp, api, req->query.data, req->query.len) != 0){
+        return -1;
+    }
+    api->write_ref(resp, page_tail, sizeof(page_tail) - 1);
+    return 0;
+}
+
+static const ws_plugin hello_plugin = {
+    WS_PLUGIN_ABI_VERSION,
+    "hello",
+    hello_init,
+    hello_handle,
+    NULL,
+};
+
+const ws_plugin *ws_plugin_entry(void){
+    return &hello_plugin;
+}
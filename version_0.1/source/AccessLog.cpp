@@ -0,0 +1,249 @@
+//
+// 访问日志
+//
+
+#include "AccessLog.h"
+#include "Metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <limits.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+
+const char *AccessLog::m_file = nullptr;
+int AccessLog::m_fd = -1;
+pthread_t AccessLog::m_thread;
+std::atomic<bool> AccessLog::m_running(false);
+std::atomic<bool> AccessLog::m_reopen(false);
+std::atomic<AccessLog::Ring *> AccessLog::m_rings[AccessLog::MAX_RINGS];
+std::atomic<int> AccessLog::m_ring_number(0);
+
+//与HttpConnection::METHOD的顺序相同
+static const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+
+static int open_log(const char *file){
+    int fd = open(file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0){
+        printf("failed to open access log %s: %s\n", file, strerror(errno));
+    }
+    return fd;
+}
+
+bool AccessLog::init(const char *file) {
+    int fd = open_log(file);
+    if(fd < 0){
+        return false;
+    }
+    close(fd);
+    m_file = file;
+    return true;
+}
+
+bool AccessLog::start() {
+    if(!m_file || m_running.load()){
+        return true;
+    }
+    m_fd = open_log(m_file);
+    if(m_fd < 0){
+        return false;
+    }
+    m_running.store(true);
+    if(pthread_create(&m_thread, NULL, flusher, NULL) != 0){
+        m_running.store(false);
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void AccessLog::stop() {
+    if(!m_running.exchange(false)){
+        return;
+    }
+    pthread_join(m_thread, NULL);
+    //后台线程已经退出，把最后一批记录写完
+    flush();
+    close(m_fd);
+    m_fd = -1;
+}
+
+AccessLog::Ring *AccessLog::ring() {
+    static thread_local Ring *t_ring = nullptr;
+    static thread_local bool t_full = false;
+    if(!t_ring && !t_full){
+        int idx = m_ring_number.fetch_add(1);
+        if(idx >= MAX_RINGS){
+            t_full = true;
+            return nullptr;
+        }
+        t_ring = new Ring;
+        t_ring->head.store(0);
+        t_ring->tail.store(0);
+        m_rings[idx].store(t_ring, std::memory_order_release);
+    }
+    return t_ring;
+}
+
+void AccessLog::append(const AccessRecord &record) {
+    Ring *r = ring();
+    if(!r){
+        Metrics::inc(M_LOG_DROPPED);
+        return;
+    }
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    if(head - r->tail.load(std::memory_order_acquire) >= RING_SIZE){
+        //后台线程跟不上(通常是磁盘慢)，丢弃这条记录
+        Metrics::inc(M_LOG_DROPPED);
+        return;
+    }
+    r->records[head % RING_SIZE] = record;
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+//URL来自客户端，按Apache的方式转义双引号、反斜杠和不可打印的字节，日志行不会被伪造或截断
+static int escape_url(char *out, const char *url, size_t len){
+    static const char hex[] = "0123456789abcdef";
+    int n = 0;
+    for(size_t i = 0; i < len; ++i){
+        unsigned char c = (unsigned char)url[i];
+        if(c == '"' || c == '\\'){
+            out[n++] = '\\';
+            out[n++] = c;
+        }else if(c < 0x20 || c >= 0x7f){
+            out[n++] = '\\';
+            out[n++] = 'x';
+            out[n++] = hex[c >> 4];
+            out[n++] = hex[c & 0xf];
+        }else{
+            out[n++] = c;
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+//把一条记录格式化到out中
+static void format(std::string &out, const AccessRecord &r){
+    //同一秒内的记录共用格式化好的时间，只有后台线程调用
+    static int64_t cached_time = -1;
+    static char cached_date[40];
+    if(r.time != cached_time){
+        time_t t = (time_t)r.time;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(cached_date, sizeof(cached_date), "%d/%b/%Y:%H:%M:%S %z", &tm);
+        cached_time = r.time;
+    }
+    char ip[INET_ADDRSTRLEN];
+    struct in_addr addr;
+    addr.s_addr = r.addr;
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    const char *method = r.method < sizeof(method_names) / sizeof(method_names[0]) ? method_names[r.method] : "-";
+    //请求行：没有解析出URL时为"-"，没有版本时省略版本
+    char request[sizeof(r.url) * 4 + 32];
+    if(r.url[0]){
+        int n = snprintf(request, sizeof(request), "%s ", method);
+        n += escape_url(request + n, r.url, strnlen(r.url, sizeof(r.url)));
+        if(r.version){
+            snprintf(request + n, sizeof(request) - n, " HTTP/%u.%u", r.version / 10, r.version % 10);
+        }
+    }else{
+        strcpy(request, "-");
+    }
+    char line[sizeof(request) + 128];
+    int len = snprintf(line, sizeof(line), "%s - - [%s] \"%s\" %u %u %u\n", ip, cached_date, request,
+                       r.status, r.bytes, r.duration_us);
+    if(len > 0){
+        out.append(line, len < (int)sizeof(line) ? len : (int)sizeof(line) - 1);
+    }
+}
+
+int AccessLog::flush() {
+    //每个环的记录格式化成一段，一次writev写出
+    std::vector<std::string> chunks;
+    int ring_number = m_ring_number.load();
+    if(ring_number > MAX_RINGS){
+        ring_number = MAX_RINGS;
+    }
+    int written = 0;
+    for(int i = 0; i < ring_number; ++i){
+        Ring *r = m_rings[i].load(std::memory_order_acquire);
+        if(!r){
+            continue;
+        }
+        uint64_t tail = r->tail.load(std::memory_order_relaxed);
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        if(head == tail){
+            continue;
+        }
+        chunks.push_back(std::string());
+        std::string &chunk = chunks.back();
+        chunk.reserve((head - tail) * 96);
+        for(uint64_t seq = tail; seq < head; ++seq){
+            format(chunk, r->records[seq % RING_SIZE]);
+        }
+        //记录都已经拷贝出来，槽可以交还给工作线程
+        r->tail.store(head, std::memory_order_release);
+        written += head - tail;
+    }
+    if(chunks.empty()){
+        return 0;
+    }
+
+    struct iovec iv[MAX_RINGS];
+    for(size_t i = 0; i < chunks.size(); ++i){
+        iv[i].iov_base = (void *)chunks[i].data();
+        iv[i].iov_len = chunks[i].size();
+    }
+    int count = (int)chunks.size();
+    struct iovec *cur = iv;
+    while(count > 0){
+        ssize_t ret = writev(m_fd, cur, count);
+        if(ret < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            //磁盘满之类的错误，没写出的记录算作丢弃
+            printf("failed to write access log: %s\n", strerror(errno));
+            Metrics::inc(M_LOG_DROPPED, written);
+            return 0;
+        }
+        while(count > 0 && (size_t)ret >= cur->iov_len){
+            ret -= cur->iov_len;
+            ++cur;
+            --count;
+        }
+        if(count > 0){
+            cur->iov_base = (char *)cur->iov_base + ret;
+            cur->iov_len -= ret;
+        }
+    }
+    return written;
+}
+
+void *AccessLog::flusher(void *arg) {
+    //信号由主线程处理，否则它们可能打断这里的写，主线程的epoll_wait却收不到EINTR
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    while(m_running.load()){
+        if(m_reopen.exchange(false)){
+            //logrotate已经把旧文件改名，之后的记录写入新文件
+            int fd = open_log(m_file);
+            if(fd >= 0){
+                dup3(fd, m_fd, O_CLOEXEC);
+                close(fd);
+            }
+        }
+        flush();
+        usleep(FLUSH_INTERVAL * 1000);
+    }
+    return NULL;
+}
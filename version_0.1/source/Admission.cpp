@@ -0,0 +1,70 @@
+//
+// 准入控制
+//
+
+#include "Admission.h"
+#include <sys/socket.h>
+
+const char Admission::RESPONSE[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                   "Content-Length: 0\r\n"
+                                   "Retry-After: 1\r\n"
+                                   "Connection: close\r\n\r\n";
+uint64_t Admission::m_target_ns = 0;
+uint64_t Admission::m_budget_bytes = 0;
+std::atomic<int64_t> Admission::m_held_bytes(0);
+std::atomic<uint64_t> Admission::m_interval_start(0);
+std::atomic<uint64_t> Admission::m_min_wait(UINT64_MAX);
+std::atomic<uint32_t> Admission::m_dequeued(0);
+std::atomic<bool> Admission::m_overloaded(false);
+std::atomic<uint64_t> Admission::m_drain_ns(0);
+
+void Admission::init(int target_ms, uint64_t budget_bytes) {
+    m_target_ns = (uint64_t)target_ms * 1000000;
+    m_budget_bytes = budget_bytes;
+    m_interval_start.store(Metrics::now_ns());
+}
+
+void Admission::dequeued(uint64_t now, uint64_t wait) {
+    if(!m_target_ns){
+        return;
+    }
+    m_dequeued.fetch_add(1, std::memory_order_relaxed);
+    uint64_t min = m_min_wait.load(std::memory_order_relaxed);
+    while(wait < min && !m_min_wait.compare_exchange_weak(min, wait, std::memory_order_relaxed)){
+    }
+    //间隔结束后第一个出队的线程负责计算这个间隔的结果，各线程的now可能略有先后，不能直接相减
+    uint64_t start = m_interval_start.load(std::memory_order_relaxed);
+    if(now < start + INTERVAL || !m_interval_start.compare_exchange_strong(start, now)){
+        return;
+    }
+    uint64_t min_wait = m_min_wait.exchange(UINT64_MAX, std::memory_order_relaxed);
+    uint32_t number = m_dequeued.exchange(0, std::memory_order_relaxed);
+    m_overloaded.store(min_wait > m_target_ns, std::memory_order_relaxed);
+    m_drain_ns.store((now - start) / (number ? number : 1), std::memory_order_relaxed);
+}
+
+bool Admission::admit(int queued, int bytes, METRIC_COUNTER &reason) {
+    if(m_budget_bytes && m_held_bytes.load(std::memory_order_relaxed) + bytes > (int64_t)m_budget_bytes){
+        reason = M_SHED_BYTES;
+        return false;
+    }
+    //没有过载时队列偶尔变长也不拒绝，和CoDel一样只在最短排队时间持续超过目标值时才丢弃
+    if(!m_target_ns || queued == 0 || !m_overloaded.load(std::memory_order_relaxed)){
+        return true;
+    }
+    uint64_t wait = (uint64_t)queued * m_drain_ns.load(std::memory_order_relaxed);
+    if(wait > 2 * m_target_ns){
+        reason = M_SHED_DELAY;
+        return false;
+    }
+    return true;
+}
+
+void Admission::reject(int fd) {
+    //最多读16次，客户端持续发送时不能让主线程一直读下去
+    char buf[4096];
+    for(int i = 0; i < 16 && recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0; ++i){
+    }
+    send(fd, RESPONSE, sizeof(RESPONSE) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    Metrics::status(503);
+}
@@ -0,0 +1,210 @@
+//
+// 请求捕获
+//
+
+#include "Capture.h"
+#include "Metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/uio.h>
+
+static_assert(sizeof(capture_record) == 24, "capture_record is part of the file format");
+
+const char *Capture::m_file = nullptr;
+int Capture::m_fd = -1;
+uint64_t Capture::m_max_bytes = 0;
+std::atomic<uint64_t> Capture::m_bytes(0);
+std::atomic<bool> Capture::m_full(false);
+std::atomic<uint32_t> Capture::m_next_conn(0);
+pthread_t Capture::m_thread;
+std::atomic<bool> Capture::m_running(false);
+std::atomic<Capture::Buffer *> Capture::m_buffers[Capture::MAX_BUFFERS];
+std::atomic<int> Capture::m_buffer_number(0);
+
+bool Capture::init(const char *file, uint64_t max_bytes) {
+    //捕获的是请求原文，只允许自己读
+    int fd = ::open(file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0){
+        printf("failed to open capture file %s: %s\n", file, strerror(errno));
+        return false;
+    }
+    capture_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(capture_record);
+    bool ok = ::write(fd, &header, sizeof(header)) == sizeof(header);
+    ::close(fd);
+    if(!ok){
+        printf("failed to write capture file %s\n", file);
+        return false;
+    }
+    m_file = file;
+    m_max_bytes = max_bytes;
+    return true;
+}
+
+bool Capture::start() {
+    if(!m_file || m_running.load()){
+        return true;
+    }
+    m_fd = ::open(m_file, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if(m_fd < 0){
+        printf("failed to open capture file %s: %s\n", m_file, strerror(errno));
+        return false;
+    }
+    m_running.store(true);
+    if(pthread_create(&m_thread, NULL, flusher, NULL) != 0){
+        m_running.store(false);
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void Capture::stop() {
+    if(!m_running.exchange(false)){
+        return;
+    }
+    pthread_join(m_thread, NULL);
+    //后台线程已经退出，把最后一批记录写完
+    flush();
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+uint64_t Capture::open(uint64_t now) {
+    uint64_t conn = ((uint64_t)getpid() << 32) | m_next_conn.fetch_add(1, std::memory_order_relaxed);
+    append(conn, now, CAPTURE_OPEN, nullptr, 0);
+    return conn;
+}
+
+void Capture::data(uint64_t conn, uint64_t now, const char *buf, size_t len) {
+    append(conn, now, CAPTURE_DATA, buf, len);
+}
+
+void Capture::close(uint64_t conn, uint64_t now) {
+    append(conn, now, CAPTURE_CLOSE, nullptr, 0);
+}
+
+Capture::Buffer *Capture::buffer() {
+    static thread_local Buffer *t_buffer = nullptr;
+    static thread_local bool t_full = false;
+    if(!t_buffer && !t_full){
+        int idx = m_buffer_number.fetch_add(1);
+        if(idx >= MAX_BUFFERS){
+            t_full = true;
+            return nullptr;
+        }
+        t_buffer = new Buffer;
+        t_buffer->data.reserve(BUFFER_BYTES);
+        t_buffer->spare.reserve(BUFFER_BYTES);
+        m_buffers[idx].store(t_buffer, std::memory_order_release);
+    }
+    return t_buffer;
+}
+
+void Capture::append(uint64_t conn, uint64_t now, uint16_t event, const char *buf, size_t len) {
+    if(!enabled()){
+        return;
+    }
+    uint64_t size = sizeof(capture_record) + len;
+    //多进程时各进程分别计数，上限按每个进程计算
+    if(m_bytes.fetch_add(size, std::memory_order_relaxed) + size > m_max_bytes){
+        if(!m_full.exchange(true)){
+            printf("capture: %s reached the size limit, capture stopped\n", m_file);
+        }
+        return;
+    }
+    Buffer *b = buffer();
+    if(!b){
+        Metrics::inc(M_CAPTURE_DROPPED);
+        return;
+    }
+    capture_record record;
+    memset(&record, 0, sizeof(record));
+    record.time = now;
+    record.conn = conn;
+    record.length = (uint32_t)len;
+    record.event = event;
+
+    b->lock.lock();
+    if(b->data.size() + size > BUFFER_BYTES){
+        //后台线程跟不上(通常是磁盘慢)，丢弃这条记录，不在请求路径上扩大缓冲区
+        b->lock.unlock();
+        Metrics::inc(M_CAPTURE_DROPPED);
+        return;
+    }
+    b->data.append((const char *)&record, sizeof(record));
+    if(len){
+        b->data.append(buf, len);
+    }
+    b->lock.unlock();
+}
+
+void Capture::flush() {
+    int buffer_number = m_buffer_number.load();
+    if(buffer_number > MAX_BUFFERS){
+        buffer_number = MAX_BUFFERS;
+    }
+    //换出每个线程的缓冲区，换出的记录在spare中，写完之后清空留给下一次
+    struct iovec iv[MAX_BUFFERS];
+    Buffer *taken[MAX_BUFFERS];
+    int count = 0;
+    for(int i = 0; i < buffer_number; ++i){
+        Buffer *b = m_buffers[i].load(std::memory_order_acquire);
+        if(!b){
+            continue;
+        }
+        b->lock.lock();
+        b->data.swap(b->spare);
+        b->lock.unlock();
+        if(b->spare.empty()){
+            continue;
+        }
+        iv[count].iov_base = (void *)b->spare.data();
+        iv[count].iov_len = b->spare.size();
+        taken[count++] = b;
+    }
+
+    int left = count;
+    struct iovec *cur = iv;
+    while(left > 0){
+        ssize_t ret = writev(m_fd, cur, left);
+        if(ret < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            printf("failed to write capture file %s: %s\n", m_file, strerror(errno));
+            break;
+        }
+        while(left > 0 && (size_t)ret >= cur->iov_len){
+            ret -= cur->iov_len;
+            ++cur;
+            --left;
+        }
+        if(left > 0){
+            cur->iov_base = (char *)cur->iov_base + ret;
+            cur->iov_len -= ret;
+        }
+    }
+    for(int i = 0; i < count; ++i){
+        taken[i]->spare.clear();
+    }
+}
+
+void *Capture::flusher(void *arg) {
+    //信号由主线程处理
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    while(m_running.load()){
+        flush();
+        usleep(FLUSH_INTERVAL * 1000);
+    }
+    return NULL;
+}
@@ -0,0 +1,197 @@
+//
+// FastCGI上游
+//
+
+#include "FastCgi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+FcgiBackend FastCgi::m_backends[FastCgi::MAX_BACKEND_NUMBER];
+int FastCgi::m_backend_number = 0;
+
+FcgiBackend::FcgiBackend() : m_prefix_len(0), m_addr_len(0), m_max_conns(DEFAULT_MAX_CONNS), m_active(0) {
+    m_prefix[0] = '\0';
+    m_address[0] = '\0';
+}
+
+FcgiBackend::~FcgiBackend() {
+    for(size_t i = 0; i < m_idle.size(); ++i){
+        close(m_idle[i]);
+    }
+}
+
+bool FcgiBackend::parse(const char *spec) {
+    const char *eq = strchr(spec, '=');
+    if(!eq || spec[0] != '/' || (size_t)(eq - spec) >= sizeof(m_prefix)){
+        return false;
+    }
+    m_prefix_len = eq - spec;
+    memcpy(m_prefix, spec, m_prefix_len);
+    m_prefix[m_prefix_len] = '\0';
+
+    snprintf(m_address, sizeof(m_address), "%s", eq + 1);
+    char *comma = strchr(m_address, ',');
+    if(comma){
+        *comma = '\0';
+        m_max_conns = atoi(comma + 1);
+        if(m_max_conns <= 0){
+            return false;
+        }
+    }
+
+    memset(&m_addr, 0, sizeof(m_addr));
+    if(strncmp(m_address, "unix:", 5) == 0){
+        sockaddr_un *addr = (sockaddr_un *)&m_addr;
+        if(strlen(m_address + 5) >= sizeof(addr->sun_path)){
+            return false;
+        }
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, m_address + 5);
+        m_addr_len = sizeof(sockaddr_un);
+        return true;
+    }
+    char ip[64];
+    const char *colon = strrchr(m_address, ':');
+    if(!colon || (size_t)(colon - m_address) >= sizeof(ip)){
+        return false;
+    }
+    memcpy(ip, m_address, colon - m_address);
+    ip[colon - m_address] = '\0';
+    sockaddr_in *addr = (sockaddr_in *)&m_addr;
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(atoi(colon + 1));
+    if(inet_pton(AF_INET, ip, &addr->sin_addr) != 1){
+        return false;
+    }
+    m_addr_len = sizeof(sockaddr_in);
+    return true;
+}
+
+bool FcgiBackend::match(const char *url) const {
+    return strncmp(url, m_prefix, m_prefix_len) == 0;
+}
+
+int FcgiBackend::acquire(bool &reused) {
+    m_lock.lock();
+    if(m_active >= m_max_conns){
+        m_lock.unlock();
+        return -1;
+    }
+    m_active++;
+    if(!m_idle.empty()){
+        int fd = m_idle.back();
+        m_idle.pop_back();
+        m_lock.unlock();
+        reused = true;
+        return fd;
+    }
+    m_lock.unlock();
+
+    //连接在锁外建立，m_active已经为它占了一个名额
+    reused = false;
+    int fd = connect_backend();
+    if(fd < 0){
+        m_lock.lock();
+        m_active--;
+        m_lock.unlock();
+        return -2;
+    }
+    return fd;
+}
+
+void FcgiBackend::release(int fd, bool keep) {
+    m_lock.lock();
+    m_active--;
+    if(keep){
+        m_idle.push_back(fd);
+        fd = -1;
+    }
+    m_lock.unlock();
+    if(fd >= 0){
+        close(fd);
+    }
+}
+
+//与后端的连接使用阻塞socket加收发超时，由处理请求的工作线程同步读写
+int FcgiBackend::connect_backend() {
+    int fd = socket(m_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        return -1;
+    }
+    struct timeval timeout = {IO_TIMEOUT, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if(connect(fd, (sockaddr *)&m_addr, m_addr_len) != 0){
+        printf("failed to connect fastcgi backend %s\n", m_address);
+        close(fd);
+        return -1;
+    }
+    if(m_addr.ss_family == AF_INET){
+        //请求由几条小记录组成，不能让Nagle算法把它们攒在一起
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+    return fd;
+}
+
+bool FastCgi::add_backend(const char *spec) {
+    if(m_backend_number >= MAX_BACKEND_NUMBER || !m_backends[m_backend_number].parse(spec)){
+        return false;
+    }
+    m_backend_number++;
+    return true;
+}
+
+FcgiBackend *FastCgi::match(const char *url) {
+    for(int i = 0; i < m_backend_number; ++i){
+        if(m_backends[i].match(url)){
+            return &m_backends[i];
+        }
+    }
+    return nullptr;
+}
+
+void FastCgi::write_header(FcgiHeader &header, int type, int content_length) {
+    header.version = FCGI_VERSION_1;
+    header.type = type;
+    //每个连接上同时只有一个请求，请求ID固定为1
+    header.request_id = htons(1);
+    header.content_length = htons(content_length);
+    header.padding_length = 0;
+    header.reserved = 0;
+}
+
+//名字和值的长度小于128时用1个字节表示，否则用最高位置1的4个字节表示
+static int encode_length(unsigned char *p, size_t len){
+    if(len < 128){
+        p[0] = len;
+        return 1;
+    }
+    p[0] = (len >> 24) | 0x80;
+    p[1] = len >> 16;
+    p[2] = len >> 8;
+    p[3] = len;
+    return 4;
+}
+
+bool FastCgi::add_param(char *buf, int &len, int cap, const char *name, const char *value) {
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+    if(len + 8 + name_len + value_len > (size_t)cap){
+        return false;
+    }
+    len += encode_length((unsigned char *)buf + len, name_len);
+    len += encode_length((unsigned char *)buf + len, value_len);
+    memcpy(buf + len, name, name_len);
+    len += name_len;
+    memcpy(buf + len, value, value_len);
+    len += value_len;
+    return true;
+}
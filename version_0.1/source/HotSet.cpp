@@ -0,0 +1,131 @@
+//
+// 热点文件集合
+//
+
+#include "HotSet.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+
+HotSet::Slot HotSet::m_slots[HotSet::SLOT_NUMBER];
+
+//FNV-1a哈希，结果为0时换成1，0留给空槽
+static uint64_t hash_path(const char *path){
+    uint64_t hash = 14695981039346656037ULL;
+    for(; *path; ++path){
+        hash ^= (unsigned char)*path;
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+void HotSet::record(const char *url) {
+    size_t len = strlen(url);
+    if(len >= PATH_LEN){
+        return;
+    }
+    uint64_t hash = hash_path(url);
+    for(int i = 0; i < MAX_PROBE; ++i){
+        Slot &slot = m_slots[(hash + i) % SLOT_NUMBER];
+        uint64_t cur = slot.hash.load(std::memory_order_acquire);
+        if(cur == 0){
+            //抢占空槽，只有CAS成功的线程写入路径
+            if(slot.hash.compare_exchange_strong(cur, hash)){
+                memcpy(slot.path, url, len + 1);
+                slot.ready.store(true, std::memory_order_release);
+                slot.count.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        if(cur == hash){
+            slot.count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+bool HotSet::save(const char *file) {
+    std::vector<std::pair<uint32_t, int> > hot;
+    for(int i = 0; i < SLOT_NUMBER; ++i){
+        Slot &slot = m_slots[i];
+        if(!slot.ready.load(std::memory_order_acquire)){
+            continue;
+        }
+        //计数减半，长时间没有访问的路径会逐渐降到0
+        uint32_t count = slot.count.load(std::memory_order_relaxed);
+        slot.count.fetch_sub(count - count / 2, std::memory_order_relaxed);
+        if(count > 0){
+            hot.push_back(std::make_pair(count, i));
+        }
+    }
+    std::sort(hot.begin(), hot.end(), [](const std::pair<uint32_t, int> &a, const std::pair<uint32_t, int> &b){
+        return a.first > b.first;
+    });
+
+    //每行"访问次数 路径"，按访问次数从大到小排列
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+    FILE *fp = fopen(tmp, "w");
+    if(!fp){
+        return false;
+    }
+    for(size_t i = 0; i < hot.size() && i < (size_t)MAX_SAVED; ++i){
+        fprintf(fp, "%u %s\n", hot[i].first, m_slots[hot[i].second].path);
+    }
+    if(fclose(fp) != 0 || rename(tmp, file) != 0){
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+void HotSet::warmup(const char *file, const char *doc_root, size_t budget) {
+    FILE *fp = fopen(file, "r");
+    if(!fp){
+        return;
+    }
+    int files = 0;
+    int locked = 0;
+    size_t used = 0;
+    unsigned count = 0;
+    char path[PATH_LEN];
+    char real_file[PATH_LEN * 2];
+    while(fscanf(fp, "%u %199s", &count, path) == 2){
+        //与do_request一致，只预读根目录下的路径
+        if(path[0] != '/' || strstr(path, "..")){
+            continue;
+        }
+        snprintf(real_file, sizeof(real_file), "%s%s", doc_root, path);
+        int fd = open(real_file, O_RDONLY);
+        if(fd < 0){
+            continue;
+        }
+        struct stat file_stat;
+        if(fstat(fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size == 0){
+            close(fd);
+            continue;
+        }
+        size_t size = file_stat.st_size;
+        //超出预算的文件只发起预读，不占用锁定内存
+        readahead(fd, 0, size);
+        if(used + size <= budget){
+            //映射一直保留到进程退出，把这些页面锁在内存中
+            void *address = mmap(0, size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+            if(address != MAP_FAILED){
+                used += size;
+                if(mlock(address, size) == 0){
+                    locked++;
+                }
+            }
+        }
+        close(fd);
+        files++;
+    }
+    fclose(fp);
+    printf("warmup: %d files from %s, %zu bytes populated, %d locked\n", files, file, used, locked);
+}
@@ -4,6 +4,11 @@
 //
 
 #include "HttpConnection.h"
+#include "HotSet.h"
+#include "StatCache.h"
+#include <ctype.h>
+#include <poll.h>
+#include <netinet/tcp.h>
 
 /* 定义HTTP响应的一些状态信息 */
 const char *ok_200_title = "OK";
@@ -15,6 +20,10 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the requested file.\n";
+const char *error_502_title = "Bad Gateway";
+const char *error_502_form = "The upstream server returned an invalid response.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The upstream server is busy, please try again later.\n";
 
 /* 网站的根目录 */
 const char *doc_root = "/root/xv6/WebServer";
@@ -42,23 +51,76 @@ void delFd(int epoll_fd, int fd){
     close(fd);
 }
 
-void modFd(int epoll_fd, int fd, int ev){
+void modFd(int epoll_fd, int fd, int ev, bool one_shot){
     epoll_event event;
     event.data.fd = fd;
-    event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    event.events = ev | EPOLLET | EPOLLRDHUP;
+    if(one_shot){
+        event.events |= EPOLLONESHOT;
+    }
     epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int HttpConnection::m_user_count = 0;
+std::atomic<int> HttpConnection::m_user_count(0);
 int HttpConnection::m_epoll_fd = -1;
+std::atomic<long> HttpConnection::m_total_epoll_ctl(0);
+std::atomic<long> HttpConnection::m_total_epoll_ctl_skipped(0);
+std::atomic<long> HttpConnection::m_total_requests(0);
+std::atomic<bool> HttpConnection::m_draining(false);
+int HttpConnection::m_read_buffer_size = HttpConnection::READ_BUFFER_SIZE;
+int HttpConnection::m_write_buffer_size = HttpConnection::WRITE_BUFFER_SIZE;
 
 void HttpConnection::close_conn(bool real_close) {
     if(real_close && (m_sock_fd != -1)){
-        delFd(m_epoll_fd, m_sock_fd);
+        //先把m_sock_fd置为-1再关闭socket，close之后这个文件描述符可能马上被主线程accept复用
+        int sock_fd = m_sock_fd;
         m_sock_fd = -1;
         //关闭一个连接时，将客户数量减1
         m_user_count--;
+        Metrics::inc(M_CLOSED);
+        m_total_epoll_ctl += m_epoll_ctl_count + 1;
+        m_total_epoll_ctl_skipped += m_epoll_ctl_skipped;
+        m_total_requests += m_request_count;
+        m_tls.reset();
+        //捕获记录必须在关闭socket之前结束，关闭之后主线程可能马上在这个对象上init()新的连接并分配新的编号
+        if(m_capture_id){
+            Capture::close(m_capture_id, Metrics::now_ns());
+            m_capture_id = 0;
+        }
+        //同样要在关闭socket之前归还准入控制的预算
+        hold_bytes(0);
+        delFd(m_epoll_fd, sock_fd);
+    }
+}
+
+void HttpConnection::shed() {
+    //应答发送到一半或者HTTPS连接上不能直接写入明文的503，只关闭连接
+    if(m_bytes_to_send == 0 && !m_tls.active()){
+        Admission::reject(m_sock_fd);
+    }
+    close_conn();
+}
+
+void HttpConnection::print_epoll_stats() {
+    long requests = m_total_requests.load();
+    long ctl = m_total_epoll_ctl.load();
+    printf("requests: %ld, epoll_ctl: %ld (%.2f per request), skipped: %ld\n",
+           requests, ctl, requests ? (double)ctl / requests : 0.0, m_total_epoll_ctl_skipped.load());
+}
+
+void HttpConnection::mod_event(int ev) {
+    if(!config.one_shot){
+        //非ONESHOT模式下始终关注读事件，只有与已注册的事件不同时才需要epoll_ctl
+        ev |= EPOLLIN;
+        if(ev == m_ev_mask){
+            ++m_epoll_ctl_skipped;
+            return;
+        }
     }
+    //ONESHOT模式下每次都必须重新注册，否则socket上的事件不会再被触发
+    modFd(m_epoll_fd, m_sock_fd, ev, config.one_shot);
+    m_ev_mask = ev;
+    ++m_epoll_ctl_count;
 }
 
 void HttpConnection::init(int sock_fd, const sockaddr_in &addr){
@@ -67,8 +129,19 @@ void HttpConnection::init(int sock_fd, const sockaddr_in &addr){
     //如下面两行是为了避免TIME_WAIT状态，仅用于调试，实际使用时应该去掉
     int reuse = 1;
     setsockopt(m_sock_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    addFd(m_epoll_fd, sock_fd, true);
-    m_user_count--;
+    addFd(m_epoll_fd, sock_fd, config.one_shot);
+    m_user_count++;
+    Metrics::inc(M_ACCEPTED);
+    m_sched.store(0);
+    m_ev_mask = EPOLLIN;
+    m_epoll_ctl_count = 0;
+    m_epoll_ctl_skipped = 0;
+    m_request_count = 0;
+    m_capture_id = Capture::enabled() ? Capture::open(Metrics::now_ns()) : 0;
+    //监听socket上的所有连接都是HTTPS连接，握手在第一次read()时开始
+    if(TlsContext::enabled()){
+        m_tls.attach(sock_fd);
+    }
 
     init();
 }
@@ -76,20 +149,79 @@ void HttpConnection::init(int sock_fd, const sockaddr_in &addr){
 void HttpConnection::init() {
     m_checked_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
+    m_accept_gzip = false;
+    m_bundle_entry = nullptr;
 
     m_method = GET;
     m_url = nullptr;
     m_version = nullptr;
     m_content_length = 0;
     m_host = nullptr;
+    m_content_type = nullptr;
+    m_content = nullptr;
+    m_fcgi_backend = nullptr;
+    m_plugin = nullptr;
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
+    m_bytes_to_send = 0;
+    m_bytes_have_send = 0;
+    m_file_address = nullptr;
 
-    memset(m_read_buf, 0, READ_BUFFER_SIZE);
-    memset(m_write_buf, 0, WRITE_BUFFER_SIZE);
+    memset(m_read_buf, 0, m_read_buffer_size);
+    memset(m_write_buf, 0, m_write_buffer_size);
     memset(m_real_file, 0, FILENAME_LEN);
+
+    m_status = 0;
+    m_response_bytes = 0;
+    m_request_start = 0;
+
+    //新的请求从这里开始计时：新连接从accept开始，保持的连接从上一个应答发送完开始
+    m_tracing = Trace::sample();
+    if(m_tracing){
+        memset(&m_trace, 0, sizeof(m_trace));
+        Trace::mark(m_trace, T_START, Metrics::now_ns());
+    }
+}
+
+void HttpConnection::request_done() {
+    if(m_status){
+        Metrics::status(m_status);
+    }
+    if(AccessLog::enabled()){
+        AccessRecord record;
+        memset(&record, 0, sizeof(record));
+        record.time = time(nullptr);
+        if(m_request_start){
+            record.duration_us = (Metrics::now_ns() - m_request_start) / 1000;
+        }
+        record.addr = m_address.sin_addr.s_addr;
+        record.port = m_address.sin_port;
+        record.status = m_status;
+        record.method = m_method;
+        //解析失败的请求也记下客户端实际发来的版本
+        if(m_version && strncasecmp(m_version, "HTTP/", 5) == 0 && isdigit((unsigned char)m_version[5])
+           && m_version[6] == '.' && isdigit((unsigned char)m_version[7]) && m_version[8] == '\0'){
+            record.version = (m_version[5] - '0') * 10 + (m_version[7] - '0');
+        }
+        record.bytes = m_response_bytes;
+        if(m_url){
+            strncpy(record.url, m_url, sizeof(record.url));
+        }
+        AccessLog::append(record);
+    }
+    if(!m_tracing){
+        return;
+    }
+    trace(T_SENT);
+    m_trace.status = m_status;
+    m_trace.bytes = m_response_bytes;
+    if(m_url){
+        strncpy(m_trace.url, m_url, sizeof(m_trace.url) - 1);
+    }
+    Trace::commit(m_trace);
+    m_tracing = false;
 }
 
 /* 从状态机 */
@@ -132,6 +264,11 @@ HttpConnection::HTTP_CODE HttpConnection::parse_request_line(char *text) {
     {
         m_method = GET;
     }
+    else if (strcasecmp(method, "POST") == 0)
+    {
+        //POST只转发给FastCGI后端，静态文件在do_request中拒绝
+        m_method = POST;
+    }
     else
     {
         return BAD_REQUEST;
@@ -165,6 +302,41 @@ HttpConnection::HTTP_CODE HttpConnection::parse_request_line(char *text) {
 }
 
 //解析HTTP请求的一个头部信息
+//Accept-Encoding的值是否接受gzip：逐项比较编码名，"gzip;q=0"表示拒绝；没有列出gzip时看"*"
+static bool accepts_gzip(const char *value) {
+    int gzip = -1, any = -1;
+    while(*value){
+        value += strspn(value, " \t,");
+        size_t len = strcspn(value, " \t;,");
+        if(len == 0){
+            break;
+        }
+        const char *name = value;
+        value += len;
+        //参数中只关心q，q=0表示不接受
+        bool accepted = true;
+        while(true){
+            value += strspn(value, " \t");
+            if(*value != ';'){
+                break;
+            }
+            ++value;
+            value += strspn(value, " \t");
+            if((value[0] == 'q' || value[0] == 'Q') && value[1] == '='){
+                accepted = strtod(value + 2, nullptr) > 0;
+            }
+            value += strcspn(value, ";,");
+        }
+        if((len == 4 && strncasecmp(name, "gzip", 4) == 0) || (len == 6 && strncasecmp(name, "x-gzip", 6) == 0)){
+            gzip = accepted;
+        }else if(len == 1 && *name == '*'){
+            any = accepted;
+        }
+        value += strcspn(value, ",");
+    }
+    return gzip >= 0 ? gzip == 1 : any == 1;
+}
+
 HttpConnection::HTTP_CODE HttpConnection::parse_headers(char *text) {
     /* 遇到空行，表示头部字段解析完毕 */
     if (text[0] == '\0')
@@ -197,6 +369,19 @@ HttpConnection::HTTP_CODE HttpConnection::parse_headers(char *text) {
         text += strspn(text, " \t");
         m_content_length = atol(text);
 
+    }
+        /* 处理Accept-Encoding头部字段，静态资源包中有gzip预压缩版本时使用 */
+    else if (strncasecmp(text, "Accept-Encoding:", 16) == 0)
+    {
+        text += 16;
+        m_accept_gzip = accepts_gzip(text);
+    }
+        /* 处理Content-Type头部字段，转发给FastCGI后端 */
+    else if (strncasecmp(text, "Content-Type:", 13) == 0)
+    {
+        text += 13;
+        text += strspn(text, " \t");
+        m_content_type = text;
     }
         /* 处理Host头部字段 */
     else if (strncasecmp(text, "Host:", 5) == 0)
@@ -205,10 +390,6 @@ HttpConnection::HTTP_CODE HttpConnection::parse_headers(char *text) {
         text += strspn(text, " \t");
         m_host = text;
     }
-    else
-    {
-        printf("oop! unkown header %s\n", text);
-    }
 
     return NO_REQUEST;
 }
@@ -218,6 +399,7 @@ HttpConnection::HTTP_CODE HttpConnection::parse_content(char *text) {
     if (m_read_idx >= (m_content_length + m_checked_idx))
     {
         text[m_content_length] = '\0';
+        m_content = text;
         return GET_REQUEST;
     }
 
@@ -228,11 +410,30 @@ HttpConnection::HTTP_CODE HttpConnection::parse_content(char *text) {
 //对所有用户可读，且不是目录，则使用mmap将其映射到m_file_address处
 //并告诉调用者获取文件成功
 HttpConnection::HTTP_CODE HttpConnection::do_request() {
+    if(config.metrics_path && strcmp(m_url, config.metrics_path) == 0){
+        return METRICS_REQUEST;
+    }
+    //匹配插件或FastCGI前缀的请求不访问文件系统
+    m_plugin = PluginHost::match(m_url);
+    if(m_plugin){
+        return PLUGIN_REQUEST;
+    }
+    m_fcgi_backend = FastCgi::match(m_url);
+    if(m_fcgi_backend){
+        return FCGI_REQUEST;
+    }
+    if(m_method != GET){
+        return BAD_REQUEST;
+    }
+    if(config.bundle_file){
+        return do_bundle_request();
+    }
+
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
     strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
     char *path = m_real_file;
-    if(stat(m_real_file, &m_file_stat) < 0){
+    if(StatCache::stat(m_real_file, &m_file_stat) < 0){
         return NO_RESOURCE;
     }
 
@@ -244,15 +445,482 @@ HttpConnection::HTTP_CODE HttpConnection::do_request() {
         return BAD_REQUEST;
     }
 
+    //缓存中的元数据最多已经过去valid_ms，文件可能在这期间被删除或者截短，只用来查找和检查权限：
+    //大小以打开后fstat的结果为准，映射超出文件末尾的部分在发送时会触发SIGBUS
     int fd = open(m_real_file, O_RDONLY);
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(fd < 0){
+        return NO_RESOURCE;
+    }
+    if(fstat(fd, &m_file_stat) < 0 || !S_ISREG(m_file_stat.st_mode)){
+        close(fd);
+        return BAD_REQUEST;
+    }
+    if(m_file_stat.st_size > 0){
+        m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(m_file_address == MAP_FAILED){
+            m_file_address = nullptr;
+            close(fd);
+            return INTERNAL_ERROR;
+        }
+    }
     close(fd);
+    if(config.hotset_file){
+        HotSet::record(m_url);
+    }
 
     return FILE_REQUEST;
 }
 
+//使用静态资源包时，请求只需要在mmap好的索引中二分查找，没有任何文件系统调用
+HttpConnection::HTTP_CODE HttpConnection::do_bundle_request() {
+    std::shared_ptr<StaticBundle> bundle = StaticBundle::current();
+    if(!bundle){
+        return INTERNAL_ERROR;
+    }
+    const BundleEntry *entry = bundle->find(m_url);
+    if(!entry){
+        return NO_RESOURCE;
+    }
+    m_bundle = bundle;
+    m_bundle_entry = entry;
+    return BUNDLE_REQUEST;
+}
+
+/* 转发FastCGI请求。工作线程同步地与后端通信，每收到一条STDOUT记录就非阻塞地发给客户端。
+ * 客户端接收得慢时，没有发出去的部分积压在m_plugin_body中，收完后端的应答之后释放后端连接，
+ * 积压的数据和普通应答一样由write()在EPOLLOUT时发送，工作线程和后端连接都不等待慢客户端 */
+HttpConnection::HTTP_CODE HttpConnection::relay_fcgi() {
+    //上一个连接可能在积压没有发完时就被关闭了
+    m_plugin_body.clear();
+    m_relay_wait_left = (int64_t)RELAY_TIMEOUT * 1000000;
+    //应答头部、各段应答体和chunked结束标记分几次发送，关闭Nagle算法，否则与客户端的延迟确认叠加，每个应答多等40ms
+    int nodelay = 1;
+    setsockopt(m_sock_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    for(int attempt = 0; attempt < 2; ++attempt){
+        bool reused = false;
+        int fcgi_fd = m_fcgi_backend->acquire(reused);
+        if(fcgi_fd == -1){
+            return SERVICE_UNAVAILABLE;
+        }else if(fcgi_fd < 0){
+            return BAD_GATEWAY;
+        }
+        bool replied = false;
+        bool keep = false;
+        HTTP_CODE ret = fcgi_exchange(fcgi_fd, replied, keep);
+        m_fcgi_backend->release(fcgi_fd, keep);
+        //复用的空闲连接可能已经被后端关闭，没有收到任何数据时换一个新连接重试一次
+        if(ret == BAD_GATEWAY && reused && !replied){
+            continue;
+        }
+        return ret;
+    }
+    return BAD_GATEWAY;
+}
+
+static bool fcgi_read_full(int fd, void *buf, int len){
+    char *p = (char *)buf;
+    while(len > 0){
+        ssize_t ret = ::read(fd, p, len);
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            return false;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+static bool fcgi_write_full(int fd, const void *buf, int len){
+    const char *p = (const char *)buf;
+    while(len > 0){
+        ssize_t ret = ::write(fd, p, len);
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            return false;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+HttpConnection::HTTP_CODE HttpConnection::fcgi_exchange(int fcgi_fd, bool &replied, bool &keep) {
+    //请求的各条记录拼在一个缓冲区中，一次write发出。请求和记录的缓冲区较大，每个线程各用一份，不占用栈
+    static const int PARAMS_SIZE = 8192;
+    static thread_local char request[PARAMS_SIZE + MAX_READ_BUFFER_SIZE + 6 * sizeof(FcgiHeader)];
+    int len = 0;
+    FcgiHeader *header = (FcgiHeader *)request;
+    FastCgi::write_header(*header, FCGI_BEGIN_REQUEST, 8);
+    unsigned char *begin = (unsigned char *)(header + 1);
+    memset(begin, 0, 8);
+    begin[1] = FCGI_RESPONDER;
+    begin[2] = FCGI_KEEP_CONN;
+    len = sizeof(FcgiHeader) + 8;
+
+    //拆分路径和查询字符串
+    char script[FILENAME_LEN];
+    const char *query = strchr(m_url, '?');
+    int script_len = query ? query - m_url : strlen(m_url);
+    if(script_len >= FILENAME_LEN){
+        return BAD_REQUEST;
+    }
+    memcpy(script, m_url, script_len);
+    script[script_len] = '\0';
+    char script_file[FILENAME_LEN * 2];
+    snprintf(script_file, sizeof(script_file), "%s%s", doc_root, script);
+    char remote_addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &m_address.sin_addr, remote_addr, sizeof(remote_addr));
+    char remote_port[8];
+    snprintf(remote_port, sizeof(remote_port), "%d", ntohs(m_address.sin_port));
+    char content_length[16];
+    snprintf(content_length, sizeof(content_length), "%d", m_content ? m_content_length : 0);
+
+    header = (FcgiHeader *)(request + len);
+    char *params = (char *)(header + 1);
+    int params_len = 0;
+    bool ok = FastCgi::add_param(params, params_len, PARAMS_SIZE, "GATEWAY_INTERFACE", "CGI/1.1")
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "SERVER_SOFTWARE", "WebServer")
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "SERVER_PROTOCOL", "HTTP/1.1")
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "REQUEST_METHOD", m_method == POST ? "POST" : "GET")
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "REQUEST_URI", m_url)
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "SCRIPT_NAME", script)
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "DOCUMENT_URI", script)
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "QUERY_STRING", query ? query + 1 : "")
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "DOCUMENT_ROOT", doc_root)
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "SCRIPT_FILENAME", script_file)
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "REMOTE_ADDR", remote_addr)
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "REMOTE_PORT", remote_port)
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "CONTENT_LENGTH", content_length)
+              && FastCgi::add_param(params, params_len, PARAMS_SIZE, "CONTENT_TYPE", m_content_type ? m_content_type : "");
+    if(ok && m_host){
+        ok = FastCgi::add_param(params, params_len, PARAMS_SIZE, "SERVER_NAME", m_host)
+             && FastCgi::add_param(params, params_len, PARAMS_SIZE, "HTTP_HOST", m_host);
+    }
+    if(ok && m_tls.active()){
+        ok = FastCgi::add_param(params, params_len, PARAMS_SIZE, "HTTPS", "on");
+    }
+    if(!ok){
+        return BAD_REQUEST;
+    }
+    FastCgi::write_header(*header, FCGI_PARAMS, params_len);
+    len += sizeof(FcgiHeader) + params_len;
+    //空的PARAMS记录表示参数结束
+    FastCgi::write_header(*(FcgiHeader *)(request + len), FCGI_PARAMS, 0);
+    len += sizeof(FcgiHeader);
+    if(m_content && m_content_length > 0){
+        FastCgi::write_header(*(FcgiHeader *)(request + len), FCGI_STDIN, m_content_length);
+        len += sizeof(FcgiHeader);
+        memcpy(request + len, m_content, m_content_length);
+        len += m_content_length;
+    }
+    FastCgi::write_header(*(FcgiHeader *)(request + len), FCGI_STDIN, 0);
+    len += sizeof(FcgiHeader);
+    if(!fcgi_write_full(fcgi_fd, request, len)){
+        return BAD_GATEWAY;
+    }
+
+    //CGI头部收齐之前先缓存在headers中，之后的应答体直接转发
+    char headers[FCGI_HEADER_SIZE];
+    int headers_len = 0;
+    bool headers_sent = false;
+    bool chunked = false;
+    static thread_local char content[65536 + 256];
+    FcgiHeader record;
+    while(true){
+        if(!fcgi_read_full(fcgi_fd, &record, sizeof(record))){
+            return headers_sent ? CLOSED_CONNECTION : BAD_GATEWAY;
+        }
+        replied = true;
+        int content_len = ntohs(record.content_length);
+        if(!fcgi_read_full(fcgi_fd, content, content_len + record.padding_length)){
+            return headers_sent ? CLOSED_CONNECTION : BAD_GATEWAY;
+        }
+        if(record.type == FCGI_END_REQUEST){
+            break;
+        }
+        if(record.type == FCGI_STDERR){
+            //后端的错误输出只计数，每秒最多打印一条，出错的后端不会让工作线程都卡在stdio上
+            Metrics::inc(M_FASTCGI_STDERR);
+            static std::atomic<uint64_t> next_print(0);
+            uint64_t now = Metrics::now_ns();
+            uint64_t next = next_print.load(std::memory_order_relaxed);
+            if(now >= next && next_print.compare_exchange_strong(next, now + 1000000000ULL)){
+                printf("fastcgi %s: %.*s\n", m_fcgi_backend->address(), content_len, content);
+            }
+            continue;
+        }
+        if(record.type != FCGI_STDOUT || content_len == 0){
+            continue;
+        }
+        if(headers_sent){
+            if(!send_fcgi_body(content, content_len, chunked)){
+                return CLOSED_CONNECTION;
+            }
+            continue;
+        }
+
+        int copy = content_len < FCGI_HEADER_SIZE - headers_len ? content_len : FCGI_HEADER_SIZE - headers_len;
+        memcpy(headers + headers_len, content, copy);
+        headers_len += copy;
+        //CGI头部以空行结束，有的程序只用\n换行
+        int body = -1;
+        for(int i = 0; i + 1 < headers_len; ++i){
+            if(headers[i] == '\n' && headers[i + 1] == '\n'){
+                body = i + 2;
+                break;
+            }
+            if(i + 3 < headers_len && memcmp(headers + i, "\r\n\r\n", 4) == 0){
+                body = i + 4;
+                break;
+            }
+        }
+        if(body < 0){
+            if(headers_len == FCGI_HEADER_SIZE){
+                return BAD_GATEWAY;
+            }
+            continue;
+        }
+        if(!send_fcgi_headers(headers, body, chunked)){
+            return CLOSED_CONNECTION;
+        }
+        headers_sent = true;
+        if(!send_fcgi_body(headers + body, headers_len - body, chunked)
+           || !send_fcgi_body(content + copy, content_len - copy, chunked)){
+            return CLOSED_CONNECTION;
+        }
+    }
+
+    //END_REQUEST的第5个字节是protocolStatus，后端过载或者不接受请求时不是REQUEST_COMPLETE
+    if(!headers_sent){
+        return (unsigned char)content[4] != FCGI_REQUEST_COMPLETE ? SERVICE_UNAVAILABLE : BAD_GATEWAY;
+    }
+    keep = true;
+    if(chunked){
+        struct iovec iv;
+        iv.iov_base = (void *)"0\r\n\r\n";
+        iv.iov_len = 5;
+        if(!send_all(&iv, 1)){
+            return CLOSED_CONNECTION;
+        }
+    }
+    if(!m_plugin_body.empty()){
+        //积压的部分交给write()发送，发送完时由它计数
+        m_iv[0].iov_base = (void *)m_plugin_body.data();
+        m_iv[0].iov_len = m_plugin_body.size();
+        m_iv_count = 1;
+        m_bytes_to_send = m_plugin_body.size();
+        return FCGI_REQUEST;
+    }
+    ++m_request_count;
+    return FCGI_REQUEST;
+}
+
+bool HttpConnection::send_fcgi_headers(char *headers, int len, bool &chunked) {
+    char out[FCGI_HEADER_SIZE + 256];
+    int out_len = 0;
+    char status[64] = "200 OK";
+    bool has_length = false;
+    //先生成除状态行之外的头部，Status和Location决定状态行
+    char *line = headers;
+    char *end = headers + len;
+    while(line < end){
+        char *next = (char *)memchr(line, '\n', end - line);
+        next = next ? next + 1 : end;
+        int line_len = next - line;
+        while(line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')){
+            --line_len;
+        }
+        if(line_len == 0){
+            break;
+        }
+        if(strncasecmp(line, "Status:", 7) == 0){
+            int skip = 7 + strspn(line + 7, " \t");
+            snprintf(status, sizeof(status), "%.*s", line_len - skip, line + skip);
+        }else{
+            if(strncasecmp(line, "Location:", 9) == 0 && strcmp(status, "200 OK") == 0){
+                strcpy(status, "302 Found");
+            }else if(strncasecmp(line, "Content-Length:", 15) == 0){
+                has_length = true;
+            }
+            if(out_len + line_len + 2 > FCGI_HEADER_SIZE){
+                return false;
+            }
+            memcpy(out + out_len, line, line_len);
+            out_len += line_len;
+            out[out_len++] = '\r';
+            out[out_len++] = '\n';
+        }
+        line = next;
+    }
+    //后端没有给出Content-Length时，应答体按chunked编码边收边发
+    chunked = !has_length;
+    out_len += snprintf(out + out_len, sizeof(out) - out_len, "%sConnection: %s\r\n\r\n",
+                        chunked ? "Transfer-Encoding: chunked\r\n" : "", m_linger ? "keep-alive" : "close");
+    char status_line[80];
+    struct iovec iv[2];
+    iv[0].iov_base = status_line;
+    iv[0].iov_len = snprintf(status_line, sizeof(status_line), "HTTP/1.1 %s\r\n", status);
+    m_status = atoi(status);
+    iv[1].iov_base = out;
+    iv[1].iov_len = out_len;
+    return send_all(iv, 2);
+}
+
+bool HttpConnection::send_fcgi_body(const char *data, int len, bool chunked) {
+    if(len <= 0){
+        return true;
+    }
+    if(!chunked){
+        struct iovec iv;
+        iv.iov_base = (void *)data;
+        iv.iov_len = len;
+        return send_all(&iv, 1);
+    }
+    char size_line[16];
+    struct iovec iv[3];
+    iv[0].iov_base = size_line;
+    iv[0].iov_len = snprintf(size_line, sizeof(size_line), "%x\r\n", len);
+    iv[1].iov_base = (void *)data;
+    iv[1].iov_len = len;
+    iv[2].iov_base = (void *)"\r\n";
+    iv[2].iov_len = 2;
+    return send_all(iv, 3);
+}
+
+bool HttpConnection::send_all(struct iovec *iv, int count) {
+    trace(T_WRITE);
+    size_t left = 0;
+    for(int i = 0; i < count; ++i){
+        left += iv[i].iov_len;
+    }
+    //已经有积压时新的输出只能排在后面。积压超过上限时等待客户端接收，一次转发等待的时间用完则放弃这个连接
+    while(!m_plugin_body.empty() && m_plugin_body.size() + left > FCGI_BUFFER_LIMIT){
+        if(m_relay_wait_left <= 0){
+            return false;
+        }
+        struct pollfd pfd;
+        pfd.fd = m_sock_fd;
+        pfd.events = POLLOUT;
+        uint64_t start = Metrics::now_ns();
+        int ready = poll(&pfd, 1, (int)(m_relay_wait_left / 1000000) + 1);
+        m_relay_wait_left -= Metrics::now_ns() - start;
+        if(ready <= 0){
+            return false;
+        }
+        struct iovec pending;
+        pending.iov_base = (void *)m_plugin_body.data();
+        pending.iov_len = m_plugin_body.size();
+        int ret = m_tls.active() ? m_tls.writev(m_sock_fd, &pending, 1) : writev(m_sock_fd, &pending, 1);
+        if(ret < 0){
+            if(errno != EAGAIN){
+                return false;
+            }
+            continue;
+        }
+        Metrics::inc(M_RESPONSE_BYTES, ret);
+        m_response_bytes += ret;
+        m_plugin_body.erase(0, ret);
+    }
+    while(count > 0 && m_plugin_body.empty()){
+        int ret = m_tls.active() ? m_tls.writev(m_sock_fd, iv, count) : writev(m_sock_fd, iv, count);
+        if(ret < 0){
+            if(errno != EAGAIN){
+                return false;
+            }
+            break;
+        }
+        Metrics::inc(M_RESPONSE_BYTES, ret);
+        m_response_bytes += ret;
+        while(count > 0 && (size_t)ret >= iv->iov_len){
+            ret -= iv->iov_len;
+            ++iv;
+            --count;
+        }
+        if(count > 0){
+            iv->iov_base = (char *)iv->iov_base + ret;
+            iv->iov_len -= ret;
+        }
+    }
+    //socket写满了，剩下的部分留给write()
+    for(int i = 0; i < count; ++i){
+        m_plugin_body.append((const char *)iv[i].iov_base, iv[i].iov_len);
+    }
+    return true;
+}
+
+//插件在工作线程中直接处理请求，请求的各个字段都是指向读缓冲区的视图
+HttpConnection::HTTP_CODE HttpConnection::run_plugin() {
+    //每个工作线程一个应答对象，拷贝的数据在应答填好后交换给连接，不需要为每个请求分配内存
+    static thread_local ws_response resp;
+    resp.reset();
+
+    ws_request req;
+    memset(&req, 0, sizeof(req));
+    req.method.data = m_method == POST ? "POST" : "GET";
+    req.method.len = strlen(req.method.data);
+    req.path.data = m_url;
+    const char *query = strchr(m_url, '?');
+    req.path.len = query ? query - m_url : strlen(m_url);
+    if(query){
+        req.query.data = query + 1;
+        req.query.len = strlen(query + 1);
+    }
+    if(m_host){
+        req.host.data = m_host;
+        req.host.len = strlen(m_host);
+    }
+    if(m_content_type){
+        req.content_type.data = m_content_type;
+        req.content_type.len = strlen(m_content_type);
+    }
+    if(m_content){
+        req.body.data = m_content;
+        req.body.len = m_content_length;
+    }
+    req.remote_addr = m_address.sin_addr.s_addr;
+    req.remote_port = ntohs(m_address.sin_port);
+    req.secure = m_tls.active();
+
+    if(m_plugin->handle(req, resp) != 0){
+        return INTERNAL_ERROR;
+    }
+    add_status_line(resp.status, resp.reason);
+    if(!add_response("%.*s", resp.headers_len, resp.headers) || !add_headers(resp.body_len)){
+        return INTERNAL_ERROR;
+    }
+    m_plugin_body.swap(resp.copy);
+    m_iv[0].iov_base = m_write_buf;
+    m_iv[0].iov_len = m_write_idx;
+    for(int i = 0; i < resp.segment_count; ++i){
+        const ws_response::Segment &segment = resp.segments[i];
+        //零拷贝的数据直接放进iovec，拷贝的数据指向连接持有的m_plugin_body
+        m_iv[i + 1].iov_base = segment.data ? (void *)segment.data : &m_plugin_body[segment.offset];
+        m_iv[i + 1].iov_len = segment.len;
+    }
+    m_iv_count = resp.segment_count + 1;
+    m_bytes_to_send = m_write_idx + resp.body_len;
+    return PLUGIN_REQUEST;
+}
+
 //对内存映射区执行munmap
 void HttpConnection::unmap() {
+    //插件的应答体较大时释放内存，否则保留给连接的下一个请求
+    if(m_plugin_body.capacity() > WRITE_BUFFER_SIZE * 16){
+        std::string().swap(m_plugin_body);
+    }else{
+        m_plugin_body.clear();
+    }
+    //资源包内的数据不需要munmap，释放引用即可
+    if(m_bundle){
+        m_bundle.reset();
+        m_file_address = 0;
+        return;
+    }
     if(m_file_address){
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
@@ -262,22 +930,35 @@ void HttpConnection::unmap() {
 //写HTTP响应
 bool HttpConnection::write() {
     int temp = 0;
-    int bytes_have_send = 0;
-    int bytes_to_send = m_write_idx;
 
-    if(bytes_to_send == 0){
-        modFd(m_epoll_fd, m_sock_fd, EPOLLIN);
+    if(m_bytes_to_send == 0){
+        //TLS握手消息没有写完，继续握手
+        if(m_tls.want_write()){
+            TlsConn::HANDSHAKE hs = m_tls.handshake();
+            if(hs == TlsConn::HS_ERROR){
+                return false;
+            }
+            mod_event(hs == TlsConn::HS_WANT_WRITE ? EPOLLOUT : EPOLLIN);
+            return true;
+        }
+        //应答已经在工作线程中直接发送完(FastCGI)。先重置连接再重新注册事件，注册之后主线程可能马上读入下一个请求
+        request_done();
         init();
+        mod_event(EPOLLIN);
         return true;
     }
 
+    trace(T_WRITE);
     while(true){
-        temp = writev(m_sock_fd, m_iv, m_iv_count);
+        temp = m_tls.active() ? m_tls.writev(m_sock_fd, m_iv, m_iv_count)
+                              : writev(m_sock_fd, m_iv, m_iv_count);
         if(temp <= -1){
             //如果TCP写缓冲区没有空间,则等待下一轮EPOLLOUT事件。虽然在此期间
             //服务器无法立即接收到同一客户下的请求，但这可以保证连接的完整性
             if(errno == EAGAIN){
-                modFd(m_epoll_fd, m_sock_fd, EPOLLOUT);
+                //慢客户端的应答在发送完之前一直占用预算
+                hold_bytes(m_bytes_to_send);
+                mod_event(EPOLLOUT);
                 return true;
             }
 
@@ -285,17 +966,30 @@ bool HttpConnection::write() {
             return false;
         }
 
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        if(bytes_to_send <= bytes_have_send){
+        m_bytes_to_send -= temp;
+        m_bytes_have_send += temp;
+        Metrics::inc(M_RESPONSE_BYTES, temp);
+        m_response_bytes += temp;
+        //writev可能只写出了一部分，把已经写完的内存块长度置0，调整第一个没写完的块，下一次从未发送的位置继续写
+        for(int i = 0; i < m_iv_count && temp > 0; ++i){
+            size_t len = (size_t)temp < m_iv[i].iov_len ? (size_t)temp : m_iv[i].iov_len;
+            m_iv[i].iov_base = (char *)m_iv[i].iov_base + len;
+            m_iv[i].iov_len -= len;
+            temp -= len;
+        }
+
+        if(m_bytes_to_send <= 0){
+            hold_bytes(0);
+            ++m_request_count;
+            request_done();
             //发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
             unmap();
             if(m_linger){
                 init();
-                modFd(m_epoll_fd, m_sock_fd, EPOLLIN);
+                mod_event(EPOLLIN);
                 return true;
             }else{
-                modFd(m_epoll_fd, m_sock_fd, EPOLLIN);
+                //连接马上就要被关闭，不再重新注册事件，否则主线程可能在关闭前再次拿到这个socket
                 return false;
             }
         }
@@ -304,12 +998,30 @@ bool HttpConnection::write() {
 
 //循环读取客户数据，知道无数据可读或者对方关闭连接
 bool HttpConnection::read() {
-    if(m_read_idx >= READ_BUFFER_SIZE)
+    if(m_read_idx >= m_read_buffer_size)
         return false;
 
+    if(TlsContext::enabled() && !m_tls.established()){
+        if(!m_tls.active()){
+            return false;
+        }
+        //握手没有完成时返回true但不读入数据，process_read得到NO_REQUEST后重新注册事件
+        TlsConn::HANDSHAKE hs = m_tls.handshake();
+        if(hs == TlsConn::HS_ERROR){
+            return false;
+        }else if(hs != TlsConn::HS_DONE){
+            return true;
+        }
+        //握手完成，客户端可能已经紧接着发出了请求，继续读取
+    }
+
     int bytes_read = 0;
     while(true){
-        bytes_read = recv(m_sock_fd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        if(m_tls.active()){
+            bytes_read = m_tls.recv(m_read_buf + m_read_idx, m_read_buffer_size - m_read_idx);
+        }else{
+            bytes_read = recv(m_sock_fd, m_read_buf + m_read_idx, m_read_buffer_size - m_read_idx, 0);
+        }
         if(bytes_read == -1){
             if(errno == EAGAIN || errno == EWOULDBLOCK)
                 break;
@@ -317,7 +1029,15 @@ bool HttpConnection::read() {
         }else if(bytes_read == 0){
             return false;
         }
+        if(m_read_idx == 0 && AccessLog::enabled()){
+            m_request_start = Metrics::now_ns();
+        }
+        //解析时会就地修改读缓冲区，必须在这里拷贝原始的字节
+        if(m_capture_id){
+            Capture::data(m_capture_id, Metrics::now_ns(), m_read_buf + m_read_idx, bytes_read);
+        }
         m_read_idx += bytes_read;
+        trace(T_READ);
     }
 
     return true;
@@ -334,7 +1054,6 @@ HttpConnection::HTTP_CODE HttpConnection::process_read() {
     {
         text = get_line();
         m_start_line = m_checked_idx;
-        printf("got 1 http line: %s\n", text);
 
         switch (m_checked_state)
         {
@@ -356,6 +1075,7 @@ HttpConnection::HTTP_CODE HttpConnection::process_read() {
                 }
                 else if (ret == GET_REQUEST)
                 {
+                    trace(T_PARSED);
                     return do_request();
                 }
                 break;
@@ -365,6 +1085,7 @@ HttpConnection::HTTP_CODE HttpConnection::process_read() {
                 ret = parse_content(text);
                 if (ret == GET_REQUEST)
                 {
+                    trace(T_PARSED);
                     return do_request();
                 }
                 line_status = LINE_OPEN;
@@ -382,8 +1103,27 @@ HttpConnection::HTTP_CODE HttpConnection::process_read() {
 
 //根据服务器处理HTTP请求的结果，决定返回给客户端的内容
 bool HttpConnection::process_write(HttpConnection::HTTP_CODE ret) {
+    //进程正在退出，发完这个应答就关闭连接，客户端会在新进程上重新建立连接
+    if(m_draining.load(std::memory_order_relaxed)){
+        m_linger = false;
+    }
     switch(ret)
     {
+        case METRICS_REQUEST:
+        {
+            m_plugin_body.clear();
+            Metrics::render(m_plugin_body);
+            add_status_line(200, ok_200_title);
+            add_response("Content-Type: text/plain; version=0.0.4\r\n");
+            add_headers(m_plugin_body.size());
+            m_iv[0].iov_base = m_write_buf;
+            m_iv[0].iov_len = m_write_idx;
+            m_iv[1].iov_base = &m_plugin_body[0];
+            m_iv[1].iov_len = m_plugin_body.size();
+            m_iv_count = 2;
+            m_bytes_to_send = m_write_idx + m_plugin_body.size();
+            return true;
+        }
         case INTERNAL_ERROR:
         {
             add_status_line(500, error_500_title);
@@ -435,6 +1175,7 @@ bool HttpConnection::process_write(HttpConnection::HTTP_CODE ret) {
                 m_iv[1].iov_base = m_file_address;
                 m_iv[1].iov_len = m_file_stat.st_size;
                 m_iv_count = 2;
+                m_bytes_to_send = m_write_idx + m_file_stat.st_size;
                 return true;
             }
             else
@@ -448,6 +1189,74 @@ bool HttpConnection::process_write(HttpConnection::HTTP_CODE ret) {
             }
             break;
         }
+        case BAD_GATEWAY:
+        {
+            add_status_line(502, error_502_title);
+            add_headers(strlen(error_502_form));
+            if (!add_content(error_502_form))
+            {
+                return false;
+            }
+            break;
+        }
+        case SERVICE_UNAVAILABLE:
+        {
+            add_status_line(503, error_503_title);
+            add_headers(strlen(error_503_form));
+            if (!add_content(error_503_form))
+            {
+                return false;
+            }
+            break;
+        }
+        case PLUGIN_REQUEST:
+        {
+            HTTP_CODE plugin_ret = run_plugin();
+            if (plugin_ret != PLUGIN_REQUEST)
+            {
+                //丢弃插件可能已经写入的部分头部
+                m_write_idx = 0;
+                return process_write(plugin_ret);
+            }
+            return true;
+        }
+        case FCGI_REQUEST:
+        {
+            //应答在relay_fcgi中已经边收边发，全部发出时m_bytes_to_send为0，随后的write()只重新注册事件，
+            //客户端没有要求保持连接时返回false，由调用者关闭连接；有积压时由随后的write()继续发送
+            HTTP_CODE relay_ret = relay_fcgi();
+            if (relay_ret == FCGI_REQUEST)
+            {
+                return m_bytes_to_send > 0 || m_linger;
+            }
+            else if (relay_ret == CLOSED_CONNECTION)
+            {
+                return false;
+            }
+            return process_write(relay_ret);
+        }
+        case BUNDLE_REQUEST:
+        {
+            //Content-Length、Content-Type等头部在打包时已经生成好了
+            const BundleEntry *entry = m_bundle_entry;
+            bool gzip = m_accept_gzip && entry->gzip_len != 0;
+            add_status_line(200, ok_200_title);
+            if (!add_response("%.*s", gzip ? entry->gzip_header_len : entry->header_len,
+                              m_bundle->at(gzip ? entry->gzip_header_offset : entry->header_offset)))
+            {
+                return false;
+            }
+            add_linger();
+            add_blank_line();
+            m_file_address = (char *)m_bundle->at(gzip ? entry->gzip_offset : entry->data_offset);
+            m_iv[0].iov_base = m_write_buf;
+            m_iv[0].iov_len = m_write_idx;
+            m_iv[1].iov_base = m_file_address;
+            m_iv[1].iov_len = gzip ? entry->gzip_len : entry->data_len;
+            m_iv_count = 2;
+            m_bytes_to_send = m_write_idx + m_iv[1].iov_len;
+            return true;
+        }
         default:
         {
             return false;
@@ -457,18 +1266,20 @@ bool HttpConnection::process_write(HttpConnection::HTTP_CODE ret) {
     m_iv[0].iov_base = m_write_buf;
     m_iv[0].iov_len = m_write_idx;
     m_iv_count = 1;
+    m_bytes_to_send = m_write_idx;
     return true;
 }
 
 bool HttpConnection::add_response(const char *format, ...) {
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
+    if (m_write_idx >= m_write_buffer_size)
     {
         return false;
     }
     va_list arg_list;
     va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - - m_write_idx))
+    int len = vsnprintf(m_write_buf + m_write_idx, m_write_buffer_size - 1 - m_write_idx, format, arg_list);
+    va_end(arg_list);
+    if (len >= (m_write_buffer_size - 1 - m_write_idx))
     {
         return false;
     }
@@ -480,7 +1291,9 @@ bool HttpConnection::add_content(const char *content) {
     return add_response("%s", content);
 }
 
+//只记下状态码，插件的头部写不下时会改成500应答，状态码在应答发送完时统一计数
 bool HttpConnection::add_status_line(int status, const char *title) {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
@@ -505,48 +1318,148 @@ bool HttpConnection::add_blank_line() {
 }
 
 void HttpConnection::process() {
+    trace(T_PROCESS);
+    //请求已经离开队列
+    hold_bytes(0);
+    //非ONESHOT模式：拥有连接的工作线程一直处理到没有新的事件为止，再释放连接
+    if (!config.one_shot)
+    {
+        int expected = 1;
+        do
+        {
+            m_sched.store(1);
+            if (!handle_owned())
+            {
+                //连接已经关闭，m_sched留给下一次init()重置
+                return;
+            }
+            expected = 1;
+        } while (!m_sched.compare_exchange_strong(expected, 0));
+        return;
+    }
+
+    //Reactor模式下，读写操作也在工作线程中完成
+    if (config.actor_model == REACTOR)
+    {
+        if (m_io_state == IO_WRITE)
+        {
+            if (!write())
+            {
+                close_conn();
+            }
+            return;
+        }
+        if (!read())
+        {
+            close_conn();
+            return;
+        }
+    }
+
+    uint64_t parse_start = Metrics::now_ns();
     HTTP_CODE read_ret = process_read();
+    uint64_t parse_end = Metrics::now_ns();
+    Metrics::observe(H_PARSE_TIME, parse_end - parse_start);
+    if (m_tracing && read_ret != NO_REQUEST)
+    {
+        Trace::mark(m_trace, T_RESOLVED, parse_end);
+    }
     if (read_ret == NO_REQUEST)
     {
         //每次重新注册EPOLLONESHOT时都需要重新开始计时器
-        this->startTimer(this->timer);
-        modFd(m_epoll_fd, m_sock_fd, EPOLLIN);
+        this->startTimer();
+        mod_event(m_tls.want_write() ? EPOLLOUT : EPOLLIN);
         return;
     }
+    Metrics::inc(M_REQUESTS);
 
     bool write_ret = process_write(read_ret);
     if (!write_ret)
     {
         close_conn();
+        return;
     }
 
-    modFd(m_epoll_fd, m_sock_fd, EPOLLOUT);
+    //工作线程直接尝试发送应答，只有在TCP写缓冲区满(EAGAIN)时write()才会注册EPOLLOUT，
+    //交由主线程在socket可写时继续发送，省去一次epoll_ctl和一次主线程唤醒
+    if (!write())
+    {
+        close_conn();
+    }
 }
 
-void HttpConnection::setTimer(Timer *timer) {
-    this->timer = timer;
+bool HttpConnection::handle_owned() {
+    //先把上一次没有发送完的应答发送出去，仍未发送完则等待EPOLLOUT
+    if (m_bytes_to_send > 0)
+    {
+        if (!write())
+        {
+            close_conn();
+            return false;
+        }
+        if (m_bytes_to_send > 0)
+        {
+            return true;
+        }
+    }
+
+    if (!read())
+    {
+        close_conn();
+        return false;
+    }
+
+    uint64_t parse_start = Metrics::now_ns();
+    HTTP_CODE read_ret = process_read();
+    uint64_t parse_end = Metrics::now_ns();
+    Metrics::observe(H_PARSE_TIME, parse_end - parse_start);
+    if (m_tracing && read_ret != NO_REQUEST)
+    {
+        Trace::mark(m_trace, T_RESOLVED, parse_end);
+    }
+    if (read_ret == NO_REQUEST)
+    {
+        this->startTimer();
+        if (m_tls.want_write())
+        {
+            mod_event(EPOLLOUT);
+        }
+        return true;
+    }
+    Metrics::inc(M_REQUESTS);
+
+    if (!process_write(read_ret) || !write())
+    {
+        close_conn();
+        return false;
+    }
+    return true;
 }
 
-void HttpConnection::startTimer(Timer *timer) {
+void HttpConnection::startTimer() {
+    //定时器的字段只在持有timeHeapLock时修改
     timeHeapLock.lock();
-    timeHeap.add_timer(timer);
+    timer.expire = time(nullptr) + CONN_TIMEOUT;
+    timeHeap.add_timer(&timer);
     timeHeapLock.unlock();
 }
 
 void HttpConnection::separateTimer() {
-    if(this->timer){
-        timeHeapLock.lock();
-        timeHeap.del_timer(timer);
-        timeHeapLock.unlock();
-    }
+    timeHeapLock.lock();
+    timeHeap.del_timer(&timer);
+    timeHeapLock.unlock();
 }
 
-HttpConnection::HttpConnection() {
-
+HttpConnection::HttpConnection() : m_sock_fd(-1), m_tracing(false), m_capture_id(0), m_held_bytes(0),
+                                   timer(CONN_TIMEOUT, this) {
+    //启动时为每个连接分配好缓冲区，处理请求时不再分配
+    m_read_buf = new char[m_read_buffer_size];
+    m_write_buf = new char[m_write_buffer_size];
 }
 
 HttpConnection::~HttpConnection() {
-
+    delete [] m_read_buf;
+    delete [] m_write_buf;
 }
 
 
@@ -0,0 +1,174 @@
+//
+// 运行指标
+//
+
+#include "Metrics.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+Metrics::Shard Metrics::m_shards[Metrics::MAX_SHARDS];
+std::atomic<int> Metrics::m_shard_number(0);
+std::atomic<uint64_t> Metrics::m_gauges[GAUGE_NUMBER];
+
+Metrics::Shard *Metrics::new_shard() {
+    int idx = m_shard_number.fetch_add(1);
+    return &m_shards[idx < MAX_SHARDS ? idx : MAX_SHARDS - 1];
+}
+
+void Metrics::status(int code) {
+    METRIC_COUNTER counter;
+    switch(code){
+        case 200: counter = M_STATUS_200; break;
+        case 206: counter = M_STATUS_206; break;
+        case 302: counter = M_STATUS_302; break;
+        case 304: counter = M_STATUS_304; break;
+        case 400: counter = M_STATUS_400; break;
+        case 403: counter = M_STATUS_403; break;
+        case 404: counter = M_STATUS_404; break;
+        case 500: counter = M_STATUS_500; break;
+        case 502: counter = M_STATUS_502; break;
+        case 503: counter = M_STATUS_503; break;
+        default: counter = M_STATUS_OTHER; break;
+    }
+    inc(counter);
+}
+
+uint64_t Metrics::bucket_upper(int bucket) {
+    if(bucket < SUB_BUCKETS){
+        return bucket;
+    }
+    int msb = bucket / SUB_BUCKETS + 1;
+    uint64_t width = 1ULL << (msb - 2);
+    return ((uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << (msb - 2)) + width - 1;
+}
+
+//输出时只列出1微秒到约34秒之间的桶，边界固定，更小的值计入第一个桶，更大的值只计入+Inf
+static const int FIRST_BUCKET = (10 - 1) * Metrics::SUB_BUCKETS;
+static const int LAST_BUCKET = (35 - 1) * Metrics::SUB_BUCKETS + Metrics::SUB_BUCKETS - 1;
+
+static void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string &out, const char *format, ...){
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if(len > 0){
+        out.append(line, len < (int)sizeof(line) ? len : (int)sizeof(line) - 1);
+    }
+}
+
+//两个计数器相减得到的值。它们来自不同的线程，读取的时刻不同，差可能暂时为负
+static uint64_t gauge(uint64_t added, uint64_t removed){
+    return added > removed ? added - removed : 0;
+}
+
+//进程的常驻内存，读取失败时为0
+static uint64_t resident_bytes(){
+    unsigned long size = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if(!fp){
+        return 0;
+    }
+    if(fscanf(fp, "%lu %lu", &size, &resident) != 2){
+        resident = 0;
+    }
+    fclose(fp);
+    return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+static void append_counter(std::string &out, const char *name, const char *help, const char *type, uint64_t value){
+    append(out, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, (unsigned long long)value);
+}
+
+void Metrics::render(std::string &out) {
+    //读取时不加锁，各线程的计数可能来自略微不同的时刻，对监控来说足够了
+    uint64_t counters[COUNTER_NUMBER] = {0};
+    uint64_t buckets[HISTOGRAM_NUMBER][BUCKET_NUMBER] = {{0}};
+    uint64_t sums[HISTOGRAM_NUMBER] = {0};
+    int shard_number = m_shard_number.load();
+    if(shard_number > MAX_SHARDS){
+        shard_number = MAX_SHARDS;
+    }
+    for(int i = 0; i < shard_number; ++i){
+        const Shard &shard = m_shards[i];
+        for(int c = 0; c < COUNTER_NUMBER; ++c){
+            counters[c] += shard.counters[c].load(std::memory_order_relaxed);
+        }
+        for(int h = 0; h < HISTOGRAM_NUMBER; ++h){
+            for(int b = 0; b < BUCKET_NUMBER; ++b){
+                buckets[h][b] += shard.histograms[h].buckets[b].load(std::memory_order_relaxed);
+            }
+            sums[h] += shard.histograms[h].sum.load(std::memory_order_relaxed);
+        }
+    }
+
+    append_counter(out, "webserver_connections_accepted_total", "Connections accepted.", "counter", counters[M_ACCEPTED]);
+    append_counter(out, "webserver_connections_active", "Connections currently open.", "gauge",
+                   gauge(counters[M_ACCEPTED], counters[M_CLOSED]));
+    append_counter(out, "webserver_requests_total", "Requests parsed.", "counter", counters[M_REQUESTS]);
+    append_counter(out, "webserver_response_bytes_total", "Response bytes sent, headers included.", "counter",
+                   counters[M_RESPONSE_BYTES]);
+    append_counter(out, "webserver_timer_expired_total", "Connections closed by the idle timer.", "counter",
+                   counters[M_TIMER_EXPIRED]);
+    append_counter(out, "webserver_queue_rejected_total", "Requests rejected by a full thread pool queue.", "counter",
+                   counters[M_QUEUE_REJECTED]);
+    append(out, "# HELP webserver_requests_shed_total Requests answered with 503 by admission control.\n"
+                "# TYPE webserver_requests_shed_total counter\n");
+    append(out, "webserver_requests_shed_total{reason=\"queue_delay\"} %llu\n", (unsigned long long)counters[M_SHED_DELAY]);
+    append(out, "webserver_requests_shed_total{reason=\"byte_budget\"} %llu\n", (unsigned long long)counters[M_SHED_BYTES]);
+    append(out, "webserver_requests_shed_total{reason=\"connection_limit\"} %llu\n",
+           (unsigned long long)counters[M_SHED_CONNECTIONS]);
+    append_counter(out, "webserver_access_log_dropped_total", "Access log records dropped because the writer fell behind.",
+                   "counter", counters[M_LOG_DROPPED]);
+    append_counter(out, "webserver_capture_dropped_total",
+                   "Capture records dropped because the writer fell behind; those connections replay incompletely.",
+                   "counter", counters[M_CAPTURE_DROPPED]);
+    append_counter(out, "webserver_fastcgi_stderr_total",
+                   "FCGI_STDERR records from FastCGI backends, at most one a second is printed.", "counter", counters[M_FASTCGI_STDERR]);
+    append_counter(out, "webserver_queue_depth", "Requests waiting in the thread pool queue.", "gauge",
+                   gauge(counters[M_QUEUE_PUSHED], counters[M_QUEUE_POPPED]));
+    append_counter(out, "webserver_timer_heap_entries", "Idle timers in the heap.", "gauge",
+                   m_gauges[G_TIMER_HEAP_ENTRIES].load(std::memory_order_relaxed));
+    append_counter(out, "webserver_timer_heap_bytes", "Bytes of the heap array, the timers live in the connection objects.",
+                   "gauge", m_gauges[G_TIMER_HEAP_BYTES].load(std::memory_order_relaxed));
+    append_counter(out, "webserver_connection_slots", "Entries of the connection table, one pointer each.", "gauge",
+                   m_gauges[G_CONNECTION_SLOTS].load(std::memory_order_relaxed));
+    append_counter(out, "webserver_connection_objects", "Connection objects created, kept for reuse by their descriptor.",
+                   "gauge", m_gauges[G_CONNECTION_OBJECTS].load(std::memory_order_relaxed));
+    append_counter(out, "webserver_connection_object_bytes", "Size of one connection object with its buffers.", "gauge",
+                   m_gauges[G_CONNECTION_BYTES].load(std::memory_order_relaxed));
+    append_counter(out, "process_resident_memory_bytes", "Resident memory size in bytes.", "gauge", resident_bytes());
+
+    static const struct{ METRIC_COUNTER counter; const char *code; } codes[] = {
+        {M_STATUS_200, "200"}, {M_STATUS_206, "206"}, {M_STATUS_302, "302"}, {M_STATUS_304, "304"},
+        {M_STATUS_400, "400"}, {M_STATUS_403, "403"}, {M_STATUS_404, "404"}, {M_STATUS_500, "500"},
+        {M_STATUS_502, "502"}, {M_STATUS_503, "503"}, {M_STATUS_OTHER, "other"},
+    };
+    append(out, "# HELP webserver_responses_total Responses by status code.\n# TYPE webserver_responses_total counter\n");
+    for(size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); ++i){
+        append(out, "webserver_responses_total{code=\"%s\"} %llu\n", codes[i].code,
+               (unsigned long long)counters[codes[i].counter]);
+    }
+
+    static const struct{ const char *name; const char *help; } histograms[HISTOGRAM_NUMBER] = {
+        {"webserver_queue_wait_seconds", "Time a request waited in the thread pool queue."},
+        {"webserver_parse_seconds", "Time spent parsing a request."},
+    };
+    for(int h = 0; h < HISTOGRAM_NUMBER; ++h){
+        const char *name = histograms[h].name;
+        append(out, "# HELP %s %s\n# TYPE %s histogram\n", name, histograms[h].help, name);
+        uint64_t cumulative = 0;
+        for(int b = 0; b < BUCKET_NUMBER; ++b){
+            cumulative += buckets[h][b];
+            if(b >= FIRST_BUCKET && b <= LAST_BUCKET){
+                append(out, "%s_bucket{le=\"%.9g\"} %llu\n", name, bucket_upper(b) / 1e9,
+                       (unsigned long long)cumulative);
+            }
+        }
+        append(out, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n", name,
+               (unsigned long long)cumulative, name, sums[h] / 1e9, name, (unsigned long long)cumulative);
+    }
+}
@@ -0,0 +1,184 @@
+//
+// 处理器插件
+//
+
+#include "PluginHost.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <dlfcn.h>
+
+Plugin PluginHost::m_plugins[PluginHost::MAX_PLUGIN_NUMBER];
+int PluginHost::m_plugin_number = 0;
+
+void ws_response::reset() {
+    status = 200;
+    strcpy(reason, "OK");
+    headers_len = 0;
+    segment_count = 0;
+    copy.clear();
+    body_len = 0;
+}
+
+bool ws_response::append(const void *data, size_t len, bool ref) {
+    if(len == 0){
+        return true;
+    }
+    //连续的拷贝数据合并成一段
+    if(!ref && segment_count > 0 && segments[segment_count - 1].data == nullptr){
+        segments[segment_count - 1].len += len;
+        copy.append((const char *)data, len);
+        body_len += len;
+        return true;
+    }
+    if(segment_count >= MAX_SEGMENTS){
+        return false;
+    }
+    Segment &segment = segments[segment_count++];
+    segment.data = ref ? data : nullptr;
+    segment.offset = copy.size();
+    segment.len = len;
+    if(!ref){
+        copy.append((const char *)data, len);
+    }
+    body_len += len;
+    return true;
+}
+
+static int api_set_status(ws_response *resp, int status, const char *reason){
+    if(status < 100 || status > 999){
+        return -1;
+    }
+    resp->status = status;
+    snprintf(resp->reason, sizeof(resp->reason), "%s", reason ? reason : "");
+    return 0;
+}
+
+static int api_add_header(ws_response *resp, const char *name, const char *value){
+    //这两个头部由服务器根据应答体和请求生成
+    if(strcasecmp(name, "Content-Length") == 0 || strcasecmp(name, "Connection") == 0
+       || strpbrk(name, "\r\n:") || strpbrk(value, "\r\n")){
+        return -1;
+    }
+    int len = snprintf(resp->headers + resp->headers_len, ws_response::HEADERS_SIZE - resp->headers_len,
+                       "%s: %s\r\n", name, value);
+    if(len < 0 || len >= ws_response::HEADERS_SIZE - resp->headers_len){
+        return -1;
+    }
+    resp->headers_len += len;
+    return 0;
+}
+
+static int api_write(ws_response *resp, const void *data, size_t len){
+    return resp->append(data, len, false) ? 0 : -1;
+}
+
+static int api_write_ref(ws_response *resp, const void *data, size_t len){
+    return resp->append(data, len, true) ? 0 : -1;
+}
+
+static const ws_server_api server_api = {
+    WS_PLUGIN_ABI_VERSION,
+    api_set_status,
+    api_add_header,
+    api_write,
+    api_write_ref,
+};
+
+bool Plugin::load(const char *spec) {
+    const char *eq = strchr(spec, '=');
+    if(!eq || spec[0] != '/' || (size_t)(eq - spec) >= sizeof(m_prefix)){
+        return false;
+    }
+    m_prefix_len = eq - spec;
+    memcpy(m_prefix, spec, m_prefix_len);
+    m_prefix[m_prefix_len] = '\0';
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s", eq + 1);
+    const char *arg = nullptr;
+    char *comma = strchr(path, ',');
+    if(comma){
+        *comma = '\0';
+        arg = comma + 1;
+    }
+
+    //RTLD_NOW：缺少的符号在启动时暴露出来，而不是在第一个请求时
+    m_handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if(!m_handle){
+        printf("dlopen %s: %s\n", path, dlerror());
+        return false;
+    }
+    ws_plugin_entry_fn entry = (ws_plugin_entry_fn)dlsym(m_handle, WS_PLUGIN_ENTRY);
+    m_plugin = entry ? entry() : nullptr;
+    if(!m_plugin || m_plugin->abi_version != WS_PLUGIN_ABI_VERSION || !m_plugin->handle){
+        printf("%s is not a plugin of ABI version %d\n", path, WS_PLUGIN_ABI_VERSION);
+        unload();
+        return false;
+    }
+    if(m_plugin->init && m_plugin->init(arg) != 0){
+        printf("plugin %s failed to initialize\n", path);
+        unload();
+        return false;
+    }
+    printf("plugin %s loaded at %s\n", name(), m_prefix);
+    return true;
+}
+
+void Plugin::fini() const {
+    if(m_plugin && m_plugin->fini){
+        m_plugin->fini();
+    }
+}
+
+void Plugin::unload() {
+    m_plugin = nullptr;
+    if(m_handle){
+        dlclose(m_handle);
+        m_handle = nullptr;
+    }
+}
+
+bool Plugin::match(const char *url) const {
+    if(strncmp(url, m_prefix, m_prefix_len) != 0){
+        return false;
+    }
+    //前缀必须在路径段的边界结束，/hello不匹配/helloworld
+    char next = url[m_prefix_len];
+    return m_prefix[m_prefix_len - 1] == '/' || next == '\0' || next == '/' || next == '?';
+}
+
+int Plugin::handle(const ws_request &req, ws_response &resp) const {
+    return m_plugin->handle(&req, &resp, &server_api);
+}
+
+const char *Plugin::name() const {
+    return m_plugin && m_plugin->name ? m_plugin->name : "unnamed";
+}
+
+bool PluginHost::load(const char *spec) {
+    if(m_plugin_number >= MAX_PLUGIN_NUMBER || !m_plugins[m_plugin_number].load(spec)){
+        return false;
+    }
+    m_plugin_number++;
+    return true;
+}
+
+const Plugin *PluginHost::match(const char *url) {
+    for(int i = 0; i < m_plugin_number; ++i){
+        if(m_plugins[i].match(url)){
+            return &m_plugins[i];
+        }
+    }
+    return nullptr;
+}
+
+void PluginHost::shutdown() {
+    for(int i = 0; i < m_plugin_number; ++i){
+        m_plugins[i].fini();
+    }
+}
+
+const ws_server_api *PluginHost::api() {
+    return &server_api;
+}
@@ -3,7 +3,10 @@
 // 进程池实现Cgi服务器
 //
 
+#include <poll.h>
 #include "ProcessPool.h"
+#include "CgiWorkerPool.h"
+
 class CgiConn{
 public:
     CgiConn(){}
@@ -18,7 +21,8 @@ public:
         m_read_index = 0;
     }
 
-    void process(){
+    //处理客户数据，返回false表示连接已经关闭
+    bool process(){
         int idx = 0;
         int ret = -1;
         //循环读取和分析客户数据
@@ -29,13 +33,14 @@ public:
             if(ret < 0){
                 if(errno != EAGAIN){
                     delFd(m_epoll_fd, m_sock_fd);
+                    return false;
                 }
-                break;
+                return true;
             }
             //如果对方关闭连接，则服务器也关闭连接
             else if(ret == 0){
                 delFd(m_epoll_fd, m_sock_fd);
-                break;
+                return false;
             }else{
                 m_read_index += ret;
                 printf("user content is %s\n", m_buf);
@@ -58,32 +63,97 @@ public:
                 //判断客户要运行的cgi程序是否存在
                 if(access(file_name, F_OK) == -1){
                     delFd(m_epoll_fd, m_sock_fd);
-                    break;
+                    return false;
                 }
-                //创建子进程来执行CGI程序
-                ret = fork();
-                if(ret == -1){
-                    delFd(m_epoll_fd, m_sock_fd);
-                    break;
+                //交给常驻的CGI工作进程执行，传统CGI程序则fork子进程执行，应答发送完后关闭连接
+                run_cgi(file_name);
+                delFd(m_epoll_fd, m_sock_fd);
+                return false;
+            }
+        }
+    }
+
+private:
+    //把请求交给CGI工作进程，并把它输出的CGI_STDOUT记录原样转发给客户
+    void run_cgi(const char *file_name){
+        bool classic = false;
+        CgiWorker *worker = m_workers.acquire(file_name, classic);
+        if(!worker){
+            if(classic){
+                run_classic(file_name);
+            }
+            return;
+        }
+        static uint16_t request_id = 0;
+        ++request_id;
+        char params[CgiWorkerPool::PATH_LEN + 64];
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &m_address.sin_addr, ip, sizeof(ip));
+        int len = snprintf(params, sizeof(params), "SCRIPT_FILENAME=%s", file_name) + 1;
+        len += snprintf(params + len, sizeof(params) - len, "REMOTE_ADDR=%s", ip) + 1;
+
+        bool broken = !cgi_write_record(worker->m_fd, CGI_BEGIN, request_id, NULL, 0)
+                      || !cgi_write_record(worker->m_fd, CGI_PARAMS, request_id, params, len);
+        bool client_ok = true;
+        CgiRecordHeader header;
+        while(!broken){
+            if(!cgi_read_record(worker->m_fd, header, m_record, CGI_MAX_CONTENT) || header.request_id != request_id){
+                broken = true;
+                break;
+            }
+            if(header.type == CGI_END){
+                break;
+            }
+            //客户已经断开时仍然要读完这个请求的记录，工作进程才能继续处理下一个请求
+            if(header.type == CGI_STDOUT && client_ok){
+                client_ok = send_all(m_record, header.content_length);
+            }
+        }
+        m_workers.release(worker, broken);
+    }
+
+    //不支持cgi_worker_serve的传统CGI程序：子进程将标准输出重定向到m_sock_fd，并执行CGI程序
+    void run_classic(const char *file_name){
+        pid_t pid = fork();
+        if(pid == 0){
+            close(STDOUT_FILENO);
+            dup(m_sock_fd);
+            execl(file_name, file_name, NULL);
+            exit(0);
+        }
+    }
+
+    //客户socket是非阻塞的，发送缓冲区满时等待可写
+    bool send_all(const char *data, size_t len){
+        while(len > 0){
+            ssize_t ret = send(m_sock_fd, data, len, 0);
+            if(ret < 0){
+                if(errno == EINTR){
+                    continue;
                 }
-                else if(ret > 0){
-                    //父进程只需要关闭连接
-                    delFd(m_epoll_fd, m_sock_fd);
-                    break;
-                }else{
-                    //子进程将标准输出重定向到m_sock_fd，并执行CGI程序
-                    close(STDOUT_FILENO);
-                    dup(m_sock_fd);
-                    execl(m_buf, m_buf, NULL);
-                    exit(0);
+                struct pollfd pfd;
+                pfd.fd = m_sock_fd;
+                pfd.events = POLLOUT;
+                if(errno != EAGAIN || poll(&pfd, 1, SEND_TIMEOUT) <= 0){
+                    return false;
                 }
+                continue;
             }
+            data += ret;
+            len -= ret;
         }
+        return true;
     }
 
 private:
     static const int BUFFER_SIZE = 1024;
+    //等待客户socket可写的最长时间，单位毫秒
+    static const int SEND_TIMEOUT = 5000;
     static int m_epoll_fd;
+    //每个进程池子进程都有自己的CGI工作进程
+    static CgiWorkerPool m_workers;
+    //从工作进程读取记录的缓冲区
+    static char m_record[CGI_MAX_CONTENT];
     int m_sock_fd;
     sockaddr_in m_address;
     char m_buf[BUFFER_SIZE];
@@ -92,8 +162,10 @@ private:
 };
 
 int CgiConn::m_epoll_fd = -1;
+CgiWorkerPool CgiConn::m_workers;
+char CgiConn::m_record[CGI_MAX_CONTENT];
 
-int main_PoolCgi(int argc, char *argv[]){
+int main(int argc, char *argv[]){
     if(argc < 2){
         //去掉路径输出文件名
         printf("usage: %s ip_address port_number\n", basename(argv[0]));
@@ -0,0 +1,142 @@
+//
+// 共享内存中的文件元数据缓存
+//
+
+#include "StatCache.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <new>
+
+StatCache::Slot *StatCache::m_slots = nullptr;
+int StatCache::m_valid_ms = 0;
+
+//FNV-1a哈希，结果为0时换成1，0留给空槽
+static uint64_t hash_path(const char *path){
+    uint64_t hash = 14695981039346656037ULL;
+    for(; *path; ++path){
+        hash ^= (unsigned char)*path;
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+//所有进程共用的单调时钟，精度为一个时钟节拍就够了
+static int64_t now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool StatCache::init(int valid_ms) {
+    void *slots = mmap(NULL, sizeof(Slot) * SLOT_NUMBER, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(slots == MAP_FAILED){
+        printf("failed to map the stat cache\n");
+        return false;
+    }
+    //匿名映射已经清零，placement new只是为了让std::atomic合法地存在于这块内存中
+    m_slots = new (slots) Slot[SLOT_NUMBER];
+    m_valid_ms = valid_ms;
+    return true;
+}
+
+int StatCache::fill(Slot &slot, const char *path, size_t len, uint64_t hash, uint32_t seq, struct stat *st) {
+    slot.owner = getpid();
+    //保证读者看到槽里的新数据之前，已经能看到奇数的序号
+    std::atomic_thread_fence(std::memory_order_release);
+    int ret = ::stat(path, st);
+    int error = ret < 0 ? errno : 0;
+    slot.st = *st;
+    slot.error = error;
+    slot.hash = hash;
+    memcpy(slot.path, path, len + 1);
+    slot.expire = now_ms() + m_valid_ms;
+    slot.seq.store(seq + 2, std::memory_order_release);
+    errno = error;
+    return ret;
+}
+
+int StatCache::stat(const char *path, struct stat *st) {
+    size_t len = strlen(path);
+    if(!m_slots || len >= PATH_LEN){
+        return ::stat(path, st);
+    }
+    uint64_t hash = hash_path(path);
+    int64_t now = now_ms();
+    //路径不在表中时替换探测范围内第一个过期的槽，都没有过期则替换第一个槽
+    Slot *victim = nullptr;
+
+    for(int i = 0; i < MAX_PROBE; ++i){
+        Slot &slot = m_slots[(hash + i) % SLOT_NUMBER];
+        int spin = 0;
+        uint32_t busy_seq = 0;
+        while(true){
+            uint32_t seq = slot.seq.load(std::memory_order_acquire);
+            if(seq & 1){
+                //别的进程正在写这个槽(很可能正在stat同一个文件)，等它写完再读。序号变了说明换了写者，重新计数
+                if(seq != busy_seq){
+                    busy_seq = seq;
+                    spin = 0;
+                }
+                if(++spin > MAX_SPIN){
+                    //写者在写的过程中退出时序号会永远是奇数，由读者接管：把序号再加2(仍为奇数)后重新写这个槽
+                    if(kill(slot.owner, 0) < 0 && errno == ESRCH
+                       && slot.seq.compare_exchange_strong(seq, seq + 2, std::memory_order_acquire)){
+                        return fill(slot, path, len, hash, seq + 1, st);
+                    }
+                    return ::stat(path, st);
+                }
+                sched_yield();
+                continue;
+            }
+            //先把槽拷贝出来，再检查序号有没有变化，变了说明读的过程中被改写，重新读
+            uint64_t slot_hash = slot.hash;
+            int64_t expire = slot.expire;
+            int error = slot.error;
+            struct stat slot_st = slot.st;
+            //写者可能正在改写path，比较的长度不能超出槽
+            bool same = slot_hash == hash && strncmp(slot.path, path, PATH_LEN) == 0;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot.seq.load(std::memory_order_relaxed) != seq){
+                continue;
+            }
+
+            if(same && expire > now){
+                if(error){
+                    errno = error;
+                    return -1;
+                }
+                *st = slot_st;
+                return 0;
+            }
+            if(same || slot_hash == 0){
+                //过期的同一路径，或者空槽(路径只会插入探测范围内的第一个空槽，空槽之后不会有它)：
+                //抢到这个槽的进程负责stat，抢不到的重新读，等待抢到的进程写完
+                if(!slot.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)){
+                    continue;
+                }
+                return fill(slot, path, len, hash, seq, st);
+            }
+            if(!victim && expire <= now){
+                victim = &slot;
+            }
+            break;
+        }
+    }
+
+    if(!victim){
+        victim = &m_slots[hash % SLOT_NUMBER];
+    }
+    uint32_t seq = victim->seq.load(std::memory_order_acquire);
+    if((seq & 1) || !victim->seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)){
+        //替换的槽正在被别人写，这次不缓存
+        return ::stat(path, st);
+    }
+    return fill(*victim, path, len, hash, seq, st);
+}
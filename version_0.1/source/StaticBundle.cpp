@@ -0,0 +1,103 @@
+//
+// 静态资源包
+//
+
+#include "StaticBundle.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+std::shared_ptr<StaticBundle> StaticBundle::m_current;
+
+StaticBundle::~StaticBundle() {
+    if(m_address){
+        munmap(m_address, m_size);
+    }
+}
+
+std::shared_ptr<StaticBundle> StaticBundle::open(const char *file) {
+    int fd = ::open(file, O_RDONLY);
+    if(fd < 0){
+        return std::shared_ptr<StaticBundle>();
+    }
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) < 0 || (size_t)file_stat.st_size < sizeof(BundleHeader)){
+        close(fd);
+        return std::shared_ptr<StaticBundle>();
+    }
+
+    std::shared_ptr<StaticBundle> bundle(new StaticBundle());
+    bundle->m_size = file_stat.st_size;
+    //不用MAP_POPULATE：它会在启动和每次SIGHUP重新加载时把整个资源包读一遍。
+    //只预读头部和索引(查找时二分访问)，文件内容第一次被请求时再缺页
+    void *address = mmap(0, bundle->m_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(address == MAP_FAILED){
+        return std::shared_ptr<StaticBundle>();
+    }
+    const BundleHeader *header = (const BundleHeader *)address;
+    size_t index_size = sizeof(BundleHeader) + (size_t)header->entry_count * sizeof(BundleEntry);
+    madvise(address, index_size < bundle->m_size ? index_size : bundle->m_size, MADV_WILLNEED);
+    bundle->m_address = (char *)address;
+    bundle->m_header = (const BundleHeader *)address;
+    bundle->m_entries = (const BundleEntry *)(bundle->m_address + sizeof(BundleHeader));
+    if(!bundle->validate()){
+        return std::shared_ptr<StaticBundle>();
+    }
+    return bundle;
+}
+
+//检查所有偏移都落在文件内，之后查找时不再做边界检查
+bool StaticBundle::validate() const {
+    if(memcmp(m_header->magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0 || m_header->file_size != m_size){
+        return false;
+    }
+    uint64_t count = m_header->entry_count;
+    if(sizeof(BundleHeader) + count * sizeof(BundleEntry) > m_size){
+        return false;
+    }
+    for(uint64_t i = 0; i < count; ++i){
+        const BundleEntry &entry = m_entries[i];
+        if(entry.path_offset + entry.path_len > m_size
+           || entry.header_offset + entry.header_len > m_size
+           || entry.data_offset + entry.data_len > m_size
+           || entry.gzip_header_offset + entry.gzip_header_len > m_size
+           || entry.gzip_offset + entry.gzip_len > m_size){
+            return false;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<StaticBundle> StaticBundle::current() {
+    return std::atomic_load(&m_current);
+}
+
+void StaticBundle::publish(const std::shared_ptr<StaticBundle> &bundle) {
+    std::atomic_store(&m_current, bundle);
+}
+
+const BundleEntry *StaticBundle::find(const char *url) const {
+    size_t url_len = strlen(url);
+    int low = 0;
+    int high = (int)m_header->entry_count - 1;
+    while(low <= high){
+        int mid = low + (high - low) / 2;
+        const BundleEntry &entry = m_entries[mid];
+        size_t len = entry.path_len < url_len ? entry.path_len : url_len;
+        int cmp = memcmp(at(entry.path_offset), url, len);
+        if(cmp == 0){
+            cmp = entry.path_len < url_len ? -1 : (entry.path_len > url_len ? 1 : 0);
+        }
+        if(cmp == 0){
+            return &entry;
+        }else if(cmp < 0){
+            low = mid + 1;
+        }else{
+            high = mid - 1;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,176 @@
+//
+// HTTPS支持：OpenSSL握手 + kTLS
+//
+
+#include "TlsContext.h"
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+struct ssl_ctx_st *TlsContext::m_ctx = nullptr;
+
+#ifdef WEBSERVER_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+bool TlsContext::init(const char *cert_file, const char *key_file) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if(!ctx){
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+#ifdef SSL_OP_ENABLE_KTLS
+    //握手完成后由OpenSSL通过setsockopt(TCP_ULP, "tls")把会话密钥交给内核。
+    //OpenSSL 3.0才支持kTLS，更早的版本(如Ubuntu 20.04的1.1.1)始终用SSL_read/SSL_write
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+    //内核只实现了AES-GCM和CHACHA20-POLY1305，只协商这几种套件才能保证kTLS可用
+    SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256");
+    SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    //非阻塞socket上SSL_write可能只写出一部分，下一次可以从新的位置继续写
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    //会话复用：TLS1.2使用服务端会话缓存和会话票据，TLS1.3在握手后下发一张无状态的会话票据
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"WebServer", 9);
+    SSL_CTX_set_num_tickets(ctx, 1);
+
+    if(SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1
+       || SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1
+       || SSL_CTX_check_private_key(ctx) != 1){
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    m_ctx = ctx;
+    return true;
+}
+
+bool TlsConn::attach(int sock_fd) {
+    reset();
+    m_ssl = SSL_new(TlsContext::get());
+    if(!m_ssl){
+        return false;
+    }
+    SSL_set_fd(m_ssl, sock_fd);
+    SSL_set_accept_state(m_ssl);
+    return true;
+}
+
+void TlsConn::reset() {
+    if(m_ssl){
+        if(m_established){
+            //非阻塞socket上只尝试一次，不等待对方的close_notify
+            SSL_shutdown(m_ssl);
+            ERR_clear_error();
+        }
+        SSL_free(m_ssl);
+        m_ssl = nullptr;
+    }
+    m_ktls_send = false;
+    m_ktls_recv = false;
+    m_established = false;
+    m_want_write = false;
+}
+
+TlsConn::HANDSHAKE TlsConn::handshake() {
+    //OpenSSL的错误队列是线程局部的，先清空以免读到其他连接留下的错误
+    ERR_clear_error();
+    int ret = SSL_do_handshake(m_ssl);
+    m_want_write = false;
+    if(ret == 1){
+        m_established = true;
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send)
+        m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+        m_ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(m_ssl));
+#endif
+        return HS_DONE;
+    }
+    switch (SSL_get_error(m_ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            return HS_WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            m_want_write = true;
+            return HS_WANT_WRITE;
+        default:
+            return HS_ERROR;
+    }
+}
+
+ssize_t TlsConn::recv(char *buf, size_t len) {
+    ERR_clear_error();
+    //kTLS接管接收方向时，SSL_read内部直接从内核读取解密后的数据
+    int ret = SSL_read(m_ssl, buf, (int)len);
+    if(ret > 0){
+        return ret;
+    }
+    switch (SSL_get_error(m_ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        default:
+            errno = ECONNRESET;
+            return -1;
+    }
+}
+
+ssize_t TlsConn::writev(int sock_fd, const struct iovec *iov, int iov_count) {
+    //内核负责加密，mmap的文件内容直接交给内核，不经过用户态的加密缓冲区
+    if(m_ktls_send){
+        return ::writev(sock_fd, iov, iov_count);
+    }
+
+    ERR_clear_error();
+    ssize_t total = 0;
+    for(int i = 0; i < iov_count; ++i){
+        if(iov[i].iov_len == 0){
+            continue;
+        }
+        int ret = SSL_write(m_ssl, iov[i].iov_base, (int)iov[i].iov_len);
+        if(ret <= 0){
+            if(total > 0){
+                return total;
+            }
+            int err = SSL_get_error(m_ssl, ret);
+            errno = (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) ? EAGAIN : EPIPE;
+            return -1;
+        }
+        total += ret;
+        if((size_t)ret < iov[i].iov_len){
+            return total;
+        }
+    }
+    return total;
+}
+
+#else
+
+bool TlsContext::init(const char *cert_file, const char *key_file) {
+    printf("WebServer was built without WEBSERVER_TLS\n");
+    return false;
+}
+
+bool TlsConn::attach(int sock_fd) {
+    return false;
+}
+
+void TlsConn::reset() {
+}
+
+TlsConn::HANDSHAKE TlsConn::handshake() {
+    return HS_ERROR;
+}
+
+ssize_t TlsConn::recv(char *buf, size_t len) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t TlsConn::writev(int sock_fd, const struct iovec *iov, int iov_count) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
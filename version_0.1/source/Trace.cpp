@@ -0,0 +1,137 @@
+//
+// 请求跟踪
+//
+
+#include "Trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+static_assert(sizeof(TraceRecord) == 104, "TraceRecord is part of the file format");
+
+const char *Trace::m_file = nullptr;
+int Trace::m_sample_every = 0;
+std::atomic<Trace::Ring *> Trace::m_rings[Trace::MAX_RINGS];
+std::atomic<int> Trace::m_ring_number(0);
+std::atomic<uint64_t> Trace::m_dropped(0);
+
+bool Trace::init(const char *file, int sample_every) {
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        printf("failed to open trace file %s: %s\n", file, strerror(errno));
+        return false;
+    }
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(TraceRecord);
+    header.phase_number = PHASE_NUMBER;
+    bool ok = ::write(fd, &header, sizeof(header)) == sizeof(header);
+    close(fd);
+    if(!ok){
+        printf("failed to write trace file %s\n", file);
+        return false;
+    }
+    m_file = file;
+    m_sample_every = sample_every > 0 ? sample_every : 1;
+    return true;
+}
+
+void Trace::mark(TraceRecord &record, TRACE_PHASE phase, uint64_t now) {
+    if(phase == T_START){
+        record.start = now;
+        return;
+    }
+    if(record.phase[phase] == 0){
+        uint64_t delta = now > record.start ? now - record.start : 0;
+        //0表示没有经过这个阶段，超过32位的时间按最大值记录
+        record.phase[phase] = delta == 0 ? 1 : (delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta);
+    }
+}
+
+Trace::Ring *Trace::ring() {
+    static thread_local Ring *t_ring = nullptr;
+    static thread_local bool t_full = false;
+    if(!t_ring && !t_full){
+        int idx = m_ring_number.fetch_add(1);
+        if(idx >= MAX_RINGS){
+            t_full = true;
+            return nullptr;
+        }
+        t_ring = new Ring;
+        t_ring->head.store(0);
+        t_ring->dumped = 0;
+        m_rings[idx].store(t_ring, std::memory_order_release);
+    }
+    return t_ring;
+}
+
+void Trace::commit(const TraceRecord &record) {
+    Ring *r = ring();
+    if(!r){
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    r->records[head % RING_SIZE] = record;
+    r->records[head % RING_SIZE].pid = getpid();
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+void Trace::dump() {
+    if(!m_file){
+        return;
+    }
+    std::vector<TraceRecord> out;
+    int ring_number = m_ring_number.load();
+    if(ring_number > MAX_RINGS){
+        ring_number = MAX_RINGS;
+    }
+    for(int i = 0; i < ring_number; ++i){
+        Ring *r = m_rings[i].load(std::memory_order_acquire);
+        if(!r){
+            continue;
+        }
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        uint64_t from = head > RING_SIZE ? head - RING_SIZE : 0;
+        if(from < r->dumped){
+            from = r->dumped;
+        }
+        size_t first = out.size();
+        for(uint64_t seq = from; seq < head; ++seq){
+            out.push_back(r->records[seq % RING_SIZE]);
+        }
+        //拷贝期间写者可能已经在覆盖最老的记录：写者正在写第n条时，第n - RING_SIZE条不再可信
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t now_head = r->head.load(std::memory_order_relaxed);
+        uint64_t valid_from = now_head + 1 > RING_SIZE ? now_head + 1 - RING_SIZE : 0;
+        if(valid_from > from){
+            uint64_t torn = valid_from - from < head - from ? valid_from - from : head - from;
+            out.erase(out.begin() + first, out.begin() + first + torn);
+            from += torn;
+        }
+        m_dropped.fetch_add(from - r->dumped, std::memory_order_relaxed);
+        r->dumped = head;
+    }
+    if(out.empty()){
+        return;
+    }
+
+    //以O_APPEND方式一次写入，多个进程写同一个文件时记录不会交错
+    int fd = open(m_file, O_WRONLY | O_APPEND);
+    if(fd < 0){
+        return;
+    }
+    size_t len = out.size() * sizeof(TraceRecord);
+    if(::write(fd, out.data(), len) != (ssize_t)len){
+        printf("failed to write trace file %s\n", m_file);
+    }
+    close(fd);
+    uint64_t dropped = m_dropped.exchange(0);
+    if(dropped){
+        printf("trace: %llu records dropped\n", (unsigned long long)dropped);
+    }
+}
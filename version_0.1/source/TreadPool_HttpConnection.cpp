@@ -7,31 +7,51 @@
 #include "ThreadPool.h"
 #include "HttpConnection.h"
 #include "TimeHeap.h"
+#include "HotSet.h"
+#include "ProcessPool.h"
+#include "StatCache.h"
+#include "Upgrade.h"
 
 #define MAX_FD 65535
 #define MAX_EVENT_NUMBER 10000
 
 extern int addFd(int epoll_fd, int fd, bool one_shot);
-extern int delFd(int epoll_fd, int fd);
+extern const char *doc_root;
 
 Locker timeHeapLock;
 TimeHeap timeHeap(100);
+ServerConfig config;
+//收到SIGINT/SIGTERM后置为true，主循环退出
+static volatile sig_atomic_t stop_server = 0;
+//收到SIGHUP后置为true，主循环重新加载静态资源包并重新打开访问日志
+static volatile sig_atomic_t reload_bundle = 0;
+//收到SIGQUIT后置为true，停止accept，等已有的连接处理完再退出
+static volatile sig_atomic_t drain_server = 0;
+//收到SIGUSR2后置为true，启动新的可执行文件并把监听socket交给它
+static volatile sig_atomic_t upgrade_server = 0;
 
-void addSig(int sig, void (*handler)(int), bool restart = true){
-    struct sigaction sa;
-    memset(&sa, 0, sizeof (sa));
-    sa.sa_handler = handler;
-    if(restart){
-        sa.sa_flags |= SA_RESTART;
+//addSig使用ProcessPool.h中的定义，那里的sig_handler属于进程池的父进程
+void server_sig_handler(int sig){
+    if(sig == SIGHUP){
+        reload_bundle = 1;
+    }else if(sig == SIGQUIT){
+        drain_server = 1;
+    }else if(sig == SIGUSR2){
+        upgrade_server = 1;
+    }else{
+        stop_server = 1;
     }
-    sigfillset(&sa.sa_mask);
-    assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-void show_error(int conn_fd, const char *info){
-    printf("%s", info);
-    send(conn_fd, info, strlen(info), 0);
-    close(conn_fd);
+//重新打开资源包文件并原子地替换，失败时继续使用旧的资源包
+void reload_static_bundle(){
+    std::shared_ptr<StaticBundle> bundle = StaticBundle::open(config.bundle_file);
+    if(!bundle){
+        printf("failed to reload bundle %s, keep the old one\n", config.bundle_file);
+        return;
+    }
+    StaticBundle::publish(bundle);
+    printf("bundle %s reloaded, %u files\n", config.bundle_file, bundle->size());
 }
 
 void handle_expired_conn(){
@@ -39,8 +59,9 @@ void handle_expired_conn(){
     while (!timeHeap.empty()){
         Timer* timer = timeHeap.top();
         if(!timer->isvalid()){
-            //过期了
-            if(timer->conn){
+            //过期了，非ONESHOT模式下正被工作线程拥有的连接由工作线程自己处理
+            if(timer->conn->idle()){
+                Metrics::inc(M_TIMER_EXPIRED);
                 timer->conn->close_conn();
             }
             timeHeap.pop_timer();
@@ -48,60 +69,119 @@ void handle_expired_conn(){
             break;
         }
     }
+    Metrics::set(G_TIMER_HEAP_ENTRIES, timeHeap.size());
+    Metrics::set(G_TIMER_HEAP_BYTES, timeHeap.bytes());
     timeHeapLock.unlock();
 }
 
-int main(int argc, char *argv[]){
-    if(argc < 2){
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
-        return 1;
+//把连接交给线程池，没有线程池时直接在主线程中处理。过载时在主线程中直接回复503并关闭连接，不经过工作线程
+void handle_request(ThreadPool<HttpConnection> *pool, HttpConnection *conn){
+    if(!pool){
+        conn->process();
+        return;
+    }
+    //只拒绝新的请求，发送到一半的应答继续交给工作线程
+    METRIC_COUNTER reason;
+    if(Admission::enabled() && !conn->responding() && !Admission::admit(pool->size(), conn->read_bytes(), reason)){
+        Metrics::inc(reason);
+        conn->shed();
+        return;
     }
+    conn->trace(T_QUEUED);
+    //放入队列之后连接就属于工作线程了，必须先记下占用的字节数
+    conn->hold_bytes(conn->read_bytes());
+    if(!pool->append(conn)){
+        //队列已满，不能让连接等到超时
+        conn->shed();
+    }
+}
 
-    const char* ip = argv[1];
-    int port = atoi(argv[2]);
+void usage(const char *prog){
+    printf("usage: %s [-r doc_root] [-a actor_model] [-o one_shot] [-n process_number] [-t thread_number] [-q queue_size] [-u read_buffer[,write_buffer]] [-A target_ms[,budget_mb]] [-c valid_ms] [-m metrics_path] [-x trace_file[,sample_every]] [-l access_log] [-C capture_file[,max_mb]] [-s cert_file -k key_file] [-b bundle_file] [-w hotset_file [-W budget_mb]] [-f prefix=backend[,max_conns]] [-p prefix=plugin.so[,arg]] ip_address port_number\n", prog);
+    printf("  -r      serve files under doc_root (default %s)\n", doc_root);
+    printf("  -a 0|1  0: simulated Proactor (default), 1: Reactor\n");
+    printf("  -o 0|1  register connections with EPOLLONESHOT (default 1), 0 implies -a 1\n");
+    printf("  -n      fork process_number servers sharing the listen socket, respawned when they die (default 1)\n");
+    printf("  -t      worker threads per server process (default 4), 0 handles requests in the event loop\n");
+    printf("  -q      requests that may wait in the thread pool queue (default 100000), further requests are answered with 503\n");
+    printf("  -u      bytes of the per-connection read buffer (default 2048, limits request headers and body) and write buffer (default 1024, limits response headers)\n");
+    printf("  -A      with a thread pool, answer 503 from the event loop once requests keep waiting in the queue longer than target_ms (0 disables), or once queued requests and unsent responses hold more than budget_mb\n");
+    printf("  -c      cache file metadata in memory shared by all server processes, trusting it for valid_ms\n");
+    printf("  -m      serve counters and latency histograms of the process in Prometheus text format at metrics_path\n");
+    printf("  -x      record the phase timings of one request in sample_every (default 1) to trace_file, see TraceDecode\n");
+    printf("  -l      append a Common Log Format line per response to access_log, written by a background thread\n");
+    printf("  -C      capture the raw bytes and timing of every connection to capture_file (up to max_mb, default 256) for loadgen -r\n");
+    printf("  -s -k   serve HTTPS with the PEM certificate chain and private key, using kTLS when available\n");
+    printf("  -b      serve every request from a bundle packed by BundlePack, reloaded on SIGHUP\n");
+    printf("  -w -W   save the most requested paths to hotset_file and warm them up (mlock up to budget_mb, default 64) at startup\n");
+    printf("  -f      pass requests under prefix to a FastCGI backend (unix:/path or ip:port), at most max_conns (default 8) at a time, repeatable\n");
+    printf("  -p      dlopen a handler plugin (see PluginApi.h) and bind it to prefix, arg is passed to its init, repeatable\n");
+    printf("signals: SIGHUP reloads the bundle and reopens the access log, SIGQUIT stops accepting and drains connections, SIGUSR2 hands the listening socket to a newly exec'd binary and then drains\n");
+}
 
+//一个服务进程的事件循环。idx为它在进程池中的序号，单进程运行时为-1
+int serve(int listen_fd, int idx){
     //忽略SIGPIPE信号
     addSig(SIGPIPE, SIG_IGN);
+    //不自动重启被中断的epoll_wait，以便及时退出主循环
+    addSig(SIGINT, server_sig_handler, false);
+    addSig(SIGTERM, server_sig_handler, false);
+    addSig(SIGHUP, server_sig_handler, false);
+    addSig(SIGQUIT, server_sig_handler, false);
+    addSig(SIGUSR2, server_sig_handler, false);
 
-    //创建线程池
+    //创建线程池。多进程时线程池在fork之后由每个子进程自己创建
     ThreadPool<HttpConnection> *pool = NULL;
-    try{
-        pool = new ThreadPool<HttpConnection>();
-    }catch (...){
-        return 1;
+    if(config.thread_number > 0){
+        try{
+            pool = new ThreadPool<HttpConnection>(config.thread_number, config.queue_size);
+        }catch (...){
+            return 1;
+        }
     }
 
-    //预先为每个可能的客户连接分配一个HttpConnection对象,最大65535个客户连接
-    HttpConnection *users = new HttpConnection[MAX_FD];
-    assert(users);
-    int user_count = 0;
-
-    int listen_fd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listen_fd >= 0);
-    struct linger tmp = {1, 0};
-    setsockopt(listen_fd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
-
-    int ret = 0;
-    struct sockaddr_in address;
-    memset(&address, 0, sizeof(address));
-    address.sin_family = AF_INET;
-    inet_pton(AF_INET, ip, &address.sin_addr);
-    address.sin_port = htons(port);
-
-    ret = bind(listen_fd, (struct sockaddr*)&address, sizeof (address));
-    assert(ret >= 0);
+    //写访问日志和捕获文件的线程同样在fork之后启动
+    if(!AccessLog::start() || !Capture::start()){
+        AccessLog::stop();
+        delete pool;
+        return 1;
+    }
 
-    ret = listen(listen_fd, 5);
-    assert(ret >= 0);
+    //描述符号作为下标的连接表，最大65535个客户连接。表中只是指针，连接对象(连同它的读写缓冲区)
+    //在描述符号第一次被accept时才创建，之后一直留给这个描述符号复用。没有用到的描述符号只占一个指针，
+    //不会在启动时就为每个可能的连接构造对象、占用几百MB的常驻内存
+    HttpConnection **users = new HttpConnection*[MAX_FD]();
+    int user_objects = 0;
+    Metrics::set(G_CONNECTION_SLOTS, MAX_FD);
+    Metrics::set(G_CONNECTION_BYTES, sizeof(HttpConnection) + HttpConnection::m_read_buffer_size
+                                     + HttpConnection::m_write_buffer_size);
 
     epoll_event events[MAX_EVENT_NUMBER];
     int epoll_fd = epoll_create(5);
     assert(epoll_fd != -1);
-    addFd(epoll_fd, listen_fd, false);
+    if(idx < 0){
+        addFd(epoll_fd, listen_fd, false);
+    }else{
+        //多个进程的epoll监听同一个socket，EPOLLEXCLUSIVE使一个新连接只唤醒其中一个进程
+        epoll_event event;
+        event.data.fd = listen_fd;
+        event.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    }
     HttpConnection::m_epoll_fd = epoll_fd;
 
-    while(true){
-        int number = epoll_wait(epoll_fd, events, MAX_EVENT_NUMBER, -1);
+    //热点文件由单进程或者0号子进程保存，需要定期保存时epoll_wait最多等待1秒
+    bool save_hotset = config.hotset_file && idx <= 0;
+    time_t next_hotset_save = time(nullptr) + HotSet::SAVE_INTERVAL;
+    //跟踪记录由每个进程的主线程定期追加到文件中
+    time_t next_trace_dump = time(nullptr) + Trace::DUMP_INTERVAL;
+    //升级时新进程的就绪管道，以及开始退出后等待已有连接的截止时间
+    int ready_fd = -1;
+    time_t drain_deadline = 0;
+    while(!stop_server){
+        //退出过程中每秒检查一次连接是否都已经关闭
+        int timeout = (save_hotset || drain_deadline || Trace::enabled()) ? 1000 : -1;
+        int number = epoll_wait(epoll_fd, events, MAX_EVENT_NUMBER, timeout);
         if((number < 0) && errno != EINTR){
             printf("epoll failure\n");
             break;
@@ -110,56 +190,432 @@ int main(int argc, char *argv[]){
         for(int i = 0; i < number; ++i){
             int sock_fd = events[i].data.fd;
             //如果是监听描述符号则会初始化客户端连接，此时要在这个连接被EPOLLIN之前添加计时器
-            if(sock_fd == listen_fd){
-                struct sockaddr_in client_address;
-                socklen_t client_addr_len = sizeof (client_address);
-                int conn_fd = accept(listen_fd, (sockaddr*)&client_address, &client_addr_len);
-                if(conn_fd < 0){
-                    printf("errno is : %d\n", errno);
-                    continue;
-                }
-                if(HttpConnection::m_user_count >= MAX_FD){
-                    show_error(conn_fd, "Internal server busy");
-                    continue;
+            if(sock_fd == ready_fd){
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ready_fd, 0);
+                //新进程就绪后才停止accept，在此之前两个进程都在accept
+                if(BinaryUpgrade::finish(ready_fd)){
+                    drain_server = 1;
                 }
-                //新建定时器
-                Timer* timer = new Timer(100000, &users[conn_fd]);
-                //将timer指针保存在HttpConnection中，方便通过HttpConnection直接获取它对应的timer
-                users[conn_fd].setTimer(timer);
-                //放入事件堆，开始计时
-                users[conn_fd].startTimer(timer);
+                ready_fd = -1;
+            }else if(sock_fd == listen_fd){
+                //监听socket以ET模式注册，一次事件可能对应多个已完成的连接，必须accept到EAGAIN为止，
+                //否则剩下的连接要等下一个新连接到来时才会被accept
+                while(true){
+                    struct sockaddr_in client_address;
+                    socklen_t client_addr_len = sizeof (client_address);
+                    int conn_fd = accept(listen_fd, (sockaddr*)&client_address, &client_addr_len);
+                    if(conn_fd < 0){
+                        if(errno != EAGAIN && errno != EWOULDBLOCK){
+                            printf("errno is : %d\n", errno);
+                        }
+                        break;
+                    }
+                    //描述符号直接作为users的下标，进程打开的文件数上限超过MAX_FD时也不能越界
+                    if(HttpConnection::m_user_count >= MAX_FD || conn_fd >= MAX_FD){
+                        Metrics::inc(M_SHED_CONNECTIONS);
+                        //HTTPS连接上不能写入明文的503，与shed()一样只关闭连接
+                        if(!TlsContext::enabled()){
+                            Admission::reject(conn_fd);
+                        }
+                        close(conn_fd);
+                        continue;
+                    }
+                    if(!users[conn_fd]){
+                        users[conn_fd] = new HttpConnection;
+                        Metrics::set(G_CONNECTION_OBJECTS, ++user_objects);
+                    }
+                    //连接对象内嵌的定时器放入事件堆，开始计时
+                    users[conn_fd]->startTimer();
 
-                //初始化客户连接
-                users[conn_fd].init(conn_fd, client_address);
-                //新增时间信息
+                    //初始化客户连接
+                    users[conn_fd]->init(conn_fd, client_address);
+                }
+            }else if(!config.one_shot){
+                //非ONESHOT模式下所有事件都交给拥有该连接的工作线程处理，连接空闲时才放入请求队列
+                if(users[sock_fd]->acquire()){
+                    users[sock_fd]->separateTimer();
+                    handle_request(pool, users[sock_fd]);
+                }
             }else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
                 //如果有异常，直接关闭客户连接
-                users[sock_fd].close_conn();
+                users[sock_fd]->close_conn();
             }else if(events[i].events & EPOLLIN){
+                if(config.actor_model == REACTOR){
+                    //Reactor模式下由工作线程读取数据，同样需要先解绑定时器
+                    users[sock_fd]->separateTimer();
+                    users[sock_fd]->set_io_state(HttpConnection::IO_READ);
+                    handle_request(pool, users[sock_fd]);
+                    continue;
+                }
                 //根据读的结果，决定是将任务加到线程池还是关闭连接
-                if(users[sock_fd].read()){
+                if(users[sock_fd]->read()){
                     //在放入线程池之前先要解绑HttpConnection与timer
                     //防止在读取时由于超时而中途关闭连接
                     //但是在HttpConnection重置连接时又需要重新绑定
-                    users[sock_fd].separateTimer();
-                    pool->append(users + sock_fd);
+                    users[sock_fd]->separateTimer();
+                    handle_request(pool, users[sock_fd]);
                 }else{
-                    users[sock_fd].close_conn();
+                    users[sock_fd]->close_conn();
                 }
             }else if(events[i].events & EPOLLOUT){
+                if(config.actor_model == REACTOR){
+                    users[sock_fd]->set_io_state(HttpConnection::IO_WRITE);
+                    handle_request(pool, users[sock_fd]);
+                    continue;
+                }
                 //根据写的结果，决定是否关闭连接
-                if(!users[sock_fd].write()){
-                    users[sock_fd].close_conn();
+                if(!users[sock_fd]->write()){
+                    users[sock_fd]->close_conn();
                 }
             }else{
 
             }
         }
+        if(reload_bundle){
+            reload_bundle = 0;
+            if(config.bundle_file){
+                reload_static_bundle();
+            }
+            AccessLog::reopen();
+        }
+        if(save_hotset && time(nullptr) >= next_hotset_save){
+            HotSet::save(config.hotset_file);
+            next_hotset_save = time(nullptr) + HotSet::SAVE_INTERVAL;
+        }
+        if(Trace::enabled() && time(nullptr) >= next_trace_dump){
+            Trace::dump();
+            next_trace_dump = time(nullptr) + Trace::DUMP_INTERVAL;
+        }
+        if(upgrade_server){
+            upgrade_server = 0;
+            if(idx >= 0){
+                printf("send SIGUSR2 to the parent process to upgrade\n");
+            }else if(ready_fd == -1 && !drain_deadline){
+                ready_fd = BinaryUpgrade::start(listen_fd);
+                if(ready_fd >= 0){
+                    epoll_event event;
+                    event.data.fd = ready_fd;
+                    event.events = EPOLLIN;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ready_fd, &event);
+                }
+            }
+        }
+        if(drain_server && !drain_deadline){
+            //监听socket还留在新进程(或其它子进程)中，accept队列里的连接由它们接收
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, 0);
+            HttpConnection::m_draining = true;
+            drain_deadline = time(nullptr) + BinaryUpgrade::DRAIN_TIMEOUT;
+            printf("stop accepting, draining connections\n");
+        }
+        if(drain_deadline){
+            bool open = false;
+            for(int fd = 0; fd < MAX_FD && !open; ++fd){
+                open = users[fd] && users[fd]->is_open();
+            }
+            if(!open || time(nullptr) >= drain_deadline){
+                break;
+            }
+        }
         handle_expired_conn();
     }
+    if(save_hotset){
+        HotSet::save(config.hotset_file);
+    }
+    HttpConnection::print_epoll_stats();
     close(epoll_fd);
     close(listen_fd);
-    delete [] users;
+    //先等工作线程退出，它们可能还在process()中访问连接对象和它的缓冲区，或者正在执行插件的handle，
+    //之后才能调用插件的fini、释放连接
     delete pool;
+    PluginHost::shutdown();
+    for(int fd = 0; fd < MAX_FD; ++fd){
+        delete users[fd];
+    }
+    delete [] users;
+    //退出前写出剩下的记录，dump只写出已经完整写入环中的记录
+    Trace::dump();
+    AccessLog::stop();
+    Capture::stop();
     return 0;
-}
\ No newline at end of file
+}
+
+//多进程时每个子进程共享监听socket，运行完整的serve
+template<>
+struct ProcessPoolTraits<HttpConnection>{
+    typedef SharedListenTag mode;
+    static int serve(int listen_fd, int idx){
+        return ::serve(listen_fd, idx);
+    }
+    //父进程收到SIGUSR2时启动新的可执行文件，新进程就绪后父进程让子进程退出
+    static int upgrade(int listen_fd){
+        return BinaryUpgrade::start(listen_fd);
+    }
+    static bool upgraded(int ready_fd){
+        return BinaryUpgrade::finish(ready_fd);
+    }
+};
+
+int main(int argc, char *argv[]){
+    int opt = 0;
+    const char *cert_file = NULL;
+    const char *key_file = NULL;
+    BinaryUpgrade::save_argv(argv);
+    while((opt = getopt(argc, argv, "r:a:o:n:t:q:u:A:c:m:x:l:C:s:k:b:w:W:f:p:")) != -1){
+        switch (opt) {
+            case 'r':
+            {
+                struct stat st;
+                if(stat(optarg, &st) < 0 || !S_ISDIR(st.st_mode)){
+                    printf("doc_root %s is not a directory\n", optarg);
+                    return 1;
+                }
+                doc_root = optarg;
+                break;
+            }
+            case 'a':
+            {
+                config.actor_model = atoi(optarg) == 1 ? REACTOR : PROACTOR;
+                break;
+            }
+            case 'o':
+            {
+                config.one_shot = atoi(optarg) != 0;
+                break;
+            }
+            case 'n':
+            {
+                config.process_number = atoi(optarg);
+                break;
+            }
+            case 't':
+            {
+                config.thread_number = atoi(optarg);
+                break;
+            }
+            case 'q':
+            {
+                config.queue_size = atoi(optarg);
+                if(config.queue_size < 1){
+                    printf("queue_size must be at least 1\n");
+                    return 1;
+                }
+                break;
+            }
+            case 'u':
+            {
+                //-u read_buffer[,write_buffer]，单位字节
+                char *comma = strchr(optarg, ',');
+                if(comma){
+                    *comma = '\0';
+                    config.write_buffer_size = atoi(comma + 1);
+                }
+                config.read_buffer_size = atoi(optarg);
+                if(config.read_buffer_size < 512 || config.read_buffer_size > HttpConnection::MAX_READ_BUFFER_SIZE
+                   || config.write_buffer_size < 256 || config.write_buffer_size > HttpConnection::MAX_WRITE_BUFFER_SIZE){
+                    printf("buffer sizes must be within 512-%d (read) and 256-%d (write) bytes\n",
+                           HttpConnection::MAX_READ_BUFFER_SIZE, HttpConnection::MAX_WRITE_BUFFER_SIZE);
+                    return 1;
+                }
+                break;
+            }
+            case 'A':
+            {
+                //-A target_ms[,budget_mb]
+                char *comma = strchr(optarg, ',');
+                if(comma){
+                    *comma = '\0';
+                    config.admission_budget_mb = atoi(comma + 1);
+                }
+                config.admission_target_ms = atoi(optarg);
+                if(config.admission_target_ms < 0 || config.admission_budget_mb < 0){
+                    printf("admission target and budget must not be negative\n");
+                    return 1;
+                }
+                break;
+            }
+            case 'c':
+            {
+                config.stat_cache_ms = atoi(optarg);
+                break;
+            }
+            case 'm':
+            {
+                config.metrics_path = optarg;
+                break;
+            }
+            case 'x':
+            {
+                //-x trace_file[,sample_every]
+                char *comma = strchr(optarg, ',');
+                if(comma){
+                    *comma = '\0';
+                    config.trace_sample = atoi(comma + 1);
+                }
+                config.trace_file = optarg;
+                break;
+            }
+            case 'l':
+            {
+                config.access_log = optarg;
+                break;
+            }
+            case 'C':
+            {
+                //-C capture_file[,max_mb]
+                char *comma = strchr(optarg, ',');
+                if(comma){
+                    *comma = '\0';
+                    config.capture_max_mb = atoi(comma + 1);
+                }
+                config.capture_file = optarg;
+                break;
+            }
+            case 's':
+            {
+                cert_file = optarg;
+                break;
+            }
+            case 'k':
+            {
+                key_file = optarg;
+                break;
+            }
+            case 'b':
+            {
+                config.bundle_file = optarg;
+                break;
+            }
+            case 'w':
+            {
+                config.hotset_file = optarg;
+                break;
+            }
+            case 'W':
+            {
+                config.hotset_budget = (size_t)atoi(optarg) << 20;
+                break;
+            }
+            case 'f':
+            {
+                if(!FastCgi::add_backend(optarg)){
+                    printf("invalid fastcgi backend %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case 'p':
+            {
+                if(!PluginHost::load(optarg)){
+                    printf("failed to load plugin %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            default:
+            {
+                usage(basename(argv[0]));
+                return 1;
+            }
+        }
+    }
+    if(argc - optind < 2){
+        usage(basename(argv[0]));
+        return 1;
+    }
+
+    if(config.process_number < 1 || config.process_number > 16 || config.thread_number < 0){
+        usage(basename(argv[0]));
+        return 1;
+    }
+    //连接对象在fork之后才创建，构造时按这个大小分配缓冲区
+    HttpConnection::m_read_buffer_size = config.read_buffer_size;
+    HttpConnection::m_write_buffer_size = config.write_buffer_size;
+    if(config.admission_target_ms > 0 || config.admission_budget_mb > 0){
+        Admission::init(config.admission_target_ms, (uint64_t)config.admission_budget_mb << 20);
+    }
+
+    if(!config.one_shot && config.actor_model != REACTOR){
+        //非ONESHOT模式下主线程不能替工作线程读写，否则两个线程会同时访问连接
+        printf("one_shot disabled, switch to Reactor mode\n");
+        config.actor_model = REACTOR;
+    }
+
+    if(cert_file || key_file){
+        if(!cert_file || !key_file || !TlsContext::init(cert_file, key_file)){
+            printf("failed to load certificate %s and key %s\n", cert_file, key_file);
+            return 1;
+        }
+    }
+
+    if(config.bundle_file){
+        std::shared_ptr<StaticBundle> bundle = StaticBundle::open(config.bundle_file);
+        if(!bundle){
+            printf("failed to load bundle %s\n", config.bundle_file);
+            return 1;
+        }
+        StaticBundle::publish(bundle);
+    }
+
+    //共享内存必须在fork出服务进程之前映射
+    if(config.stat_cache_ms > 0 && !config.bundle_file && !StatCache::init(config.stat_cache_ms)){
+        return 1;
+    }
+
+    if(config.trace_file && !Trace::init(config.trace_file, config.trace_sample)){
+        return 1;
+    }
+    if(config.access_log && !AccessLog::init(config.access_log)){
+        return 1;
+    }
+    if(config.capture_file && !Capture::init(config.capture_file, (uint64_t)config.capture_max_mb << 20)){
+        return 1;
+    }
+
+    const char* ip = argv[optind];
+    int port = atoi(argv[optind + 1]);
+
+    //升级启动时直接使用旧进程的监听socket，不再bind/listen，已经在accept队列中的连接不会丢失
+    int listen_fd = BinaryUpgrade::inherited_listen_fd();
+    bool inherited = listen_fd >= 0;
+    int ret = 0;
+    if(!inherited){
+        listen_fd = socket(PF_INET, SOCK_STREAM, 0);
+        assert(listen_fd >= 0);
+        //不再设置SO_LINGER为{1, 0}：accept得到的socket会继承这个选项，close时直接发送RST，
+        //"Connection: close"的应答(尤其是TLS记录)还在发送缓冲区中就被丢弃了
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        inet_pton(AF_INET, ip, &address.sin_addr);
+        address.sin_port = htons(port);
+
+        ret = bind(listen_fd, (struct sockaddr*)&address, sizeof (address));
+        assert(ret >= 0);
+    }
+
+    //在开始监听之前预热上次运行时的热点文件，第一批请求不会落在冷的page cache上
+    if(config.hotset_file && !config.bundle_file){
+        HotSet::warmup(config.hotset_file, doc_root, config.hotset_budget);
+    }
+
+    if(!inherited){
+        //升级时新旧进程交接的短暂间隔内连接都在accept队列中排队，队列太短会丢弃SYN，客户端要等1秒重传
+        ret = listen(listen_fd, SOMAXCONN);
+        assert(ret >= 0);
+    }
+
+    //初始化都已经完成，旧进程可以停止accept了。在这之后到事件循环开始之间到来的连接留在accept队列中
+    BinaryUpgrade::notify_ready();
+    if(config.process_number == 1){
+        return serve(listen_fd, -1);
+    }
+    //子进程在serve返回后直接退出，只有父进程会从run返回
+    setNonBlocking(listen_fd);
+    ProcessPool<HttpConnection> *process_pool = ProcessPool<HttpConnection>::create(listen_fd, config.process_number);
+    process_pool->run();
+    PluginHost::shutdown();
+    close(listen_fd);
+    delete process_pool;
+    return 0;
+}
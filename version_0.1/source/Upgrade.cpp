@@ -0,0 +1,140 @@
+//
+// 不停机升级
+//
+
+#include "Upgrade.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <vector>
+
+//升级时传给新进程的两个文件描述符
+#define LISTEN_FD_ENV "WEBSERVER_LISTEN_FD"
+#define READY_FD_ENV "WEBSERVER_READY_FD"
+
+extern char **environ;
+
+char **BinaryUpgrade::m_argv = nullptr;
+
+void BinaryUpgrade::save_argv(char **argv) {
+    m_argv = argv;
+}
+
+//读出并删除环境变量中的文件描述符，免得它再被传给之后exec的进程
+static int take_fd_env(const char *name){
+    const char *value = getenv(name);
+    if(!value){
+        return -1;
+    }
+    int fd = atoi(value);
+    unsetenv(name);
+    if(fd < 0 || fcntl(fd, F_GETFD) < 0){
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+int BinaryUpgrade::inherited_listen_fd() {
+    int fd = take_fd_env(LISTEN_FD_ENV);
+    if(fd < 0){
+        return -1;
+    }
+    //确认继承来的确实是一个正在监听的socket
+    int listening = 0;
+    socklen_t len = sizeof(listening);
+    if(getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) != 0 || !listening){
+        printf("inherited fd %d is not a listening socket\n", fd);
+        close(fd);
+        return -1;
+    }
+    printf("listening socket inherited from the old process\n");
+    return fd;
+}
+
+void BinaryUpgrade::notify_ready() {
+    int fd = take_fd_env(READY_FD_ENV);
+    if(fd < 0){
+        return;
+    }
+    char ready = 1;
+    if(::write(fd, &ready, 1) != 1){
+        printf("failed to notify the old process\n");
+    }
+    close(fd);
+}
+
+int BinaryUpgrade::start(int listen_fd) {
+    if(!m_argv){
+        return -1;
+    }
+    int ready_pipe[2];
+    if(pipe2(ready_pipe, O_CLOEXEC) != 0){
+        return -1;
+    }
+
+    //环境变量在fork之前准备好，子进程在exec之前只调用异步信号安全的函数
+    static char listen_env[64];
+    static char ready_env[64];
+    snprintf(listen_env, sizeof(listen_env), LISTEN_FD_ENV "=%d", listen_fd);
+    snprintf(ready_env, sizeof(ready_env), READY_FD_ENV "=%d", ready_pipe[1]);
+    std::vector<char *> envp;
+    for(char **env = environ; *env; ++env){
+        if(strncmp(*env, LISTEN_FD_ENV "=", strlen(LISTEN_FD_ENV) + 1) != 0
+           && strncmp(*env, READY_FD_ENV "=", strlen(READY_FD_ENV) + 1) != 0){
+            envp.push_back(*env);
+        }
+    }
+    envp.push_back(listen_env);
+    envp.push_back(ready_env);
+    envp.push_back(nullptr);
+
+    //先把缓冲的输出写出去，否则新进程会再输出一遍
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid < 0){
+        close(ready_pipe[0]);
+        close(ready_pipe[1]);
+        return -1;
+    }
+    if(pid == 0){
+        //新进程只继承监听socket和就绪管道的写端。客户连接的socket如果被它继承，旧进程关闭连接时TCP连接并不会真正关闭
+        //close_range的封装函数要glibc 2.34，直接发起系统调用；内核早于5.11时返回ENOSYS，逐个设置
+        int ret = -1;
+#ifdef SYS_close_range
+        ret = syscall(SYS_close_range, 3, ~0U, 1U << 2 /* CLOSE_RANGE_CLOEXEC */);
+#endif
+        if(ret != 0){
+            for(int fd = 3; fd < 65536; ++fd){
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+            }
+        }
+        fcntl(listen_fd, F_SETFD, 0);
+        fcntl(ready_pipe[1], F_SETFD, 0);
+        execvpe(m_argv[0], m_argv, envp.data());
+        _exit(127);
+    }
+
+    close(ready_pipe[1]);
+    fcntl(ready_pipe[0], F_SETFL, O_NONBLOCK);
+    printf("upgrading: started %s (pid %d)\n", m_argv[0], pid);
+    return ready_pipe[0];
+}
+
+bool BinaryUpgrade::finish(int ready_fd) {
+    char ready = 0;
+    //调用者只在epoll报告可读时调用：读到一个字节表示就绪，读到EOF表示新进程没有通知就退出了
+    ssize_t ret = read(ready_fd, &ready, 1);
+    close(ready_fd);
+    if(ret != 1){
+        printf("upgrade failed: the new process exited before it was ready\n");
+        return false;
+    }
+    printf("upgrade: the new process is ready, draining\n");
+    return true;
+}
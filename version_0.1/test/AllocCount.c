@@ -0,0 +1,148 @@
+/*
+ * 统计堆分配的预加载库：用LD_PRELOAD加载到WebServer中，替换malloc/calloc/realloc/free(operator new也经过malloc)。
+ * 进程收到ALLOC_SIGNAL后开始统计，再收到一次停止；统计期间每次分配都记录调用栈，相同的调用栈合并计数。
+ * 进程退出时把结果写入环境变量ALLOC_REPORT指定的文件(没有设置时写到标准错误)，格式为：
+ *     allocations <总次数>
+ *     stack <次数> <最近一次的字节数>
+ *     <backtrace_symbols_fd输出的各层>
+ * 用法: LD_PRELOAD=./libAllocCount.so ALLOC_REPORT=alloc.txt ./WebServer ip_address port
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <execinfo.h>
+
+#define ALLOC_SIGNAL (SIGRTMIN + 1)
+#define MAX_FRAMES 24
+#define MAX_STACKS 64
+
+/* glibc中分配函数的真正实现，不经过dlsym，避免dlsym自己分配内存造成递归 */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+struct stack{
+    void *frames[MAX_FRAMES];
+    int depth;
+    unsigned long count;
+    size_t size;
+};
+
+static volatile sig_atomic_t armed = 0;
+static unsigned long total = 0;
+static struct stack stacks[MAX_STACKS];
+static int stack_number = 0;
+/* 不同线程可能同时分配，记录调用栈时用一个自旋锁保护 */
+static volatile int record_lock = 0;
+/* backtrace内部也可能分配，防止递归 */
+static __thread int in_hook = 0;
+
+static void record(size_t size)
+{
+    if(!armed || in_hook){
+        return;
+    }
+    in_hook = 1;
+    void *frames[MAX_FRAMES];
+    /* 跳过record和分配函数本身 */
+    int depth = backtrace(frames, MAX_FRAMES) - 2;
+    while(__sync_lock_test_and_set(&record_lock, 1)){
+    }
+    ++total;
+    int i;
+    for(i = 0; i < stack_number; ++i){
+        if(stacks[i].depth == depth && memcmp(stacks[i].frames, frames + 2, depth * sizeof(void *)) == 0){
+            break;
+        }
+    }
+    if(i == stack_number && stack_number < MAX_STACKS){
+        memcpy(stacks[i].frames, frames + 2, depth * sizeof(void *));
+        stacks[i].depth = depth;
+        ++stack_number;
+    }
+    if(i < stack_number){
+        ++stacks[i].count;
+        stacks[i].size = size;
+    }
+    __sync_lock_release(&record_lock);
+    in_hook = 0;
+}
+
+void *malloc(size_t size)
+{
+    record(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    record(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    record(size);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    record(size);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : 12; /* ENOMEM */
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    record(size);
+    return __libc_memalign(alignment, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+static void toggle(int sig)
+{
+    (void)sig;
+    armed = !armed;
+}
+
+__attribute__((constructor)) static void alloc_count_init(void)
+{
+    /* 第一次调用backtrace时会加载libgcc_s，提前调用，不计入统计 */
+    void *frames[2];
+    backtrace(frames, 2);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = toggle;
+    sa.sa_flags = SA_RESTART;
+    sigaction(ALLOC_SIGNAL, &sa, NULL);
+}
+
+__attribute__((destructor)) static void alloc_count_report(void)
+{
+    const char *file = getenv("ALLOC_REPORT");
+    int fd = file ? open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644) : 2;
+    if(fd < 0){
+        return;
+    }
+    armed = 0;
+    dprintf(fd, "allocations %lu\n", total);
+    for(int i = 0; i < stack_number; ++i){
+        dprintf(fd, "stack %lu %zu\n", stacks[i].count, stacks[i].size);
+        backtrace_symbols_fd(stacks[i].frames, stacks[i].depth, fd);
+    }
+    if(fd != 2){
+        close(fd);
+    }
+}
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+# 请求路径零分配测试：用LD_PRELOAD把libAllocCount.so加载到WebServer中，在一个保持连接上先发一些请求预热，
+# 然后开始统计，再发送完整的和分两次到达的静态文件GET请求，要求统计期间没有任何堆分配。
+# 分别在模拟Proactor、Reactor、没有线程池和非ONESHOT几种模式下运行。有分配时打印每个调用栈，用addr2line还原函数名
+#
+# 用法: alloc_test.py --server path/WebServer --preload path/libAllocCount.so [--requests 1000]
+
+import argparse
+import os
+import re
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+# 与AllocCount.c中的ALLOC_SIGNAL一致
+ALLOC_SIGNAL = signal.SIGRTMIN + 1
+MODES = [("proactor", []), ("reactor", ["-a", "1"]), ("no_pool", ["-t", "0"]), ("reactor_no_oneshot", ["-o", "0", "-a", "1"])]
+REQUEST = b"GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def wait_listening(port, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=0.2).close()
+            return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def get(sock, split=False):
+    """发一个请求并读完应答。split为True时请求分两次发送，服务器先解析到不完整的请求"""
+    if split:
+        sock.sendall(REQUEST[:20])
+        time.sleep(0.002)
+        sock.sendall(REQUEST[20:])
+    else:
+        sock.sendall(REQUEST)
+    data = b""
+    while True:
+        chunk = sock.recv(65536)
+        if not chunk:
+            raise RuntimeError("connection closed by the server")
+        data += chunk
+        head, sep, body = data.partition(b"\r\n\r\n")
+        if not sep:
+            continue
+        if not head.startswith(b"HTTP/1.1 200"):
+            raise RuntimeError(f"unexpected response: {head[:80]!r}")
+        length = re.search(rb"(?i)content-length:\s*(\d+)", head)
+        if length and len(body) >= int(length.group(1)):
+            return
+
+
+def symbolize(line):
+    """把backtrace_symbols_fd输出的"模块(+偏移)[地址]"还原成函数名和行号"""
+    m = re.match(r"(.*)\(\+(0x[0-9a-f]+)\)\[", line)
+    if not m or not shutil.which("addr2line"):
+        return line
+    out = subprocess.run(["addr2line", "-C", "-f", "-p", "-e", m.group(1), m.group(2)], capture_output=True, text=True)
+    return out.stdout.strip() or line
+
+
+def run_mode(args, name, options, work):
+    report = os.path.join(work, f"{name}.alloc")
+    env = dict(os.environ, LD_PRELOAD=os.path.abspath(args.preload), ALLOC_REPORT=report)
+    port = free_port()
+    log = open(os.path.join(work, f"{name}.log"), "w")
+    server = subprocess.Popen([args.server, "-r", work] + options + ["127.0.0.1", str(port)], env=env,
+                              stdout=log, stderr=subprocess.STDOUT)
+    try:
+        if not wait_listening(port):
+            raise RuntimeError(f"server did not start, see {log.name}")
+        with socket.create_connection(("127.0.0.1", port)) as sock:
+            for i in range(args.warmup):
+                get(sock, split=i % 10 == 0)
+            server.send_signal(ALLOC_SIGNAL)
+            time.sleep(0.1)
+            for i in range(args.requests):
+                get(sock, split=i % 10 == 0)
+            time.sleep(0.1)
+            server.send_signal(ALLOC_SIGNAL)
+            time.sleep(0.1)
+    finally:
+        server.send_signal(signal.SIGINT)
+        try:
+            server.wait(timeout=10)
+        except subprocess.TimeoutExpired:
+            server.kill()
+            server.wait()
+        log.close()
+
+    with open(report) as f:
+        lines = f.read().splitlines()
+    total = int(lines[0].split()[1])
+    print(f"{name}: {total} allocations in {args.requests} requests")
+    for line in lines[1:]:
+        if line.startswith("stack "):
+            _, count, size = line.split()
+            print(f"  {count} x {size} bytes at:")
+        else:
+            print(f"    {symbolize(line)}")
+    return total
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check that serving keep-alive static GETs allocates no memory")
+    parser.add_argument("--server", required=True)
+    parser.add_argument("--preload", required=True, help="path of libAllocCount.so")
+    parser.add_argument("--requests", type=int, default=1000, help="requests while counting")
+    parser.add_argument("--warmup", type=int, default=200, help="requests before counting")
+    args = parser.parse_args()
+
+    work = tempfile.mkdtemp(prefix="webserver-alloc-")
+    with open(os.path.join(work, "index.html"), "wb") as f:
+        f.write(b"x" * 4096)
+    failed = False
+    try:
+        for name, options in MODES:
+            try:
+                failed |= run_mode(args, name, options, work) > 0
+            except (RuntimeError, OSError) as e:
+                print(f"{name}: {e}", file=sys.stderr)
+                failed = True
+    finally:
+        shutil.rmtree(work, ignore_errors=True)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
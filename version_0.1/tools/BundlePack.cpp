@@ -0,0 +1,238 @@
+//
+// 把网站根目录打包成StaticBundle资源包
+// 用法: BundlePack [-z] doc_root output_file
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "StaticBundle.h"
+#ifdef BUNDLE_GZIP
+#include <zlib.h>
+#endif
+
+struct PackFile{
+    std::string path;
+    std::string full_path;
+    std::string header;
+    std::string data;
+    std::string gzip_header;
+    std::string gzip;
+};
+
+static std::vector<PackFile> files;
+static size_t doc_root_len = 0;
+
+static const char *content_type(const std::string &path){
+    static const char *types[][2] = {
+        {".html", "text/html"}, {".htm", "text/html"}, {".css", "text/css"},
+        {".js", "application/javascript"}, {".json", "application/json"}, {".txt", "text/plain"},
+        {".xml", "application/xml"}, {".svg", "image/svg+xml"}, {".png", "image/png"},
+        {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"}, {".gif", "image/gif"},
+        {".ico", "image/x-icon"}, {".webp", "image/webp"}, {".woff2", "font/woff2"},
+    };
+    size_t dot = path.rfind('.');
+    if(dot != std::string::npos){
+        for(size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i){
+            if(strcasecmp(path.c_str() + dot, types[i][0]) == 0){
+                return types[i][1];
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+//只有文本类的资源才值得预压缩
+static bool compressible(const char *type){
+    return strncmp(type, "text/", 5) == 0 || strstr(type, "javascript") || strstr(type, "json")
+           || strstr(type, "xml");
+}
+
+static int collect(const char *full_path, const struct stat *file_stat, int type, struct FTW *ftw){
+    //与do_request的规则一致：只打包对所有用户可读的普通文件
+    if(type == FTW_F && S_ISREG(file_stat->st_mode) && (file_stat->st_mode & S_IROTH)){
+        PackFile file;
+        file.full_path = full_path;
+        file.path = full_path + doc_root_len;
+        if(file.path.empty() || file.path[0] != '/'){
+            file.path = "/" + file.path;
+        }
+        files.push_back(file);
+    }
+    return 0;
+}
+
+static bool read_file(PackFile &file){
+    int fd = open(file.full_path.c_str(), O_RDONLY);
+    if(fd < 0){
+        return false;
+    }
+    char buf[65536];
+    ssize_t len = 0;
+    while((len = read(fd, buf, sizeof(buf))) > 0){
+        file.data.append(buf, len);
+    }
+    close(fd);
+    return len == 0;
+}
+
+#ifdef BUNDLE_GZIP
+static bool gzip(const std::string &in, std::string &out){
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    //窗口位数加16表示输出gzip格式而不是zlib格式
+    if(deflateInit2(&stream, 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK){
+        return false;
+    }
+    out.resize(deflateBound(&stream, in.size()));
+    stream.next_in = (Bytef *)in.data();
+    stream.avail_in = in.size();
+    stream.next_out = (Bytef *)&out[0];
+    stream.avail_out = out.size();
+    int ret = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
+#endif
+
+static void align(std::string &buf, size_t alignment){
+    while(buf.size() % alignment){
+        buf.push_back('\0');
+    }
+}
+
+int main(int argc, char *argv[]){
+    bool use_gzip = false;
+    int opt = 0;
+    while((opt = getopt(argc, argv, "z")) != -1){
+        if(opt == 'z'){
+            use_gzip = true;
+        }else{
+            printf("usage: %s [-z] doc_root output_file\n", basename(argv[0]));
+            return 1;
+        }
+    }
+    if(argc - optind < 2){
+        printf("usage: %s [-z] doc_root output_file\n", basename(argv[0]));
+        return 1;
+    }
+#ifndef BUNDLE_GZIP
+    if(use_gzip){
+        printf("BundlePack was built without zlib, -z ignored\n");
+        use_gzip = false;
+    }
+#endif
+
+    std::string doc_root = argv[optind];
+    while(doc_root.size() > 1 && doc_root[doc_root.size() - 1] == '/'){
+        doc_root.erase(doc_root.size() - 1);
+    }
+    doc_root_len = doc_root.size();
+    const char *output = argv[optind + 1];
+    if(nftw(doc_root.c_str(), collect, 64, FTW_PHYS) != 0){
+        perror("nftw");
+        return 1;
+    }
+    //服务器对索引做二分查找，这里按字节序排序
+    std::sort(files.begin(), files.end(), [](const PackFile &a, const PackFile &b){ return a.path < b.path; });
+
+    size_t gzip_count = 0;
+    for(size_t i = 0; i < files.size(); ++i){
+        PackFile &file = files[i];
+        if(!read_file(file)){
+            printf("failed to read %s\n", file.full_path.c_str());
+            return 1;
+        }
+        const char *type = content_type(file.path);
+        char header[256];
+        snprintf(header, sizeof(header), "Content-Length: %zu\r\nContent-Type: %s\r\n", file.data.size(), type);
+        file.header = header;
+#ifdef BUNDLE_GZIP
+        //只保留确实变小了的压缩版本
+        if(use_gzip && compressible(type) && gzip(file.data, file.gzip) && file.gzip.size() < file.data.size()){
+            //两个版本按请求的Accept-Encoding选择，都要带Vary，否则共享缓存可能把gzip版本发给不接受它的客户端
+            snprintf(header, sizeof(header), "Content-Length: %zu\r\nContent-Type: %s\r\nContent-Encoding: gzip\r\n"
+                     "Vary: Accept-Encoding\r\n", file.gzip.size(), type);
+            file.gzip_header = header;
+            file.header += "Vary: Accept-Encoding\r\n";
+            gzip_count++;
+        }else{
+            file.gzip.clear();
+        }
+#endif
+    }
+
+    //先确定索引和字符串区的大小，再计算数据区的偏移
+    std::string strings;
+    std::vector<BundleEntry> entries(files.size());
+    size_t strings_offset = sizeof(BundleHeader) + files.size() * sizeof(BundleEntry);
+    for(size_t i = 0; i < files.size(); ++i){
+        BundleEntry &entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        entry.path_offset = strings_offset + strings.size();
+        entry.path_len = files[i].path.size();
+        strings += files[i].path;
+        entry.header_offset = strings_offset + strings.size();
+        entry.header_len = files[i].header.size();
+        strings += files[i].header;
+        entry.gzip_header_offset = strings_offset + strings.size();
+        entry.gzip_header_len = files[i].gzip_header.size();
+        strings += files[i].gzip_header;
+    }
+    align(strings, 4096);
+
+    //数据区按页对齐，每个文件按64字节对齐
+    std::string data;
+    size_t data_offset = strings_offset + strings.size();
+    for(size_t i = 0; i < files.size(); ++i){
+        entries[i].data_offset = data_offset + data.size();
+        entries[i].data_len = files[i].data.size();
+        data += files[i].data;
+        align(data, 64);
+        if(!files[i].gzip.empty()){
+            entries[i].gzip_offset = data_offset + data.size();
+            entries[i].gzip_len = files[i].gzip.size();
+            data += files[i].gzip;
+            align(data, 64);
+        }
+        //数据已经拷贝进data，释放内存
+        std::string().swap(files[i].data);
+        std::string().swap(files[i].gzip);
+    }
+
+    BundleHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+    header.entry_count = entries.size();
+    header.file_size = data_offset + data.size();
+
+    //先写临时文件再rename，服务器在SIGHUP时打开的总是一个完整的资源包
+    std::string tmp = std::string(output) + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if(!fp){
+        perror("fopen");
+        return 1;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+              && (entries.empty() || fwrite(&entries[0], sizeof(BundleEntry), entries.size(), fp) == entries.size())
+              && fwrite(strings.data(), 1, strings.size(), fp) == strings.size()
+              && fwrite(data.data(), 1, data.size(), fp) == data.size();
+    ok = (fclose(fp) == 0) && ok;
+    if(!ok || rename(tmp.c_str(), output) != 0){
+        perror("write bundle");
+        unlink(tmp.c_str());
+        return 1;
+    }
+    printf("packed %zu files (%zu gzip variants), %llu bytes\n", files.size(), gzip_count,
+           (unsigned long long)header.file_size);
+    return 0;
+}
@@ -0,0 +1,140 @@
+//
+// HTTPS握手压测：分别统计完整握手和会话票据复用握手每秒能完成多少次
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct BenchResult{
+    int handshakes;
+    int failed;
+    int resumed;
+    double handshake_time;
+    double elapsed;
+};
+
+//建立一个HTTPS连接，握手后请求path并读完应答。session不为空时尝试复用它，
+//返回后*session替换为本次连接得到的会话
+static bool one_connection(SSL_CTX *ctx, const sockaddr_in &address, const char *path,
+                           SSL_SESSION **session, BenchResult &result){
+    int sock_fd = socket(PF_INET, SOCK_STREAM, 0);
+    if(sock_fd < 0){
+        return false;
+    }
+    int nodelay = 1;
+    setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    if(connect(sock_fd, (const sockaddr *)&address, sizeof(address)) < 0){
+        close(sock_fd);
+        return false;
+    }
+
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, sock_fd);
+    if(*session){
+        SSL_set_session(ssl, *session);
+    }
+
+    double start = now();
+    bool ok = SSL_connect(ssl) == 1;
+    result.handshake_time += now() - start;
+    if(ok){
+        if(SSL_session_reused(ssl)){
+            result.resumed++;
+        }
+        char request[512];
+        int len = snprintf(request, sizeof(request),
+                           "GET %s HTTP/1.1\r\nHost: bench\r\nConnection: close\r\n\r\n", path);
+        ok = SSL_write(ssl, request, len) == len;
+        char buf[16384];
+        //TLS1.3的会话票据在握手之后才下发，读应答时由SSL_read处理
+        while(ok && SSL_read(ssl, buf, sizeof(buf)) > 0){
+        }
+        SSL_SESSION *new_session = SSL_get1_session(ssl);
+        if(new_session){
+            if(*session){
+                SSL_SESSION_free(*session);
+            }
+            *session = new_session;
+        }
+    }
+    //不调用SSL_shutdown就释放的会话会被标记为不可复用
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(sock_fd);
+    ERR_clear_error();
+    return ok;
+}
+
+static BenchResult run(SSL_CTX *ctx, const sockaddr_in &address, const char *path, double seconds, bool resume){
+    BenchResult result;
+    memset(&result, 0, sizeof(result));
+    SSL_SESSION *session = NULL;
+    double start = now();
+    while(now() - start < seconds){
+        SSL_SESSION **use = resume ? &session : NULL;
+        SSL_SESSION *none = NULL;
+        if(one_connection(ctx, address, path, use ? use : &none, result)){
+            result.handshakes++;
+        }else{
+            result.failed++;
+        }
+        if(none){
+            SSL_SESSION_free(none);
+        }
+    }
+    result.elapsed = now() - start;
+    if(session){
+        SSL_SESSION_free(session);
+    }
+    return result;
+}
+
+static void report(const char *name, const BenchResult &result){
+    printf("%-8s handshakes: %d, failed: %d, resumed: %d, %.1f handshakes/sec, %.3f ms per handshake\n",
+           name, result.handshakes, result.failed, result.resumed, result.handshakes / result.elapsed,
+           result.handshakes ? result.handshake_time * 1000 / result.handshakes : 0.0);
+}
+
+int main(int argc, char *argv[]){
+    if(argc < 3){
+        printf("usage: %s ip_address port_number [seconds] [path]\n", basename(argv[0]));
+        return 1;
+    }
+    const char *ip = argv[1];
+    int port = atoi(argv[2]);
+    double seconds = argc > 3 ? atof(argv[3]) : 5;
+    const char *path = argc > 4 ? argv[4] : "/index.html";
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    address.sin_port = htons(port);
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    //压测本地服务器，不校验证书
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+
+    report("full", run(ctx, address, path, seconds, false));
+    report("resumed", run(ctx, address, path, seconds, true));
+
+    SSL_CTX_free(ctx);
+    return 0;
+}
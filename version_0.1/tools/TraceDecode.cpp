@@ -0,0 +1,167 @@
+//
+// 解析WebServer -x写出的请求跟踪文件，输出各阶段耗时的分布和最慢的请求
+// 用法: TraceDecode trace_file [slowest_number]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "Trace.h"
+
+//每个阶段的名字，耗时指从上一个经过的阶段到这个阶段的时间
+static const char *phase_names[PHASE_NUMBER] = {
+    "start", "read", "queued", "process", "parsed", "resolved", "write", "sent"
+};
+static const char *phase_help[PHASE_NUMBER] = {
+    "",
+    "waiting for the request (from accept or the previous response)",
+    "main thread, from read to enqueue",
+    "waiting in the thread pool queue (or in the event loop without one)",
+    "parsing",
+    "do_request: file lookup, stat and mmap",
+    "building the response headers",
+    "sending, including EPOLLOUT waits",
+};
+
+//一个请求各阶段的耗时，没有经过的阶段为-1。阶段按实际发生的时间排序，
+//Reactor模式下读操作发生在出队之后，耗时仍然计入实际在它之前的那个阶段之后
+static void split(const TraceRecord &record, int64_t segment[PHASE_NUMBER]){
+    int order[PHASE_NUMBER];
+    int n = 0;
+    for(int p = 0; p < PHASE_NUMBER; ++p){
+        segment[p] = -1;
+        if(p == T_START || record.phase[p]){
+            order[n++] = p;
+        }
+    }
+    std::stable_sort(order, order + n, [&record](int a, int b){
+        return (a == T_START ? 0 : record.phase[a]) < (b == T_START ? 0 : record.phase[b]);
+    });
+    for(int i = 1; i < n; ++i){
+        uint32_t prev = order[i - 1] == T_START ? 0 : record.phase[order[i - 1]];
+        segment[order[i]] = record.phase[order[i]] - prev;
+    }
+}
+
+//服务时间：从读到请求到应答发送完，不包括保持的连接上等待下一个请求的时间
+static int64_t service_time(const TraceRecord &record){
+    if(!record.phase[T_SENT]){
+        return -1;
+    }
+    uint32_t begin = record.phase[T_READ] ? record.phase[T_READ] : 0;
+    return (int64_t)record.phase[T_SENT] - begin;
+}
+
+static int64_t percentile(std::vector<int64_t> &values, double p){
+    size_t idx = (size_t)(p * (values.size() - 1));
+    return values[idx];
+}
+
+static void print_row(const char *name, std::vector<int64_t> &values, const char *help){
+    if(values.empty()){
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    double sum = 0;
+    for(size_t i = 0; i < values.size(); ++i){
+        sum += values[i];
+    }
+    printf("%-9s %9zu %10.1f %10.1f %10.1f %10.1f %10.1f  %s\n", name, values.size(), sum / values.size() / 1000,
+           percentile(values, 0.5) / 1000.0, percentile(values, 0.9) / 1000.0, percentile(values, 0.99) / 1000.0,
+           values.back() / 1000.0, help);
+}
+
+int main(int argc, char *argv[]){
+    if(argc < 2){
+        printf("usage: %s trace_file [slowest_number]\n", argv[0]);
+        return 1;
+    }
+    int slowest_number = argc > 2 ? atoi(argv[2]) : 10;
+
+    FILE *fp = fopen(argv[1], "rb");
+    if(!fp){
+        perror(argv[1]);
+        return 1;
+    }
+    TraceFileHeader header;
+    if(fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0){
+        printf("%s is not a trace file\n", argv[1]);
+        fclose(fp);
+        return 1;
+    }
+    if(header.record_size != sizeof(TraceRecord) || header.phase_number != PHASE_NUMBER){
+        printf("%s was written by an incompatible version (record size %u, %u phases)\n",
+               argv[1], header.record_size, header.phase_number);
+        fclose(fp);
+        return 1;
+    }
+    std::vector<TraceRecord> records;
+    TraceRecord record;
+    while(fread(&record, sizeof(record), 1, fp) == 1){
+        record.url[sizeof(record.url) - 1] = '\0';
+        records.push_back(record);
+    }
+    fclose(fp);
+    printf("%zu requests\n\n", records.size());
+    if(records.empty()){
+        return 0;
+    }
+
+    std::vector<int64_t> phases[PHASE_NUMBER];
+    std::vector<int64_t> totals;
+    for(size_t i = 0; i < records.size(); ++i){
+        int64_t segment[PHASE_NUMBER];
+        split(records[i], segment);
+        for(int p = 1; p < PHASE_NUMBER; ++p){
+            if(segment[p] >= 0){
+                phases[p].push_back(segment[p]);
+            }
+        }
+        int64_t total = service_time(records[i]);
+        if(total >= 0){
+            totals.push_back(total);
+        }
+    }
+    printf("%-9s %9s %10s %10s %10s %10s %10s  (microseconds)\n", "phase", "count", "mean", "p50", "p90", "p99", "max");
+    for(int p = 1; p < PHASE_NUMBER; ++p){
+        print_row(phase_names[p], phases[p], phase_help[p]);
+    }
+    print_row("service", totals, "from read to sent");
+
+    //按服务时间列出最慢的请求
+    std::vector<size_t> order;
+    for(size_t i = 0; i < records.size(); ++i){
+        if(service_time(records[i]) >= 0){
+            order.push_back(i);
+        }
+    }
+    size_t shown = std::min(order.size(), (size_t)(slowest_number > 0 ? slowest_number : 0));
+    std::partial_sort(order.begin(), order.begin() + shown, order.end(), [&records](size_t a, size_t b){
+        return service_time(records[a]) > service_time(records[b]);
+    });
+    if(shown){
+        printf("\nslowest %zu requests (microseconds):\n%-7s %-4s %8s %9s", shown, "pid", "code", "bytes", "service");
+        for(int p = 1; p < PHASE_NUMBER; ++p){
+            printf(" %9s", phase_names[p]);
+        }
+        printf("  url\n");
+    }
+    for(size_t i = 0; i < shown; ++i){
+        const TraceRecord &r = records[order[i]];
+        int64_t segment[PHASE_NUMBER];
+        split(r, segment);
+        printf("%-7u %-4u %8u %9.1f", r.pid, r.status, r.bytes, service_time(r) / 1000.0);
+        for(int p = 1; p < PHASE_NUMBER; ++p){
+            if(segment[p] >= 0){
+                printf(" %9.1f", segment[p] / 1000.0);
+            }else{
+                printf(" %9s", "-");
+            }
+        }
+        printf("  %s\n", r.url);
+    }
+    return 0;
+}